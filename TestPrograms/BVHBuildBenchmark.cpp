@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <tbb/global_control.h>
+
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/Light.hpp"
+#include "libraries/Scene/include/World.hpp"
+#include "libraries/Utility/include/BVH.hpp"
+#include "libraries/Utility/include/Transformations.hpp"
+
+using namespace raytracer;
+using namespace utility;
+using namespace scene;
+
+// Measures how the hierarchy build scales with the number of worker threads for both build methods. The bunny is
+// built as is and then replicated on a grid to get inputs in the range of large production meshes. Afterwards the
+// bunny is rendered with either hierarchy to compare what the faster build costs at trace time.
+constexpr int RUNS_PER_MEASUREMENT = 3;
+constexpr unsigned int TRACE_RESOLUTION = 400;
+
+static std::vector<AABB> replicate(const std::vector<AABB> &bounds, const int copiesPerAxis) {
+  AABB meshBounds = AABB::empty();
+  for (const auto &box : bounds) {
+    meshBounds.expandToInclude(box);
+  }
+  const Tuple spacing = (meshBounds.max - meshBounds.min) * 1.1f;
+
+  std::vector<AABB> replicated;
+  replicated.reserve(bounds.size() * copiesPerAxis * copiesPerAxis * copiesPerAxis);
+  for (int x = 0; x < copiesPerAxis; ++x) {
+    for (int y = 0; y < copiesPerAxis; ++y) {
+      for (int z = 0; z < copiesPerAxis; ++z) {
+        const Tuple offset = Vector(spacing.x * x, spacing.y * y, spacing.z * z);
+        for (const auto &box : bounds) {
+          replicated.push_back(AABB(box.min + offset, box.max + offset));
+        }
+      }
+    }
+  }
+  return replicated;
+}
+
+// Best of a few runs, the first build also pays for spinning up the worker threads
+static double measureBuildMilliseconds(const std::vector<AABB> &bounds, const BVHBuildMethod method,
+                                       size_t &nodeCount) {
+  double best = INFINITY;
+  for (int run = 0; run < RUNS_PER_MEASUREMENT; ++run) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    const BVH bvh = buildBVH(bounds, method);
+    const auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    nodeCount = bvh.nodes.size();
+  }
+  return best;
+}
+
+static void compareTracePerformance(World &world, const size_t meshIndex) {
+  const auto instance = addMeshInstance(world, meshIndex);
+  world.objects[instance].MaterialIndex = static_cast<int16_t>(addMaterial(world, material::createDefaultMaterial()));
+
+  const AABB &bounds = world.objects[instance].boundingBox;
+  const Tuple center = bounds.centroid();
+  const float extent = std::max({bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z});
+  addLight(world, PointLight{Color(1.0f, 1.0f, 1.0f), center + Vector(-3.0f * extent, 3.0f * extent, 3.0f * extent)});
+  buildAccelerationStructure(world);
+
+  Camera camera(TRACE_RESOLUTION, TRACE_RESOLUTION, 1.0f);
+  camera.setTransform(
+      transformations::view_transform(center + Vector(0.0f, 0.0f, 2.0f * extent), center, Vector(0.0f, 1.0f, 0.0f)));
+
+  std::cout << "bunny trace at " << TRACE_RESOLUTION << "x" << TRACE_RESOLUTION << '\n';
+  for (const auto &[name, method] : {std::pair{"SAH", BVHBuildMethod::SAH}, std::pair{"Linear", BVHBuildMethod::Linear}}) {
+    setMeshBuildMethod(world, meshIndex, method);
+    double best = INFINITY;
+    for (int run = 0; run < RUNS_PER_MEASUREMENT; ++run) {
+      const auto start = std::chrono::high_resolution_clock::now();
+      camera.render(world);
+      const auto end = std::chrono::high_resolution_clock::now();
+      best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+    }
+    std::cout << "  " << name << ": " << best << " ms, SAH cost " << computeSAHCost(world.meshData[meshIndex].bvh)
+              << '\n';
+  }
+}
+
+int main() {
+  World world;
+  const auto meshIndex = loadMesh(world, "stanford-bunny.obj");
+  if (!meshIndex.has_value()) {
+    std::cerr << "Could not load stanford-bunny.obj, run this from the repository root\n";
+    return 1;
+  }
+
+  const MeshData &mesh = world.meshData[*meshIndex];
+  std::vector<AABB> bunnyBounds;
+  bunnyBounds.reserve(mesh.triangleCount);
+  for (int32_t i = mesh.firstTriangleIndex; i < mesh.firstTriangleIndex + mesh.triangleCount; ++i) {
+    const TriangleData &tri = world.triangleData[i];
+    AABB bounds(tri.v0, tri.v1);
+    bounds.expandToInclude(tri.v2);
+    bunnyBounds.push_back(bounds);
+  }
+
+  const std::vector<std::pair<const char *, std::vector<AABB>>> inputs = {
+      {"bunny", bunnyBounds},
+      {"bunny x8", replicate(bunnyBounds, 2)},
+      {"bunny x27", replicate(bunnyBounds, 3)},
+  };
+
+  std::vector<size_t> threadCounts;
+  const size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  for (size_t threads = 1; threads < maxThreads; threads *= 2) {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(maxThreads);
+
+  for (const auto &[name, bounds] : inputs) {
+    std::cout << name << " (" << bounds.size() << " triangles)\n";
+    for (const auto &[methodName, method] :
+         {std::pair{"SAH", BVHBuildMethod::SAH}, std::pair{"Linear", BVHBuildMethod::Linear}}) {
+      double singleThreaded = 0.0;
+      for (const size_t threads : threadCounts) {
+        tbb::global_control threadLimit(tbb::global_control::max_allowed_parallelism, threads);
+        size_t nodeCount = 0;
+        const double milliseconds = measureBuildMilliseconds(bounds, method, nodeCount);
+        if (threads == 1) {
+          singleThreaded = milliseconds;
+        }
+        std::cout << "  " << methodName << ", " << threads << " threads: " << milliseconds << " ms, speedup "
+                  << singleThreaded / milliseconds << ", " << nodeCount << " nodes\n";
+      }
+    }
+  }
+
+  compareTracePerformance(world, *meshIndex);
+
+  return 0;
+}
@@ -1,7 +1,14 @@
 #include <iostream>
+#include <atomic>
 #include <cmath>
 #include <string>
 #include <numbers>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
 
 #include "libraries/Utility/include/Tuple.hpp"
 #include "libraries/Canvas/include/Canvas.hpp"
@@ -12,8 +19,17 @@
 #include "libraries/Material/include/Material.hpp"
 #include "libraries/Material/include/Pattern.hpp"
 #include "libraries/Scene/include/World.hpp"
+#include "libraries/Scene/include/MeshCache.hpp"
+#include "libraries/Utility/include/Hash.hpp"
+#include "libraries/Utility/include/MappedFile.hpp"
 #include "libraries/Geometry/include/Shape.hpp"
 #include "libraries/Scene/include/Renderer.hpp"
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/ProgressiveRender.hpp"
+#include "libraries/Scene/include/Sequence.hpp"
+#include "libraries/Scene/include/Wavefront.hpp"
+
+#include <tbb/task_arena.h>
 
 using namespace raytracer;
 using namespace material;
@@ -86,6 +102,12 @@ int failedTests = 0;
     throw std::runtime_error("Colors not equal"); \
   }
 
+// Bit for bit, for renders that have to reproduce another render exactly
+#define ASSERT_COLOR_IDENTICAL(c1, c2) \
+  if ((c1).red() != (c2).red() || (c1).green() != (c2).green() || (c1).blue() != (c2).blue()) { \
+    throw std::runtime_error("Colors not identical"); \
+  }
+
 // =================== Basic Ray-Sphere Intersection Tests ===================
 
 TEST(RayIntersectsSphereAtTwoPoints) {
@@ -309,6 +331,30 @@ TEST(LightingWithSurfaceInShadow) {
   ASSERT_NEAR(color.red(), 0.1, 0.01);
 }
 
+TEST(ObjectWithoutShadowDoesNotBlockLight) {
+  World world;
+
+  WorldObject sphere1{ShapeTypeTag{ShapeType::Sphere}};
+  sphere1.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_blocker = addObject(world, sphere1);
+  setObjectShadow(world, idx_blocker, false);
+
+  WorldObject sphere2{ShapeTypeTag{ShapeType::Sphere}};
+  auto material = createDefaultMaterial();
+  material.ambient = 0.1;
+  sphere2.MaterialIndex = addMaterial(world, material);
+  auto idx_lit = addObject(world, sphere2);
+  addTransformToObject(world, idx_lit, transformations::translation(0, 0, 10));
+
+  addLight(world, PointLight(Color(1,1,1), Point(0,0,-10)));
+
+  // The shadow query is the same with and without the hierarchy
+  Ray ray(Point(0, 0, 5), Vector(0, 0, 1));
+  ASSERT_GT(colorAt(ray, world, 5).red(), 0.5);
+  buildAccelerationStructure(world);
+  ASSERT_GT(colorAt(ray, world, 5).red(), 0.5);
+}
+
 // =================== Reflection Tests ===================
 
 TEST(ReflectingOffNonReflectiveSurface) {
@@ -485,6 +531,92 @@ TEST(RefractedColorWithRefractedRay) {
   ASSERT_GT(color.red(), 0.0);
 }
 
+TEST(MediaAtRayOriginTracksNestedObjects) {
+  World world;
+  auto material = createDefaultMaterial();
+  material.transparency = 1.0;
+  material.refractiveIndex = 1.5;
+  WorldObject outer{ShapeTypeTag{ShapeType::Sphere}};
+  outer.MaterialIndex = addMaterial(world, material);
+  auto idx_outer = addObject(world, outer);
+  addTransformToObject(world, idx_outer, transformations::scaling(2, 2, 2));
+  material.refractiveIndex = 2.0;
+  WorldObject inner{ShapeTypeTag{ShapeType::Sphere}};
+  inner.MaterialIndex = addMaterial(world, material);
+  addObject(world, inner);
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+
+  ASSERT_EQ(mediaAt(Ray(Point(0, 0, -5), Vector(0, 0, 1)), world).size, 0u);
+  ASSERT_EQ(mediaAt(Ray(Point(0, 0, -1.5), Vector(0, 0, 1)), world).size, 1u);
+  auto media = mediaAt(Ray(Point(0, 0, 0), Vector(0, 0, 1)), world);
+  ASSERT_EQ(media.size, 2u);
+  ASSERT_TRUE(floatNearlyEqual(media.refractiveIndex(world), 2.0f));
+
+  // Looking the media up front or on the first transparent hit gives the same result
+  Ray ray(Point(0, 0, -1.5), Vector(0, 0.3, 1).normalize());
+  ASSERT_EQ(colorAt(ray, world, 5), colorAt(ray, world, mediaAt(ray, world), 5));
+}
+
+TEST(MediaAtRayOriginInsideMesh) {
+  // A closed cube mesh filled with water, around the smaller glass sphere
+  const auto cubePath = std::filesystem::temp_directory_path() / "raytracer_media_cube.obj";
+  {
+    std::ofstream cube(cubePath);
+    cube << "v -1 -1 -1\nv 1 -1 -1\nv 1 1 -1\nv -1 1 -1\nv -1 -1 1\nv 1 -1 1\nv 1 1 1\nv -1 1 1\n"
+            "f 1 3 2\nf 1 4 3\nf 5 6 7\nf 5 7 8\nf 1 2 6\nf 1 6 5\nf 4 7 3\nf 4 8 7\nf 1 5 8\nf 1 8 4\n"
+            "f 2 3 7\nf 2 7 6\n";
+  }
+  World world;
+  const auto meshIndex = loadMesh(world, cubePath.string());
+  std::filesystem::remove(cubePath);
+  ASSERT_TRUE(meshIndex.has_value());
+  auto water = createDefaultMaterial();
+  water.transparency = 1.0;
+  water.refractiveIndex = 1.33;
+  const auto idx_cube = addMeshInstance(world, *meshIndex, transformations::scaling(3, 3, 3));
+  world.objects[idx_cube].MaterialIndex = addMaterial(world, water);
+  auto glass = createDefaultMaterial();
+  glass.transparency = 1.0;
+  glass.refractiveIndex = 1.5;
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, glass);
+  addObject(world, sphere);
+  buildAccelerationStructure(world);
+
+  ASSERT_EQ(mediaAt(Ray(Point(0, 0, -5), Vector(0, 0, 1)), world).size, 0u);
+  // The camera in the water looks at the sphere
+  auto media = mediaAt(Ray(Point(0.5, 0.2, -2), Vector(0, 0, 1)), world);
+  ASSERT_EQ(media.size, 1u);
+  ASSERT_TRUE(media.objects[0] == &world.objects[idx_cube]);
+  ASSERT_TRUE(floatNearlyEqual(media.refractiveIndex(world), 1.33f));
+  media = mediaAt(Ray(Point(0.1, 0.2, 0), Vector(0.3, 0, 1).normalize()), world);
+  ASSERT_EQ(media.size, 2u);
+  ASSERT_TRUE(floatNearlyEqual(media.refractiveIndex(world), 1.5f));
+}
+
+TEST(ContributionThresholdCutsOffWeakRays) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  auto material = createDefaultMaterial();
+  material.reflectance = 0.3;
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, material);
+  addObject(world, sphere);
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, material);
+  auto idx_floor = addObject(world, floor);
+  addTransformToObject(world, idx_floor, transformations::translation(0, -1, 0));
+
+  // Reflected off the floor into the sphere
+  Ray ray(Point(0, 0, -6), Vector(0, -1, 3).normalize());
+  const auto full = colorAt(ray, world, MediumStack{}, 5, 0.0f);
+  ASSERT_NE(full, colorAt(ray, world, 1));
+  // The reflected rays carry 30% of the color at most, so they are all cut off
+  ASSERT_COLOR_EQ(colorAt(ray, world, MediumStack{}, 5, 0.5f), colorAt(ray, world, 1));
+  // Second bounces carry 9%
+  ASSERT_COLOR_EQ(colorAt(ray, world, MediumStack{}, 5, 0.1f), colorAt(ray, world, 2));
+}
+
 // =================== Fresnel Effect Tests ===================
 
 TEST(SchlickApproximationUnderTotalInternalReflection) {
@@ -637,6 +769,965 @@ TEST(MultipleIntersections) {
   ASSERT_TRUE(color.red() < 0.3);
 }
 
+TEST(ClosestHitIgnoresObjectsBehindRayAndFurtherAway) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+
+  // Added furthest first so the closest hit is not simply the first one found
+  const Color colors[] = {Color(0, 0, 1), Color(1, 0, 0), Color(0, 1, 0)};
+  const float offsets[] = {6, 3, 0};
+  for (int i = 0; i < 3; ++i) {
+    WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+    auto material = createDefaultMaterial();
+    material.surfaceColor = colors[i];
+    sphere.MaterialIndex = addMaterial(world, material);
+    auto idx_loop = addObject(world, sphere);
+    addTransformToObject(world, idx_loop, transformations::translation(0, 0, offsets[i]));
+  }
+
+  // Starts between the green sphere behind it and the red one in front
+  Ray ray(Point(0, 0, 1.5), Vector(0, 0, 1));
+  auto color = colorAt(ray, world, 5);
+
+  ASSERT_GT(color.red(), color.green());
+  ASSERT_GT(color.red(), color.blue());
+}
+
+// =================== Camera Tests ===================
+
+TEST(TiledRenderDoesNotDependOnTileSizeOrThreads) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  for (int i = 0; i < 3; ++i) {
+    WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+    auto material = createDefaultMaterial();
+    material.surfaceColor = Color(0.3 * i, 0.5, 1 - 0.3 * i);
+    material.reflectance = 0.3;
+    sphere.MaterialIndex = addMaterial(world, material);
+    auto idx_loop = addObject(world, sphere);
+    addTransformToObject(world, idx_loop, transformations::translation(2.5 * (i - 1), 0, 0));
+  }
+
+  // 37 x 23 pixels leave partial tiles along the right and bottom edges
+  Camera camera(37, 23, 1.2f);
+  camera.setTransform(transformations::view_transform(Point(0, 1, -6), Point(0, 0, 0), Vector(0, 1, 0)));
+  camera.setTileSize(1);
+  camera.setThreadCount(1);
+  const auto reference = camera.render(world);
+
+  camera.setTileSize(8);
+  camera.setThreadCount(0);
+  const auto tiled = camera.render(world);
+  for (size_t y = 0; y < 23; ++y) {
+    for (size_t x = 0; x < 37; ++x) {
+      ASSERT_EQ(tiled.pixelAt(x, y), reference.pixelAt(x, y));
+    }
+  }
+}
+
+TEST(PacketTracingMatchesSingleRays) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,10)));
+  const auto meshIndex = loadMesh(world, "suzanne.obj");
+  ASSERT_TRUE(meshIndex.has_value());
+  const auto meshMaterial = addMaterial(world, createDefaultMaterial());
+  for (int i = 0; i < 3; ++i) {
+    const auto instance = addMeshInstance(world, *meshIndex,
+                                          transformations::translation(2.5 * (i - 1), 0, 0) *
+                                              transformations::rotation_y(0.4 * i));
+    world.objects[instance].MaterialIndex = meshMaterial;
+  }
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  auto floorMaterial = createDefaultMaterial();
+  floorMaterial.reflectance = 0.5;
+  floor.MaterialIndex = addMaterial(world, floorMaterial);
+  auto idx_floor = addObject(world, floor);
+  addTransformToObject(world, idx_floor, transformations::translation(0, -1, 0));
+
+  Camera camera(41, 29, 1.2f);
+  camera.setTransform(transformations::view_transform(Point(0.5, 1.5, 6), Point(0, 0, 0), Vector(0, 1, 0)));
+  for (const bool accelerated : {false, true}) {
+    if (accelerated) {
+      buildAccelerationStructure(world);
+    }
+    camera.setPacketTracing(false);
+    const auto single = camera.render(world);
+    camera.setPacketTracing(true);
+    const auto packets = camera.render(world);
+    for (size_t y = 0; y < 29; ++y) {
+      for (size_t x = 0; x < 41; ++x) {
+        ASSERT_COLOR_EQ(packets.pixelAt(x, y), single.pixelAt(x, y));
+      }
+    }
+  }
+}
+
+TEST(AdaptiveSupersamplingOnlyRefinesEdges) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  addObject(world, sphere);
+
+  Camera camera(31, 31, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 0, -4), Point(0, 0, 0), Vector(0, 1, 0)));
+  const auto centers = camera.render(world);
+  camera.setMaxSamplesPerPixel(17);
+  const auto adaptive = camera.render(world);
+  const auto samples = camera.samplesPerPixelImage();
+
+  size_t refined = 0;
+  for (size_t y = 0; y < 31; ++y) {
+    for (size_t x = 0; x < 31; ++x) {
+      if (samples.pixelAt(x, y) == Color(0, 0, 0)) {
+        ASSERT_EQ(adaptive.pixelAt(x, y), centers.pixelAt(x, y));
+      } else {
+        ++refined;
+      }
+    }
+  }
+  // The silhouette and the highlight get more rays, the background and most of the sphere do not
+  ASSERT_GT(refined, 0u);
+  ASSERT_LT(refined, 31u * 31u / 2);
+  ASSERT_EQ(samples.pixelAt(0, 0), Color(0, 0, 0));
+  ASSERT_NE(adaptive.pixelAt(15, 8), centers.pixelAt(15, 8));
+}
+
+TEST(CropRenderMatchesFullRender) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  addObject(world, sphere);
+  // A mesh to the right, so the triangle and packet paths make up part of the image
+  const auto meshIndex = loadMesh(world, "suzanne.obj");
+  ASSERT_TRUE(meshIndex.has_value());
+  const auto instance = addMeshInstance(world, *meshIndex, transformations::translation(1.2, -0.5, 0) *
+                                                               transformations::scaling(0.6, 0.6, 0.6));
+  world.objects[instance].MaterialIndex = addMaterial(world, createDefaultMaterial());
+  buildAccelerationStructure(world);
+
+  Camera camera(31, 31, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 0, -4), Point(0, 0, 0), Vector(0, 1, 0)));
+  camera.setMaxSamplesPerPixel(17);
+  const auto full = camera.render(world);
+
+  // One window inside of the image, one reaching past its bottom right corner
+  for (const CropWindow window : {CropWindow{7, 5, 11, 9}, CropWindow{20, 24, 40, 40}}) {
+    const auto crop = camera.renderCrop(world, window);
+    const auto clamped = camera.clampToFrame(window);
+    ASSERT_EQ(crop.width, size_t{clamped.width});
+    ASSERT_EQ(crop.height, size_t{clamped.height});
+    for (size_t y = 0; y < crop.height; ++y) {
+      for (size_t x = 0; x < crop.width; ++x) {
+        ASSERT_COLOR_IDENTICAL(crop.pixelAt(x, y), full.pixelAt(x + clamped.x, y + clamped.y));
+      }
+    }
+  }
+
+  Canvas composite(31, 31);
+  camera.renderCrop(world, CropWindow{7, 5, 11, 9}, composite);
+  ASSERT_COLOR_IDENTICAL(composite.pixelAt(10, 8), full.pixelAt(10, 8));
+  ASSERT_EQ(composite.pixelAt(15, 15), Color(0, 0, 0));
+  ASSERT_EQ(camera.samplesPerPixelImage().width, 11u);
+}
+
+TEST(IncrementalRenderMatchesFullRender) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_floor = addObject(world, floor);
+  addTransformToObject(world, idx_floor, transformations::translation(0, -1, 0));
+  auto mirror = createDefaultMaterial();
+  mirror.reflectance = 0.5;
+  WorldObject left{ShapeTypeTag{ShapeType::Sphere}};
+  left.MaterialIndex = addMaterial(world, mirror);
+  auto idx_left = addObject(world, left);
+  addTransformToObject(world, idx_left, transformations::translation(-1.5, 0, 0));
+  WorldObject right{ShapeTypeTag{ShapeType::Sphere}};
+  right.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_right = addObject(world, right);
+  addTransformToObject(world, idx_right, transformations::translation(1.5, 0, 2) * transformations::scaling(0.5, 0.5, 0.5));
+
+  Camera camera(64, 48, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 1.5, -6), Point(0, 0, 0), Vector(0, 1, 0)));
+  camera.setTileSize(8);
+  camera.setMaxSamplesPerPixel(5);
+  IncrementalRenderCache cache;
+  const auto assertMatchesFullRender = [&] {
+    const auto &incremental = camera.renderIncremental(world, cache);
+    const auto full = camera.render(world);
+    for (size_t y = 0; y < 48; ++y) {
+      for (size_t x = 0; x < 64; ++x) {
+        ASSERT_COLOR_IDENTICAL(incremental.pixelAt(x, y), full.pixelAt(x, y));
+      }
+    }
+  };
+  assertMatchesFullRender();
+  ASSERT_EQ(cache.retracedTiles, 48u);
+  camera.renderIncremental(world, cache);
+  ASSERT_EQ(cache.retracedTiles, 0u);
+
+  // The small sphere moves over the floor and drops its shadow elsewhere, the mirror sphere shows it in a new place
+  addTransformToObject(world, idx_right, transformations::translation(0.5, 0, -1));
+  assertMatchesFullRender();
+  ASSERT_GT(cache.retracedTiles, 0u);
+  ASSERT_LT(cache.retracedTiles, 48u);
+
+  world.materials[world.objects[idx_right].MaterialIndex].surfaceColor = Color(1, 0.2, 0.2);
+  assertMatchesFullRender();
+  ASSERT_LT(cache.retracedTiles, 48u);
+
+  // Only the tiles whose rays hit the mirror sphere, directly or through its reflections, depend on it
+  world.materials[world.objects[idx_left].MaterialIndex].surfaceColor = Color(0.2, 0.4, 1);
+  assertMatchesFullRender();
+  ASSERT_GT(cache.retracedTiles, 0u);
+  ASSERT_LT(cache.retracedTiles, 48u);
+  // The retraced tiles were supersampled, the cached ones have to match that too
+  const auto samples = camera.samplesPerPixelImage();
+  size_t refined = 0;
+  for (size_t y = 0; y < 48; ++y) {
+    for (size_t x = 0; x < 64; ++x) {
+      refined += samples.pixelAt(x, y) != Color(0, 0, 0);
+    }
+  }
+  ASSERT_GT(refined, 0u);
+}
+
+TEST(SequenceRenderMatchesRenderingEveryFrame) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_floor = addObject(world, floor);
+  addTransformToObject(world, idx_floor, transformations::translation(0, -1, 0));
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_sphere = addObject(world, sphere);
+  WorldObject cube{ShapeTypeTag{ShapeType::Cube}};
+  cube.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_cube = addObject(world, cube);
+  addTransformToObject(world, idx_cube, transformations::translation(2, 0, 2));
+
+  const std::vector<Matrix<4,4>> cameraTrack = {
+      transformations::view_transform(Point(0, 1.5, -6), Point(0, 0, 0), Vector(0, 1, 0)),
+      transformations::view_transform(Point(1, 1.5, -6), Point(0, 0, 0), Vector(0, 1, 0))};
+  const std::vector<ObjectTrack> objectTracks = {
+      {idx_sphere, {transformations::translation(-1, 0, 0), transformations::translation(-0.5, 0, 0),
+                    transformations::translation(0, 0.5, 0)}}};
+  std::vector<Canvas> frames;
+  Camera camera(24, 16, 1.0f);
+  const auto timings = renderSequence(camera, world, cameraTrack, objectTracks,
+                                      [&](const Canvas &image, const size_t frame) {
+                                        ASSERT_EQ(frame, frames.size());
+                                        frames.push_back(image);
+                                      });
+  ASSERT_EQ(timings.size(), 3u);
+  ASSERT_EQ(frames.size(), 3u);
+  ASSERT_TRUE(timings[0].rebuilt);
+  ASSERT_FALSE(timings[1].rebuilt);
+
+  // The last frame keeps the last camera transform, and the world keeps the transforms of the last frame
+  ASSERT_TRUE(world.objects[idx_sphere].transform == transformations::translation(0, 0.5, 0));
+  camera.setTransform(cameraTrack.back());
+  const auto expected = camera.render(world);
+  for (size_t y = 0; y < 16; ++y) {
+    for (size_t x = 0; x < 24; ++x) {
+      ASSERT_COLOR_EQ(frames[2].pixelAt(x, y), expected.pixelAt(x, y));
+    }
+  }
+}
+
+TEST(MovingObjectIsBlurredOverTheShutterInterval) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_sphere = addObject(world, sphere);
+  addTransformToObject(world, idx_sphere, transformations::translation(-2, 0, 0));
+  setObjectMotion(world, idx_sphere, transformations::translation(2, 0, 0));
+  buildAccelerationStructure(world);
+  ASSERT_TRUE(hasMovingObjects(world));
+
+  // The ray time picks where the sphere is
+  ASSERT_TRUE(closestHit(Ray(Point(-2, 0, -5), Vector(0, 0, 1), 0.0f), world).object != nullptr);
+  ASSERT_TRUE(closestHit(Ray(Point(-2, 0, -5), Vector(0, 0, 1), 1.0f), world).object == nullptr);
+  ASSERT_TRUE(closestHit(Ray(Point(2, 0, -5), Vector(0, 0, 1), 1.0f), world).object != nullptr);
+  ASSERT_TRUE(closestHit(Ray(Point(0, 0, -5), Vector(0, 0, 1), 0.5f), world).object != nullptr);
+  ASSERT_FALSE(occluded(Ray(Point(0, 0, -5), Vector(0, 0, 1), 0.0f), world, 0.0f, 10.0f));
+  ASSERT_TRUE(occluded(Ray(Point(0, 0, -5), Vector(0, 0, 1), 0.5f), world, 0.0f, 10.0f));
+  const AABB bounds = worldBounds(world, world.objects[idx_sphere]);
+  ASSERT_TRUE(bounds.min.x <= -3.0f && bounds.max.x >= 3.0f);
+
+  // The pixel in the middle is covered for half of the interval, so it ends up between the sphere and the background
+  Camera camera(1, 1, 0.1f);
+  camera.setTransform(transformations::view_transform(Point(0, 0, -5), Point(0, 0, 0), Vector(0, 1, 0)));
+  camera.setMaxSamplesPerPixel(17);
+  const Color blurred = camera.render(world).pixelAt(0, 0);
+  const Color covered = colorAt(Ray(Point(0, 0, -5), Vector(0, 0, 1), 0.5f), world);
+  ASSERT_TRUE(covered.red() > 0.2f);
+  ASSERT_TRUE(blurred.red() > 0.2f * covered.red() && blurred.red() < 0.8f * covered.red());
+
+  // Placed somewhere else, the sphere moves the same way from there
+  setObjectTransform(world, idx_sphere, transformations::translation(-2, 5, 0));
+  updateAccelerationStructure(world);
+  ASSERT_TRUE(closestHit(Ray(Point(-2, 5, -5), Vector(0, 0, 1), 0.0f), world).object != nullptr);
+  ASSERT_TRUE(closestHit(Ray(Point(2, 5, -5), Vector(0, 0, 1), 1.0f), world).object != nullptr);
+  ASSERT_TRUE(closestHit(Ray(Point(2, 0, -5), Vector(0, 0, 1), 1.0f), world).object == nullptr);
+
+  // A moving group moves its members
+  const auto group = addGroup(world, transformations::translation(0, -5, 0));
+  WorldObject member{ShapeTypeTag{ShapeType::Sphere}};
+  member.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  const auto idx_member = addObject(world, member);
+  addObjectToGroup(world, group, idx_member);
+  setObjectMotion(world, group, transformations::translation(3, -5, 0));
+  buildAccelerationStructure(world);
+  ASSERT_TRUE(closestHit(Ray(Point(0, -5, -5), Vector(0, 0, 1), 0.0f), world).object == &world.objects[idx_member]);
+  ASSERT_TRUE(closestHit(Ray(Point(0, -5, -5), Vector(0, 0, 1), 1.0f), world).object == nullptr);
+  ASSERT_TRUE(closestHit(Ray(Point(3, -5, -5), Vector(0, 0, 1), 1.0f), world).object == &world.objects[idx_member]);
+  ASSERT_TRUE(worldBounds(world, world.objects[group]).max.x >= 4.0f);
+}
+
+TEST(GroupsRenderLikeTheirFlattenedMembers) {
+  // The same scene twice, once with the sphere and cube in nested groups and once with their transforms written out
+  const auto buildScene = [](World &world, const bool grouped) {
+    addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+    auto checkered = createDefaultMaterial();
+    checkered.patternIndex = addPattern(world, Pattern{PatternType::Checker,
+                                                       PatternData{Color(1, 1, 1), Color(0.25, 0.25, 0.25)}});
+    WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+    floor.MaterialIndex = addMaterial(world, createDefaultMaterial());
+    auto idx_floor = addObject(world, floor);
+    addTransformToObject(world, idx_floor, transformations::translation(0, -1, 0));
+    WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+    sphere.MaterialIndex = addMaterial(world, checkered);
+    auto idx_sphere = addObject(world, sphere);
+    addTransformToObject(world, idx_sphere, transformations::translation(1, 0, 0));
+    WorldObject cube{ShapeTypeTag{ShapeType::Cube}};
+    cube.MaterialIndex = addMaterial(world, createDefaultMaterial());
+    auto idx_cube = addObject(world, cube);
+    addTransformToObject(world, idx_cube, transformations::scaling(0.5, 0.5, 0.5));
+    addTransformToObject(world, idx_cube, transformations::translation(-1, 0, 0));
+    if (grouped) {
+      auto idx_inner = addGroup(world, transformations::rotation_y(0.5));
+      addObjectToGroup(world, idx_inner, idx_sphere);
+      addObjectToGroup(world, idx_inner, idx_cube);
+      auto idx_outer = addGroup(world, transformations::translation(0, 0.5, 0));
+      addObjectToGroup(world, idx_outer, idx_inner);
+      addTransformToObject(world, idx_outer, transformations::scaling(1.2, 1.2, 1.2));
+      return idx_outer;
+    }
+    for (const auto idx : {idx_sphere, idx_cube}) {
+      addTransformToObject(world, idx, transformations::rotation_y(0.5));
+      addTransformToObject(world, idx, transformations::translation(0, 0.5, 0));
+      addTransformToObject(world, idx, transformations::scaling(1.2, 1.2, 1.2));
+    }
+    return idx_floor;
+  };
+  World flat;
+  buildScene(flat, false);
+  World grouped;
+  auto idx_outer = buildScene(grouped, true);
+  ASSERT_TRUE(grouped.objects[1].transform == flat.objects[1].transform);
+  ASSERT_TRUE(grouped.objects[2].transform == flat.objects[2].transform);
+
+  // The outer group bounds everything below it, rays that miss the box skip its members
+  const AABB &bounds = grouped.objects[idx_outer].boundingBox;
+  for (const size_t idx : {size_t{1}, size_t{2}}) {
+    const AABB member = worldBounds(grouped, grouped.objects[idx]);
+    ASSERT_TRUE(bounds.min.x <= member.min.x && bounds.min.y <= member.min.y && bounds.min.z <= member.min.z);
+    ASSERT_TRUE(bounds.max.x >= member.max.x && bounds.max.y >= member.max.y && bounds.max.z >= member.max.z);
+  }
+  ASSERT_TRUE(closestHit(Ray(Point(0, 5, -5), Vector(0, 0, 1)), grouped).object == nullptr);
+
+  Camera camera(24, 16, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 1.5, -6), Point(0, 0, 0), Vector(0, 1, 0)));
+  // Without the object hierarchy, and with it traced one ray at a time and as packets
+  for (int pass = 0; pass < 3; ++pass) {
+    if (pass == 1) {
+      buildAccelerationStructure(flat);
+      buildAccelerationStructure(grouped);
+      ASSERT_TRUE(hasAccelerationStructure(grouped));
+    }
+    camera.setPacketTracing(pass == 2);
+    const auto expected = camera.render(flat);
+    const auto image = camera.render(grouped);
+    for (size_t y = 0; y < 16; ++y) {
+      for (size_t x = 0; x < 24; ++x) {
+        ASSERT_COLOR_EQ(image.pixelAt(x, y), expected.pixelAt(x, y));
+      }
+    }
+  }
+}
+
+TEST(AreaLightCastsSoftShadowsOnlyInThePenumbra) {
+  // A 2 x 2 light above a small cube on the floor
+  World world;
+  addLight(world, rectangleLight(Color(1,1,1), Point(0, 4, 0), Vector(2, 0, 0), Vector(0, 0, 2), 64));
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_floor = addObject(world, floor);
+  WorldObject cube{ShapeTypeTag{ShapeType::Cube}};
+  cube.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_cube = addObject(world, cube);
+  addTransformToObject(world, idx_cube, transformations::scaling(0.5, 0.5, 0.5));
+  addTransformToObject(world, idx_cube, transformations::translation(0, 1, 0));
+  buildAccelerationStructure(world);
+
+  const auto visibilityAt = [&](const PointLight &light, const float x) {
+    ShadingPoint shading;
+    shading.object = &world.objects[idx_floor];
+    shading.point = Point(x, 0, 0);
+    shading.eyeVector = Vector(0, 1, 0);
+    shading.normalVector = Vector(0, 1, 0);
+    return lightVisibility(sampleLight(shading, light, world), world);
+  };
+  const PointLight &area = world.lights[0];
+  // Every point of the light is hidden right below the cube and visible far away from it, which the probes settle
+  ASSERT_EQ(visibilityAt(area, 0.0f), 0.0f);
+  ASSERT_EQ(visibilityAt(area, 5.0f), 1.0f);
+  // Next to the cube part of the light is hidden
+  const float penumbra = visibilityAt(area, 1.0f);
+  ASSERT_TRUE(penumbra > 0.1f && penumbra < 0.9f);
+  ASSERT_EQ(visibilityAt(area, 1.0f), penumbra);
+  // Point lights at the two ends of the area light are hidden and visible there
+  ASSERT_EQ(visibilityAt(PointLight{Color(1,1,1), Point(-1, 4, 0)}, 1.0f), 0.0f);
+  ASSERT_EQ(visibilityAt(PointLight{Color(1,1,1), Point(1, 4, 0)}, 1.0f), 1.0f);
+  const PointLight sphere = sphereLight(Color(1,1,1), Point(0, 4, 0), 1.0f, 64);
+  const float spherePenumbra = visibilityAt(sphere, 1.0f);
+  ASSERT_TRUE(spherePenumbra > 0.1f && spherePenumbra < 0.9f);
+  // Settled points trace the probes, the penumbra traces the 8 x 8 grid on top
+  const auto shadowRaysAt = [&](const float x) {
+    ShadingPoint shading;
+    shading.object = &world.objects[idx_floor];
+    shading.point = Point(x, 0, 0);
+    shading.eyeVector = Vector(0, 1, 0);
+    shading.normalVector = Vector(0, 1, 0);
+    uint32_t shadowRays = 0;
+    lightVisibility(sampleLight(shading, area, world), world, &shadowRays);
+    return shadowRays;
+  };
+  ASSERT_EQ(shadowRaysAt(5.0f), AREA_LIGHT_PROBE_GRID * AREA_LIGHT_PROBE_GRID);
+  ASSERT_EQ(shadowRaysAt(1.0f), AREA_LIGHT_PROBE_GRID * AREA_LIGHT_PROBE_GRID + 64u);
+
+  // The shadow fades from the umbra to the lit floor
+  Camera camera(32, 1, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(2.5, 6, -0.01), Point(2.5, 0, 0), Vector(0, 0, 1)));
+  const auto image = camera.render(world);
+  size_t partlyLit = 0;
+  for (size_t x = 0; x < 32; ++x) {
+    const float red = image.pixelAt(x, 0).red();
+    partlyLit += red > 0.15f && red < 0.85f * image.pixelAt(31, 0).red();
+  }
+  ASSERT_GT(partlyLit, 2u);
+}
+
+TEST(LightHierarchyEstimatesManyLightsWithinTheBound) {
+  World world;
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_floor = addObject(world, floor);
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_sphere = addObject(world, sphere);
+  addTransformToObject(world, idx_sphere, transformations::translation(0, 1, 0));
+  for (int x = 0; x < 8; ++x) {
+    for (int z = 0; z < 8; ++z) {
+      PointLight light{Color(0.05, 0.05, 0.05), Point(2 * (x - 4), 4, 2 * (z - 4))};
+      light.attenuation = 0.2f;
+      addLight(world, light);
+    }
+  }
+  buildAccelerationStructure(world);
+  ASSERT_TRUE(hasLightHierarchy(world));
+
+  Camera camera(16, 12, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 3, -6), Point(0, 0.5, 0), Vector(0, 1, 0)));
+  const auto exact = camera.render(world);
+  world.lightErrorBound = 0.02f;
+  const auto estimated = camera.render(world);
+  float summedError = 0.0f;
+  for (size_t y = 0; y < 12; ++y) {
+    for (size_t x = 0; x < 16; ++x) {
+      summedError += std::abs(exact.pixelAt(x, y).red() - estimated.pixelAt(x, y).red());
+    }
+  }
+  ASSERT_TRUE(summedError / (16 * 12) < 0.02f);
+
+  // A point on the floor gets fewer samples than there are lights, the lights far away being clustered
+  ShadingPoint shading;
+  shading.object = &world.objects[idx_floor];
+  shading.point = Point(-7, 0, -7);
+  shading.eyeVector = Vector(0, 1, 0);
+  shading.normalVector = Vector(0, 1, 0);
+  std::vector<LightSample> samples(world.lights.size());
+  const uint32_t count = sampleLights(shading, world, samples.data());
+  ASSERT_TRUE(count > 0 && count < world.lights.size());
+  ASSERT_EQ(sampleLights(shading, world, samples.data()), count);
+
+  // Until the hierarchy is rebuilt every light is sampled
+  addLight(world, PointLight{Color(0.05, 0.05, 0.05), Point(0, 4, 0)});
+  ASSERT_FALSE(hasLightHierarchy(world));
+  samples.resize(world.lights.size());
+  ASSERT_EQ(sampleLights(shading, world, samples.data()), world.lights.size());
+  updateAccelerationStructure(world);
+  ASSERT_TRUE(hasLightHierarchy(world));
+}
+
+TEST(WavefrontRenderMatchesRecursiveRender) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  addLight(world, PointLight(Color(0.3,0.3,0.3), Point(5,8,-3)));
+  auto glass = createDefaultMaterial();
+  glass.reflectance = 0.9;
+  glass.transparency = 0.9;
+  glass.refractiveIndex = 1.5;
+  WorldObject glassSphere{ShapeTypeTag{ShapeType::Sphere}};
+  glassSphere.MaterialIndex = addMaterial(world, glass);
+  addObject(world, glassSphere);
+  auto mirror = createDefaultMaterial();
+  mirror.surfaceColor = Color(0.8, 0.3, 0.2);
+  mirror.reflectance = 0.5;
+  WorldObject mirrorSphere{ShapeTypeTag{ShapeType::Sphere}};
+  mirrorSphere.MaterialIndex = addMaterial(world, mirror);
+  auto idx_mirror = addObject(world, mirrorSphere);
+  addTransformToObject(world, idx_mirror, transformations::translation(2.2, 0, 1));
+  auto floorMaterial = createDefaultMaterial();
+  floorMaterial.reflectance = 0.2;
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, floorMaterial);
+  auto idx_floor = addObject(world, floor);
+  addTransformToObject(world, idx_floor, transformations::translation(0, -1, 0));
+
+  Camera camera(41, 29, 1.2f);
+  camera.setTransform(transformations::view_transform(Point(0.5, 1.5, -6), Point(0, 0, 0), Vector(0, 1, 0)));
+  camera.setPacketTracing(false);
+  const auto recursive = camera.render(world);
+  WavefrontTimings timings;
+  const auto wavefront = renderWavefront(camera, world, &timings);
+  for (size_t y = 0; y < 29; ++y) {
+    for (size_t x = 0; x < 41; ++x) {
+      ASSERT_COLOR_EQ(wavefront.pixelAt(x, y), recursive.pixelAt(x, y));
+    }
+  }
+  ASSERT_EQ(timings.bounceCount, 5u);
+  ASSERT_TRUE(timings.rayCount > 41u * 29u);
+  ASSERT_TRUE(timings.shadowRayCount > 0u);
+}
+
+TEST(WavefrontRenderWithoutLights) {
+  World world;
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  addObject(world, sphere);
+
+  Camera camera(9, 9, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 0, -4), Point(0, 0, 0), Vector(0, 1, 0)));
+  WavefrontTimings timings;
+  const auto image = renderWavefront(camera, world, &timings);
+  for (size_t y = 0; y < 9; ++y) {
+    for (size_t x = 0; x < 9; ++x) {
+      ASSERT_COLOR_EQ(image.pixelAt(x, y), Color(0, 0, 0));
+    }
+  }
+  ASSERT_TRUE(timings.rayCount >= 81u);
+  ASSERT_EQ(timings.shadowRayCount, 0u);
+}
+
+TEST(WavefrontCountsEveryShadowRayOfAreaLights) {
+  World world;
+  addLight(world, rectangleLight(Color(1,1,1), Point(0, 4, 0), Vector(2, 0, 0), Vector(0, 0, 2), 16));
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  addObject(world, floor);
+
+  // Every primary ray hits the floor, which has no reflected or refracted rays
+  Camera camera(8, 8, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 6, -0.01), Point(0, 0, 0), Vector(0, 0, 1)));
+  WavefrontTimings timings;
+  renderWavefront(camera, world, &timings);
+  ASSERT_EQ(timings.rayCount, 64u);
+  ASSERT_EQ(timings.shadowRayCount, 64u * AREA_LIGHT_PROBE_GRID * AREA_LIGHT_PROBE_GRID);
+}
+
+TEST(ProgressiveRenderRefinesToTheFinalImage) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  addObject(world, sphere);
+
+  Camera camera(31, 31, 1.0f);
+  camera.setTransform(transformations::view_transform(Point(0, 0, -4), Point(0, 0, 0), Vector(0, 1, 0)));
+  std::vector<ProgressiveRender::Pass> passes;
+  auto progressive = startProgressiveRender(camera, world, [&](const Canvas &, const ProgressiveRender::Pass pass) {
+    passes.push_back(pass);
+  });
+  progressive->wait();
+  ASSERT_TRUE(progressive->finished());
+  ASSERT_EQ(progressive->completedPasses(), 3u);
+  ASSERT_EQ(passes.size(), 3u);
+  ASSERT_TRUE(passes[0] == ProgressiveRender::Pass::Preview);
+  ASSERT_TRUE(passes[2] == ProgressiveRender::Pass::Supersampled);
+
+  camera.setMaxSamplesPerPixel(ProgressiveRender::PROGRESSIVE_SAMPLES_PER_PIXEL);
+  const auto expected = camera.render(world);
+  const auto latest = progressive->latestImage();
+  for (size_t y = 0; y < 31; ++y) {
+    for (size_t x = 0; x < 31; ++x) {
+      ASSERT_COLOR_EQ(latest.pixelAt(x, y), expected.pixelAt(x, y));
+    }
+  }
+
+  // Cancelled before it started, the render stops without finishing a pass
+  std::atomic<bool> cancelled{true};
+  Canvas image(31, 31);
+  ASSERT_FALSE(camera.renderCenters(world, image, &cancelled));
+  ASSERT_EQ(image.pixelAt(15, 15), Color(0, 0, 0));
+  Camera large(2000, 2000, 1.0f);
+  large.setMaxSamplesPerPixel(257);
+  auto cancelledRender = startProgressiveRender(large, world);
+  cancelledRender->cancel();
+  cancelledRender->wait();
+  ASSERT_TRUE(cancelledRender->finished());
+  ASSERT_LT(cancelledRender->completedPasses(), 3u);
+}
+
+// =================== Acceleration Structure Tests ===================
+
+TEST(AccelerationStructureMatchesLinearScan) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+
+  WorldObject floor{ShapeTypeTag{ShapeType::Plane}};
+  floor.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx_floor = addObject(world, floor);
+  addTransformToObject(world, idx_floor, transformations::translation(0, -1, 0));
+
+  // A grid of small spheres, enough to give the hierarchy a few levels
+  for (int x = -5; x <= 5; x++) {
+    for (int z = 0; z < 10; z++) {
+      WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+      auto material = createDefaultMaterial();
+      material.surfaceColor = Color(0.1 * (x + 5), 0.1 * z, 0.5);
+      sphere.MaterialIndex = addMaterial(world, material);
+      auto idx = addObject(world, sphere);
+      addTransformToObject(world, idx, transformations::translation(x, 0, z) * transformations::scaling(0.3, 0.3, 0.3));
+    }
+  }
+
+  std::vector<Ray> rays;
+  for (int i = 0; i < 50; i++) {
+    rays.emplace_back(Point(0, 2, -5), Vector(-0.5 + i * 0.02, -0.2, 1).normalize());
+  }
+  std::vector<Color> linearColors;
+  for (const auto &ray : rays) {
+    linearColors.push_back(colorAt(ray, world, 5));
+  }
+
+  buildAccelerationStructure(world);
+  ASSERT_TRUE(hasAccelerationStructure(world));
+  ASSERT_EQ(world.unboundedObjects.size(), 1u);
+  for (size_t i = 0; i < rays.size(); i++) {
+    ASSERT_COLOR_EQ(colorAt(rays[i], world, 5), linearColors[i]);
+  }
+}
+
+TEST(AccelerationStructureDroppedOnSceneChange) {
+  World world;
+  WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+  sphere.MaterialIndex = addMaterial(world, createDefaultMaterial());
+  auto idx = addObject(world, sphere);
+
+  buildAccelerationStructure(world);
+  ASSERT_TRUE(hasAccelerationStructure(world));
+
+  addTransformToObject(world, idx, transformations::translation(5, 0, 0));
+  ASSERT_FALSE(hasAccelerationStructure(world));
+}
+
+TEST(AccelerationStructureRefitAfterObjectsMove) {
+  World world;
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,-10)));
+  std::vector<size_t> spheres;
+  for (int x = 0; x < 10; x++) {
+    for (int z = 0; z < 10; z++) {
+      WorldObject sphere{ShapeTypeTag{ShapeType::Sphere}};
+      auto material = createDefaultMaterial();
+      material.surfaceColor = Color(0.1 * x, 0.1 * z, 0.5);
+      sphere.MaterialIndex = addMaterial(world, material);
+      spheres.push_back(addObject(world, sphere));
+      addTransformToObject(world, spheres.back(), transformations::translation(x - 5, 0, z) * transformations::scaling(0.3, 0.3, 0.3));
+    }
+  }
+  buildAccelerationStructure(world);
+  const float builtCost = world.objectBVHBuildCost;
+
+  // A small motion keeps neighbours together, so a refit is enough
+  for (const auto idx : spheres) {
+    addTransformToObject(world, idx, transformations::translation(0, 0.1 * (idx % 3), 0));
+  }
+  ASSERT_FALSE(hasAccelerationStructure(world));
+  ASSERT_FALSE(updateAccelerationStructure(world));
+  ASSERT_TRUE(hasAccelerationStructure(world));
+  ASSERT_EQ(world.objectBVHBuildCost, builtCost);
+
+  World linearWorld = world;
+  linearWorld.objectBVH = BVH{};
+  for (int i = 0; i < 50; i++) {
+    Ray ray(Point(0, 2, -5), Vector(-0.5 + i * 0.02, -0.2, 1).normalize());
+    ASSERT_COLOR_EQ(colorAt(ray, world, 5), colorAt(ray, linearWorld, 5));
+  }
+
+  // Shuffling the spheres across the grid scatters every leaf, which has to trigger a rebuild
+  for (size_t i = 0; i < spheres.size(); i++) {
+    const size_t target = (i * 37) % spheres.size();
+    addTransformToObject(world, spheres[i], transformations::translation(float(target / 10) - float(i / 10), 0,
+                                                                         float(target % 10) - float(i % 10)));
+  }
+  ASSERT_TRUE(updateAccelerationStructure(world));
+  ASSERT_TRUE(hasAccelerationStructure(world));
+}
+
+template <uint32_t Width>
+static void checkWideHierarchyMatchesBinary(const BVH &bvh, const std::vector<Ray> &rays) {
+  const WideBVH<Width> wide = collapseBVH<Width>(bvh);
+  for (const auto &ray : rays) {
+    std::vector<uint32_t> binaryLeaves;
+    std::vector<uint32_t> wideLeaves;
+    float maxDistance = INFINITY;
+    traverseBVHLeaves(bvh, ray, maxDistance, [&](uint32_t first, uint32_t) { binaryLeaves.push_back(first); });
+    traverseWideBVHLeaves(wide, ray, maxDistance, [&](uint32_t first, uint32_t) { wideLeaves.push_back(first); });
+    std::sort(binaryLeaves.begin(), binaryLeaves.end());
+    std::sort(wideLeaves.begin(), wideLeaves.end());
+    ASSERT_TRUE(binaryLeaves == wideLeaves);
+  }
+}
+
+TEST(WideHierarchyVisitsSameLeavesAsBinary) {
+  // A grid of unit boxes with a few flat ones mixed in
+  std::vector<AABB> boxes;
+  for (int x = 0; x < 12; x++) {
+    for (int y = 0; y < 12; y++) {
+      for (int z = 0; z < 12; z++) {
+        const float depth = (x + y + z) % 5 == 0 ? 0.0f : 0.5f;
+        boxes.emplace_back(Point(x * 2, y * 2, z * 2), Point(x * 2 + 1, y * 2 + 0.5, z * 2 + depth));
+      }
+    }
+  }
+  const BVH bvh = buildBVH(boxes);
+
+  std::vector<Ray> rays;
+  for (int i = 0; i < 64; i++) {
+    rays.emplace_back(Point(-5, 11 + i % 8, -5), Vector(1, 0.03 * (i / 8) - 0.1, 1 + 0.01 * i).normalize());
+    rays.emplace_back(Point(30, 30, 30), Vector(-1, -1 + 0.01 * i, -1).normalize());
+  }
+  checkWideHierarchyMatchesBinary<4>(bvh, rays);
+  checkWideHierarchyMatchesBinary<8>(bvh, rays);
+}
+
+TEST(MeshHierarchyMatchesBruteForce) {
+  World world;
+  const auto meshIndex = loadMeshFromObjFile(world, "suzanne.obj");
+  ASSERT_TRUE(meshIndex.has_value());
+  world.objects[*meshIndex].MaterialIndex = addMaterial(world, createDefaultMaterial());
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,10)));
+
+  // Without a hierarchy the mesh's triangles are all tested as a single leaf
+  World bruteForceWorld = world;
+  bruteForceWorld.meshData[0].bvh = BVH{};
+  bruteForceWorld.meshData[0].wideBVH = {};
+
+  const auto &box = world.objects[*meshIndex].boundingBox;
+  for (int i = 0; i < 40; i++) {
+    const float x = box.min.x + (box.max.x - box.min.x) * (i + 0.5f) / 40;
+    Ray ray(Point(x, (box.min.y + box.max.y) / 2, box.max.z + 5), Vector(0, 0.05, -1).normalize());
+    ASSERT_COLOR_EQ(colorAt(ray, world, 5), colorAt(ray, bruteForceWorld, 5));
+  }
+}
+
+TEST(LinearHierarchyMatchesBruteForce) {
+  World world;
+  world.bvhBuildMethod = BVHBuildMethod::Linear;
+  const auto meshIndex = loadMeshFromObjFile(world, "suzanne.obj");
+  ASSERT_TRUE(meshIndex.has_value());
+  world.objects[*meshIndex].MaterialIndex = addMaterial(world, createDefaultMaterial());
+  addLight(world, PointLight(Color(1,1,1), Point(-10,10,10)));
+
+  // Every leaf has to be enclosed by its parent, otherwise traversal would skip it
+  const BVH &bvh = world.meshData[0].bvh;
+  for (const auto &node : bvh.nodes) {
+    if (!node.isLeaf()) {
+      for (const auto &child : {bvh.nodes[node.leftOrFirst], bvh.nodes[node.leftOrFirst + 1]}) {
+        ASSERT_TRUE(child.bounds.min.x >= node.bounds.min.x && child.bounds.max.x <= node.bounds.max.x);
+        ASSERT_TRUE(child.bounds.min.y >= node.bounds.min.y && child.bounds.max.y <= node.bounds.max.y);
+        ASSERT_TRUE(child.bounds.min.z >= node.bounds.min.z && child.bounds.max.z <= node.bounds.max.z);
+      }
+    }
+  }
+  ASSERT_GT(computeSAHCost(bvh), 0.0f);
+
+  World bruteForceWorld = world;
+  bruteForceWorld.meshData[0].bvh = BVH{};
+  bruteForceWorld.meshData[0].wideBVH = {};
+
+  const auto &box = world.objects[*meshIndex].boundingBox;
+  for (int i = 0; i < 40; i++) {
+    const float x = box.min.x + (box.max.x - box.min.x) * (i + 0.5f) / 40;
+    Ray ray(Point(x, (box.min.y + box.max.y) / 2, box.max.z + 5), Vector(0, 0.05, -1).normalize());
+    ASSERT_COLOR_EQ(colorAt(ray, world, 5), colorAt(ray, bruteForceWorld, 5));
+  }
+}
+
+TEST(ParallelHierarchyBuildIsRepeatable) {
+  // Enough boxes for the subtrees to be built by parallel tasks
+  std::vector<AABB> boxes;
+  uint32_t state = 12345;
+  const auto next = [&state] {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / 16777216.0f;
+  };
+  for (int i = 0; i < 20000; ++i) {
+    const Tuple corner = Point(next() * 100, next() * 100, next() * 100);
+    boxes.emplace_back(corner, corner + Vector(next(), next(), next()));
+  }
+
+  for (const auto method : {BVHBuildMethod::SAH, BVHBuildMethod::Linear}) {
+    const BVH parallel = buildBVH(boxes, method, 4);
+    BVH serial;
+    tbb::task_arena(1).execute([&] { serial = buildBVH(boxes, method, 4); });
+    ASSERT_EQ(parallel.nodes.size(), serial.nodes.size());
+    ASSERT_TRUE(parallel.primitiveIndices == serial.primitiveIndices);
+    for (size_t i = 0; i < serial.nodes.size(); ++i) {
+      ASSERT_EQ(parallel.nodes[i].leftOrFirst, serial.nodes[i].leftOrFirst);
+      ASSERT_EQ(parallel.nodes[i].count, serial.nodes[i].count);
+      ASSERT_TRUE(parallel.nodes[i].bounds.min == serial.nodes[i].bounds.min &&
+                  parallel.nodes[i].bounds.max == serial.nodes[i].bounds.max);
+    }
+  }
+}
+
+TEST(TriangleBatchMatchesScalarTest) {
+  World world;
+  const auto meshIndex = loadMesh(world, "suzanne.obj");
+  ASSERT_TRUE(meshIndex.has_value());
+  const MeshData &mesh = world.meshData[*meshIndex];
+  const auto &box = mesh.bvh.nodes[0].bounds;
+  // Leaving out a few triangles makes the last batch partially filled
+  const int32_t count = mesh.triangleCount - 3;
+
+  for (int i = 0; i < 60; i++) {
+    const float x = box.min.x + (box.max.x - box.min.x) * (i + 0.5f) / 60;
+    const float y = box.min.y + (box.max.y - box.min.y) * ((i * 7) % 60 + 0.5f) / 60;
+    Ray ray(Point(x, y, box.max.z + 5), Vector(0.01 * (i % 5), 0, -1).normalize());
+
+    TriangleHit scalarHit;
+    for (int32_t tri = 0; tri < count; tri++) {
+      float t, u, v;
+      if (intersectTriangle(world.triangleData[mesh.firstTriangleIndex + tri], ray.origin, ray.direction, t, u, v) &&
+          t < scalarHit.t) {
+        scalarHit = TriangleHit{t, u, v, tri};
+      }
+    }
+
+    TriangleHit batchHit;
+    intersectTriangles(mesh.positions, 0, static_cast<uint32_t>(count), ray, batchHit);
+    ASSERT_EQ(batchHit.triangleIndex, scalarHit.triangleIndex);
+    if (scalarHit.triangleIndex != -1) {
+      ASSERT_NEAR(batchHit.t, scalarHit.t, 1e-4);
+      ASSERT_NEAR(batchHit.u, scalarHit.u, 1e-4);
+      ASSERT_NEAR(batchHit.v, scalarHit.v, 1e-4);
+    }
+  }
+}
+
+TEST(MeshCacheSkipsParsingOnWarmStart) {
+  const auto cacheDirectory = std::filesystem::temp_directory_path() / "raytracer_mesh_cache_test";
+  std::filesystem::remove_all(cacheDirectory);
+
+  World coldWorld;
+  coldWorld.meshCacheDirectory = cacheDirectory.string();
+  const auto coldMesh = loadMesh(coldWorld, "suzanne.obj");
+  ASSERT_TRUE(coldMesh.has_value());
+  ASSERT_FALSE(std::filesystem::is_empty(cacheDirectory));
+
+  // The warm world sees the cached triangles and hierarchies, byte for byte
+  World warmWorld;
+  warmWorld.meshCacheDirectory = cacheDirectory.string();
+  const auto warmMesh = loadMesh(warmWorld, "suzanne.obj");
+  ASSERT_TRUE(warmMesh.has_value());
+  const MeshData &cold = coldWorld.meshData[*coldMesh];
+  const MeshData &warm = warmWorld.meshData[*warmMesh];
+  ASSERT_EQ(warm.triangleCount, cold.triangleCount);
+  ASSERT_EQ(warm.bvh.nodes.size(), cold.bvh.nodes.size());
+  ASSERT_EQ(warm.wideBVH.nodes.size(), cold.wideBVH.nodes.size());
+  ASSERT_EQ(std::memcmp(warmWorld.triangleData.data(), coldWorld.triangleData.data(),
+                        cold.triangleCount * sizeof(TriangleData)), 0);
+  ASSERT_EQ(std::memcmp(warm.wideBVH.nodes.data(), cold.wideBVH.nodes.data(),
+                        cold.wideBVH.nodes.size() * sizeof(cold.wideBVH.nodes[0])), 0);
+
+  // Entries built with another method are not reused
+  World linearWorld;
+  linearWorld.meshCacheDirectory = cacheDirectory.string();
+  linearWorld.bvhBuildMethod = BVHBuildMethod::Linear;
+  const MappedFile source("suzanne.obj");
+  const auto hash = fnv1aHash(source.data, source.size);
+  ASSERT_FALSE(loadMeshFromCache(linearWorld, meshCachePath(linearWorld.meshCacheDirectory, hash), hash).has_value());
+
+  // Writers of the same entry at once each use their own temporary file, the entry ends up whole
+  const auto cachePath = meshCachePath(coldWorld.meshCacheDirectory, hash);
+  std::vector<std::thread> writers;
+  std::atomic<int> written = 0;
+  for (int i = 0; i < 4; ++i) {
+    writers.emplace_back([&] { written += writeMeshCache(coldWorld, *coldMesh, cachePath, hash); });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  ASSERT_EQ(written.load(), 4);
+  World rewrittenWorld;
+  ASSERT_TRUE(loadMeshFromCache(rewrittenWorld, cachePath, hash).has_value());
+  for (const auto &entry : std::filesystem::directory_iterator(cacheDirectory)) {
+    ASSERT_TRUE(entry.path().extension() != ".tmp");
+  }
+
+  std::filesystem::remove_all(cacheDirectory);
+}
+
+TEST(MeshInstancesShareTriangleData) {
+  World world;
+  const auto firstInstance = loadMeshFromObjFile(world, "suzanne.obj");
+  ASSERT_TRUE(firstInstance.has_value());
+  const size_t triangleCount = world.triangleData.size();
+
+  // Asking for the same file again only adds an instance
+  const auto secondInstance = loadMeshFromObjFile(world, "suzanne.obj");
+  ASSERT_TRUE(secondInstance.has_value());
+  ASSERT_EQ(world.triangleData.size(), triangleCount);
+  ASSERT_EQ(world.meshData.size(), 1u);
+  ASSERT_EQ(world.objects[*secondInstance].shapeTag.dataIndex, world.objects[*firstInstance].shapeTag.dataIndex);
+
+  // Each instance carries its own transform on top of the shared mesh
+  const auto shifted = addMeshInstance(world, 0, transformations::translation(100, 0, 0));
+  ASSERT_NEAR(world.objects[shifted].boundingBox.transform(world.objects[shifted].transform).min.x,
+              world.objects[*firstInstance].boundingBox.min.x + 100, 0.001);
+
+  auto material = createDefaultMaterial();
+  material.ambient = 1.0;
+  const auto materialIndex = addMaterial(world, material);
+  for (auto &object : world.objects) {
+    object.MaterialIndex = materialIndex;
+  }
+  addLight(world, PointLight(Color(1,1,1), Point(100,10,30)));
+  buildAccelerationStructure(world);
+
+  const auto center = world.objects[shifted].boundingBox.transform(world.objects[shifted].transform).centroid();
+  Ray ray(center + Vector(0, 0, 20), Vector(0, 0, -1));
+  ASSERT_NE(colorAt(ray, world, 5), Color(0, 0, 0));
+}
+
 // =================== Main ===================
 
 int main() {
@@ -45,6 +45,8 @@ int main(){
 
   addLight(world, scene::PointLight(utility::Color(0.9, 0.9, 0.9), utility::Point(2, 10, -5)));
 
+  buildAccelerationStructure(world);
+
   auto camera = scene::Camera(5000, 5000, 0.45);
   camera.setTransform(utility::transformations::view_transform(utility::Point( 0, 0, -5),
                                                                utility::Point( 0, 0,  0), 
@@ -0,0 +1,87 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/Wavefront.hpp"
+#include "libraries/Scene/include/World.hpp"
+#include "libraries/Utility/include/Transformations.hpp"
+
+using namespace raytracer;
+using namespace utility;
+using namespace scene;
+
+// Renders a hall lit by a grid of small lights with every light evaluated and with the light hierarchy at a few
+// error bounds, reporting the time, the shadow rays traced and how far the image is from the exact one.
+constexpr int RUNS_PER_MEASUREMENT = 3;
+constexpr unsigned int RESOLUTION = 256;
+constexpr int LIGHTS_PER_SIDE = 16;
+
+template <typename Render> static double measureRenderMilliseconds(Render &&render, Canvas &image) {
+  double best = INFINITY;
+  for (int run = 0; run < RUNS_PER_MEASUREMENT; ++run) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    image = render();
+    const auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+int main() {
+  World world;
+  auto floorMaterial = material::createDefaultMaterial();
+  floorMaterial.ambient = 0.0f;
+  addObjectWithMaterial(world, WorldObject{ShapeTypeTag{ShapeType::Plane}}, floorMaterial);
+  for (int x = 0; x < 8; ++x) {
+    for (int z = 0; z < 8; ++z) {
+      auto material = material::createDefaultMaterial();
+      material.ambient = 0.0f;
+      material.surfaceColor = Color(0.3f + 0.08f * x, 0.8f - 0.08f * z, 0.5f);
+      const auto sphere = addObjectWithMaterial(world, WorldObject{ShapeTypeTag{ShapeType::Sphere}}, material);
+      addTransformToObject(world, sphere, transformations::translation(6.0f * (x - 4) + 1.5f, 1.0f, 6.0f * z));
+    }
+  }
+  // Fixtures over a large hall, each lighting the floor around it
+  for (int x = 0; x < LIGHTS_PER_SIDE; ++x) {
+    for (int z = 0; z < LIGHTS_PER_SIDE; ++z) {
+      PointLight light{Color(1.0f, 0.8f + 0.02f * x, 0.8f + 0.02f * z),
+                       Point(3.0f * (x - LIGHTS_PER_SIDE / 2), 4.0f, 3.0f * z - 6.0f)};
+      light.attenuation = 1.0f;
+      addLight(world, light);
+    }
+  }
+  buildAccelerationStructure(world);
+
+  Camera camera(RESOLUTION, RESOLUTION, 1.2f);
+  camera.setTransform(
+      transformations::view_transform(Point(0.0f, 6.0f, -12.0f), Point(0.0f, 0.0f, 12.0f), Vector(0.0f, 1.0f, 0.0f)));
+
+  Canvas exact(RESOLUTION, RESOLUTION);
+  Canvas estimated(RESOLUTION, RESOLUTION);
+  for (const float errorBound : {0.0f, 0.005f, 0.02f, 0.1f}) {
+    world.lightErrorBound = errorBound;
+    Canvas &image = errorBound == 0.0f ? exact : estimated;
+    const double milliseconds = measureRenderMilliseconds([&] { return camera.render(world); }, image);
+    WavefrontTimings timings;
+    renderWavefront(camera, world, &timings);
+
+    double summedError = 0.0;
+    float maxError = 0.0f;
+    for (unsigned int y = 0; y < RESOLUTION; ++y) {
+      for (unsigned int x = 0; x < RESOLUTION; ++x) {
+        const Color a = exact.pixelAt(x, y);
+        const Color b = image.pixelAt(x, y);
+        const float error = std::max({std::abs(a.red() - b.red()), std::abs(a.green() - b.green()),
+                                      std::abs(a.blue() - b.blue())});
+        summedError += error;
+        maxError = std::max(maxError, error);
+      }
+    }
+    std::cout << world.lights.size() << " lights, error bound " << errorBound << ": " << milliseconds << " ms, "
+              << timings.shadowRayCount << " shadow rays, mean error "
+              << summedError / (RESOLUTION * RESOLUTION) << ", max error " << maxError << "\n";
+  }
+  return 0;
+}
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -26,12 +27,18 @@ int main(int argc, char *argv[]) {
   const std::filesystem::path objPath{argv[1]};
 
   World world;
+  // Later runs on the same model map the parsed triangles and their hierarchy from here
+  world.meshCacheDirectory = ".meshcache";
 
+  const auto loadStart = std::chrono::high_resolution_clock::now();
   const auto meshIndex = loadMeshFromObjFile(world, objPath.string());
   if (!meshIndex.has_value()) {
     std::cerr << "Could not load " << objPath << '\n';
     return 1;
   }
+  const auto loadEnd = std::chrono::high_resolution_clock::now();
+  std::cout << "Loaded " << objPath << " in "
+            << std::chrono::duration<double, std::milli>(loadEnd - loadStart).count() << " ms\n";
 
   auto meshMaterial = material::Material(utility::Color(0.9f, 0.6f, 0.2f), // surface color
                                          0.1f,                             // ambient
@@ -59,6 +66,8 @@ int main(int argc, char *argv[]) {
   addLight(world, scene::PointLight{utility::Color(1.0f, 1.0f, 1.0f),
                                     center + utility::Vector(-3.0f * extent, 3.0f * extent, 3.0f * extent)});
 
+  buildAccelerationStructure(world);
+
   // The model is assumed to face towards positive z, so the camera is placed
   // on that side
   auto camera = scene::Camera(1000, 1000, 1.0f);
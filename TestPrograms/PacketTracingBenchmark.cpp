@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/World.hpp"
+#include "libraries/Utility/include/RayPacket.hpp"
+#include "libraries/Utility/include/Transformations.hpp"
+
+using namespace raytracer;
+using namespace utility;
+using namespace scene;
+
+// Compares tracing primary rays one at a time with tracing them as packets. The scenes have no lights, so shading is
+// nearly free and the numbers are dominated by finding the first hits. Both modes run on a single thread and have to
+// produce the same image.
+constexpr int RUNS_PER_MEASUREMENT = 3;
+constexpr unsigned int RESOLUTION = 1024;
+
+static double measureRenderMilliseconds(Camera &camera, const World &world, Canvas &image) {
+  double best = INFINITY;
+  for (int run = 0; run < RUNS_PER_MEASUREMENT; ++run) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    image = camera.render(world);
+    const auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+static void comparePacketTracing(const char *name, World &world, const AABB &bounds) {
+  buildAccelerationStructure(world);
+  const Tuple center = bounds.centroid();
+  const float extent = std::max({bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y, bounds.max.z - bounds.min.z});
+
+  Camera camera(RESOLUTION, RESOLUTION, 0.8f);
+  camera.setTransform(
+      transformations::view_transform(center + Vector(0.3f * extent, 0.2f * extent, 1.5f * extent), center,
+                                      Vector(0.0f, 1.0f, 0.0f)));
+  camera.setThreadCount(1);
+
+  Canvas single(RESOLUTION, RESOLUTION);
+  Canvas packets(RESOLUTION, RESOLUTION);
+  camera.setPacketTracing(false);
+  const double singleMilliseconds = measureRenderMilliseconds(camera, world, single);
+  camera.setPacketTracing(true);
+  const double packetMilliseconds = measureRenderMilliseconds(camera, world, packets);
+
+  size_t mismatches = 0;
+  for (unsigned int y = 0; y < RESOLUTION; ++y) {
+    for (unsigned int x = 0; x < RESOLUTION; ++x) {
+      mismatches += single.pixelAt(x, y) != packets.pixelAt(x, y);
+    }
+  }
+  std::cout << name << " at " << RESOLUTION << "x" << RESOLUTION << ": single rays " << singleMilliseconds
+            << " ms, packets of " << RAY_PACKET_SIZE << " " << packetMilliseconds << " ms, speedup "
+            << singleMilliseconds / packetMilliseconds << ", " << mismatches << " pixels differ\n";
+}
+
+int main() {
+  World bunnyWorld;
+  const auto bunny = loadMeshFromObjFile(bunnyWorld, "stanford-bunny.obj");
+  if (!bunny.has_value()) {
+    std::cerr << "Could not load stanford-bunny.obj, run this from the repository root\n";
+    return 1;
+  }
+  bunnyWorld.objects[*bunny].MaterialIndex =
+      static_cast<int16_t>(addMaterial(bunnyWorld, material::createDefaultMaterial()));
+  comparePacketTracing("bunny", bunnyWorld, bunnyWorld.objects[*bunny].boundingBox);
+
+  // A grid of instances exercises the packet traversal of the object hierarchy as well
+  World crowdWorld;
+  const auto suzanne = loadMesh(crowdWorld, "suzanne.obj");
+  if (!suzanne.has_value()) {
+    std::cerr << "Could not load suzanne.obj, run this from the repository root\n";
+    return 1;
+  }
+  const auto material = static_cast<int16_t>(addMaterial(crowdWorld, material::createDefaultMaterial()));
+  AABB crowdBounds = AABB::empty();
+  for (int x = 0; x < 10; ++x) {
+    for (int z = 0; z < 10; ++z) {
+      const auto instance = addMeshInstance(crowdWorld, *suzanne,
+                                            transformations::translation(3.0f * x, 0.0f, -3.0f * z) *
+                                                transformations::rotation_y(0.3f * static_cast<float>(x + z)));
+      crowdWorld.objects[instance].MaterialIndex = material;
+      crowdBounds.expandToInclude(
+          crowdWorld.objects[instance].boundingBox.transform(crowdWorld.objects[instance].transform));
+    }
+  }
+  comparePacketTracing("suzanne crowd", crowdWorld, crowdBounds);
+
+  return 0;
+}
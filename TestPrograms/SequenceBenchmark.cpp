@@ -0,0 +1,81 @@
+#include <cmath>
+#include <iostream>
+#include <numbers>
+#include <vector>
+
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/Sequence.hpp"
+#include "libraries/Scene/include/World.hpp"
+#include "libraries/Utility/include/Transformations.hpp"
+
+using namespace raytracer;
+using namespace utility;
+using namespace scene;
+
+// Renders a short animation of spinning meshes seen by an orbiting camera and prints the time spent on every frame.
+// The first frame builds the object hierarchy, the others refit it, so they show the steady state throughput. Frames
+// are written to <prefix>0000.ppm and so on when a prefix is given, and dropped otherwise.
+constexpr size_t FRAME_COUNT = 24;
+constexpr unsigned int RESOLUTION = 256;
+
+int main(int argc, char **argv) {
+  World world;
+  const auto suzanne = loadMesh(world, "suzanne.obj");
+  if (!suzanne.has_value()) {
+    std::cerr << "Could not load suzanne.obj, run this from the repository root\n";
+    return 1;
+  }
+  auto shiny = material::createDefaultMaterial();
+  shiny.surfaceColor = Color(0.9f, 0.6f, 0.2f);
+  shiny.reflectance = 0.3f;
+  const auto shinyIndex = static_cast<int16_t>(addMaterial(world, shiny));
+
+  std::vector<ObjectTrack> objectTracks;
+  for (int x = 0; x < 8; ++x) {
+    for (int z = 0; z < 8; ++z) {
+      const auto instance = addMeshInstance(world, *suzanne);
+      world.objects[instance].MaterialIndex = shinyIndex;
+      ObjectTrack track{instance, {}};
+      for (size_t frame = 0; frame < FRAME_COUNT; ++frame) {
+        const float angle = 0.3f * static_cast<float>(x + z) + 0.1f * static_cast<float>(frame);
+        track.transforms.push_back(transformations::translation(3.0f * (x - 4), 0.0f, 3.0f * z) *
+                                   transformations::rotation_y(angle));
+      }
+      objectTracks.push_back(std::move(track));
+    }
+  }
+  auto floorMaterial = material::createDefaultMaterial();
+  floorMaterial.reflectance = 0.5f;
+  const auto floorIndex = addObjectWithMaterial(world, WorldObject{ShapeTypeTag{ShapeType::Plane}}, floorMaterial);
+  addTransformToObject(world, floorIndex, transformations::translation(0.0f, -1.0f, 0.0f));
+  addLight(world, PointLight(Color(1, 1, 1), Point(-10.0f, 10.0f, -10.0f)));
+
+  std::vector<Matrix<4, 4>> cameraTrack;
+  for (size_t frame = 0; frame < FRAME_COUNT; ++frame) {
+    const float angle = 0.5f * std::numbers::pi_v<float> * static_cast<float>(frame) / FRAME_COUNT;
+    const auto eye = Point(9.0f * std::sin(angle), 3.0f, 10.0f - 19.0f * std::cos(angle));
+    cameraTrack.push_back(transformations::view_transform(eye, Point(0.0f, 0.0f, 10.0f), Vector(0.0f, 1.0f, 0.0f)));
+  }
+
+  Camera camera(RESOLUTION, RESOLUTION, 1.0f);
+  const FrameWriter writer = argc > 1 ? ppmFrameWriter(argv[1]) : FrameWriter([](const Canvas &, size_t) {});
+  const auto timings = renderSequence(camera, world, cameraTrack, objectTracks, writer);
+
+  double steadyMilliseconds = 0.0;
+  for (size_t frame = 0; frame < timings.size(); ++frame) {
+    const auto &frameTimings = timings[frame];
+    const double total =
+        frameTimings.updateMilliseconds + frameTimings.renderMilliseconds + frameTimings.stallMilliseconds;
+    std::cout << "frame " << frame << ": update " << frameTimings.updateMilliseconds << " ms"
+              << (frameTimings.rebuilt ? " (rebuilt)" : "") << ", render " << frameTimings.renderMilliseconds
+              << " ms, stall " << frameTimings.stallMilliseconds << " ms, write " << frameTimings.writeMilliseconds
+              << " ms\n";
+    if (frame > 0) {
+      steadyMilliseconds += total;
+    }
+  }
+  if (timings.size() > 1) {
+    std::cout << "steady state: " << steadyMilliseconds / static_cast<double>(timings.size() - 1) << " ms per frame\n";
+  }
+  return 0;
+}
@@ -46,6 +46,8 @@ int main() {
 
   addLight(world, scene::PointLight{utility::Color(1.0f, 1.0f, 1.0f), utility::Point(-10.0f, 10.0f, -10.0f)});
 
+  buildAccelerationStructure(world);
+
   auto camera = scene::Camera(400, 400, 1.0f);
   camera.setTransform(utility::transformations::view_transform(
       utility::Point(0.0f, 0.0f, -5.0f), utility::Point(0.0f, 0.0f, 0.0f), utility::Vector(0.0f, 1.0f, 0.0f)));
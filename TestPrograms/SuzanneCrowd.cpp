@@ -0,0 +1,81 @@
+#include <fstream>
+#include <iostream>
+#include <numbers>
+
+#include "libraries/Canvas/include/Canvas.hpp"
+#include "libraries/Material/include/Material.hpp"
+#include "libraries/Material/include/Pattern.hpp"
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/Light.hpp"
+#include "libraries/Scene/include/World.hpp"
+#include "libraries/Utility/include/Transformations.hpp"
+#include "libraries/Utility/include/Tuple.hpp"
+
+using namespace raytracer;
+using namespace material;
+using namespace geometry;
+using namespace scene;
+
+// Renders a crowd of Suzanne instances. The triangles and their hierarchy are
+// loaded once and shared, every instance only adds a transform and a
+// material, so the memory use stays that of a single Suzanne.
+int main() {
+  World world;
+
+  const auto meshIndex = loadMesh(world, "suzanne.obj");
+  if (!meshIndex.has_value()) {
+    std::cerr << "Could not load suzanne.obj, run this from the repository root\n";
+    return 1;
+  }
+
+  auto floorMaterial = createDefaultMaterial();
+  floorMaterial.ambient = 0.2f;
+  floorMaterial.specular = 0.0f;
+  const auto floorIndex = addObjectWithMaterial(
+      world, WorldObject{ShapeTypeTag{ShapeType::Plane}}, floorMaterial,
+      Pattern{PatternType::Checker, PatternData{utility::Color(0.8f, 0.8f, 0.8f), utility::Color(0.3f, 0.3f, 0.3f)}});
+  addTransformToObject(world, floorIndex, utility::transformations::translation(0.0f, -1.0f, 0.0f));
+
+  // Suzanne is modelled around (-2.5, 1.4, 4.9), move her to the origin before placing the instances
+  const auto &meshBounds = world.meshData[*meshIndex].bvh.nodes[0].bounds;
+  const auto center = meshBounds.centroid();
+  const auto recenter = utility::transformations::translation(-center.x, -center.y, -center.z);
+
+  constexpr int rows = 25;
+  constexpr int columns = 20;
+  for (int row = 0; row < rows; ++row) {
+    for (int column = 0; column < columns; ++column) {
+      auto instanceMaterial = createDefaultMaterial();
+      instanceMaterial.surfaceColor = utility::Color(0.3f + 0.7f * column / columns, 0.6f, 0.3f + 0.7f * row / rows);
+      instanceMaterial.ambient = 0.1f;
+      instanceMaterial.diffuse = 0.8f;
+
+      const float x = (column - columns / 2.0f) * 2.5f;
+      const float z = row * 2.5f;
+      // Turn every instance around to face the camera, with a little variation per instance
+      const float turn = std::numbers::pi_v<float> * (1.0f + ((row * columns + column) % 7 - 3) / 12.0f);
+      const auto instance =
+          addMeshInstance(world, *meshIndex,
+                          utility::transformations::translation(x, 0.0f, z) *
+                              utility::transformations::rotation_y(turn) * recenter);
+      world.objects[instance].MaterialIndex = static_cast<int16_t>(addMaterial(world, instanceMaterial));
+    }
+  }
+
+  addLight(world, scene::PointLight{utility::Color(1.0f, 1.0f, 1.0f), utility::Point(-20.0f, 30.0f, -20.0f)});
+
+  buildAccelerationStructure(world);
+
+  auto camera = scene::Camera(1200, 600, 1.2f);
+  camera.setTransform(utility::transformations::view_transform(
+      utility::Point(0.0f, 8.0f, -12.0f), utility::Point(0.0f, 0.0f, 20.0f), utility::Vector(0.0f, 1.0f, 0.0f)));
+
+  auto canvas = camera.render(world);
+
+  std::ofstream image{"SuzanneCrowd.ppm", std::ios::out | std::ios::trunc};
+  canvas.canvasToPPM(image);
+
+  std::cout << "Rendered " << rows * columns << " instances sharing " << world.triangleData.size() << " triangles\n";
+
+  return 0;
+}
@@ -46,6 +46,8 @@ int main() {
   addLight(world, scene::PointLight{utility::Color(1.0f, 1.0f, 1.0f),
                                     center + utility::Vector(-8.0f, 8.0f, 8.0f)});
 
+  buildAccelerationStructure(world);
+
   // The model faces towards positive z, so the camera is placed on that side
   auto camera = scene::Camera(1000, 1000, 1.0f);
   camera.setTransform(utility::transformations::view_transform(center + utility::Vector(0.0f, 0.0f, 5.0f), center,
@@ -0,0 +1,86 @@
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "libraries/Geometry/include/Shape.hpp"
+#include "libraries/Scene/include/World.hpp"
+
+using namespace raytracer;
+using namespace utility;
+using namespace geometry;
+using namespace scene;
+
+// Compares the per triangle Möller Trumbore test on TriangleData with the batched test on the SoA positions. Every
+// ray is tested against all of the bunny's triangles, split into chunks of the size of a hierarchy leaf, so the
+// numbers reflect the leaf sizes the traversal produces rather than one long loop.
+constexpr int RAY_COUNT = 256;
+
+template <typename Kernel>
+static double measureNanosecondsPerTest(const std::vector<Ray> &rays, const uint32_t triangleCount, Kernel &&kernel,
+                                        int32_t &checksum) {
+  const auto start = std::chrono::high_resolution_clock::now();
+  checksum = 0;
+  for (const auto &ray : rays) {
+    checksum += kernel(ray);
+  }
+  const auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() / (double(rays.size()) * triangleCount);
+}
+
+int main() {
+  World world;
+  const auto meshIndex = loadMesh(world, "stanford-bunny.obj");
+  if (!meshIndex.has_value()) {
+    std::cerr << "Could not load stanford-bunny.obj, run this from the repository root\n";
+    return 1;
+  }
+  const MeshData &mesh = world.meshData[*meshIndex];
+  const auto triangleCount = static_cast<uint32_t>(mesh.triangleCount);
+
+  // Rays from a point in front of the bunny towards random points inside its bounds
+  const AABB &bounds = mesh.bvh.nodes[0].bounds;
+  std::mt19937 generator(42);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<Ray> rays;
+  const Tuple eye = bounds.centroid() + Vector(0.0f, 0.0f, 2.0f * (bounds.max.z - bounds.min.z));
+  for (int i = 0; i < RAY_COUNT; ++i) {
+    const Tuple target = Point(bounds.min.x + unit(generator) * (bounds.max.x - bounds.min.x),
+                               bounds.min.y + unit(generator) * (bounds.max.y - bounds.min.y),
+                               bounds.min.z + unit(generator) * (bounds.max.z - bounds.min.z));
+    rays.emplace_back(eye, (target - eye).normalize());
+  }
+
+  std::cout << triangleCount << " triangles, " << RAY_COUNT << " rays\n";
+  for (const uint32_t chunkSize : {4u, 8u, 16u, 64u}) {
+    int32_t scalarChecksum = 0;
+    const double scalar = measureNanosecondsPerTest(rays, triangleCount, [&](const Ray &ray) {
+      TriangleHit hit;
+      for (uint32_t first = 0; first < triangleCount; first += chunkSize) {
+        for (uint32_t i = first; i < std::min(first + chunkSize, triangleCount); ++i) {
+          float t, u, v;
+          if (intersectTriangle(world.triangleData[mesh.firstTriangleIndex + i], ray.origin, ray.direction, t, u, v) &&
+              t < hit.t) {
+            hit = TriangleHit{t, u, v, static_cast<int32_t>(i)};
+          }
+        }
+      }
+      return hit.triangleIndex;
+    }, scalarChecksum);
+
+    int32_t batchedChecksum = 0;
+    const double batched = measureNanosecondsPerTest(rays, triangleCount, [&](const Ray &ray) {
+      TriangleHit hit;
+      for (uint32_t first = 0; first < triangleCount; first += chunkSize) {
+        intersectTriangles(mesh.positions, first, std::min(chunkSize, triangleCount - first), ray, hit);
+      }
+      return hit.triangleIndex;
+    }, batchedChecksum);
+
+    std::cout << "  chunks of " << chunkSize << ": scalar " << scalar << " ns/test, batched " << batched
+              << " ns/test, speedup " << scalar / batched << (scalarChecksum == batchedChecksum ? "" : " (MISMATCH)")
+              << '\n';
+  }
+
+  return 0;
+}
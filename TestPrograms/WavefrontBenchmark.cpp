@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/Wavefront.hpp"
+#include "libraries/Scene/include/World.hpp"
+#include "libraries/Utility/include/Transformations.hpp"
+
+using namespace raytracer;
+using namespace utility;
+using namespace scene;
+
+// Compares the recursive renderer with the wavefront renderer on a scene where most hits spawn reflected rays, and a
+// glass sphere adds refracted ones. Both have to produce the same image.
+constexpr int RUNS_PER_MEASUREMENT = 3;
+constexpr unsigned int RESOLUTION = 512;
+
+template <typename Render> static double measureRenderMilliseconds(Render &&render, Canvas &image) {
+  double best = INFINITY;
+  for (int run = 0; run < RUNS_PER_MEASUREMENT; ++run) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    image = render();
+    const auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+int main() {
+  World world;
+  const auto suzanne = loadMesh(world, "suzanne.obj");
+  if (!suzanne.has_value()) {
+    std::cerr << "Could not load suzanne.obj, run this from the repository root\n";
+    return 1;
+  }
+  auto shiny = material::createDefaultMaterial();
+  shiny.surfaceColor = Color(0.9f, 0.6f, 0.2f);
+  shiny.reflectance = 0.3f;
+  const auto shinyIndex = static_cast<int16_t>(addMaterial(world, shiny));
+  for (int x = 0; x < 8; ++x) {
+    for (int z = 0; z < 8; ++z) {
+      const auto instance = addMeshInstance(world, *suzanne,
+                                            transformations::translation(3.0f * (x - 4), 0.0f, 3.0f * z) *
+                                                transformations::rotation_y(0.3f * static_cast<float>(x + z)));
+      world.objects[instance].MaterialIndex = shinyIndex;
+    }
+  }
+  auto floorMaterial = material::createDefaultMaterial();
+  floorMaterial.reflectance = 0.5f;
+  const auto floorIndex = addObjectWithMaterial(world, WorldObject{ShapeTypeTag{ShapeType::Plane}}, floorMaterial);
+  addTransformToObject(world, floorIndex, transformations::translation(0.0f, -1.0f, 0.0f));
+  const auto glassIndex = addObjectWithMaterial(world, WorldObject{ShapeTypeTag{ShapeType::Sphere}},
+                                                material::Material(Color(1, 1, 1), 0, 0, 0.9, 300, 0.9, 0.9, 1.5));
+  addTransformToObject(world, glassIndex, transformations::translation(0.0f, 1.0f, -3.0f));
+  addLight(world, PointLight(Color(1, 1, 1), Point(-10.0f, 10.0f, -10.0f)));
+  buildAccelerationStructure(world);
+
+  Camera camera(RESOLUTION, RESOLUTION, 1.0f);
+  camera.setTransform(
+      transformations::view_transform(Point(0.0f, 3.0f, -9.0f), Point(0.0f, 0.0f, 6.0f), Vector(0.0f, 1.0f, 0.0f)));
+  camera.setThreadCount(1);
+  camera.setPacketTracing(false);
+
+  Canvas recursive(RESOLUTION, RESOLUTION);
+  Canvas wavefront(RESOLUTION, RESOLUTION);
+  const double recursiveMilliseconds = measureRenderMilliseconds([&] { return camera.render(world); }, recursive);
+  WavefrontTimings timings;
+  const double wavefrontMilliseconds =
+      measureRenderMilliseconds([&] { return renderWavefront(camera, world, &timings); }, wavefront);
+
+  size_t mismatches = 0;
+  for (unsigned int y = 0; y < RESOLUTION; ++y) {
+    for (unsigned int x = 0; x < RESOLUTION; ++x) {
+      mismatches += recursive.pixelAt(x, y) != wavefront.pixelAt(x, y);
+    }
+  }
+  std::cout << RESOLUTION << "x" << RESOLUTION << ": recursive " << recursiveMilliseconds << " ms, wavefront "
+            << wavefrontMilliseconds << " ms, " << mismatches << " pixels differ\n";
+  std::cout << "wavefront stages of the last run (ms): generate " << timings.generateMilliseconds << ", sort "
+            << timings.sortMilliseconds << ", trace " << timings.traceMilliseconds << ", shade "
+            << timings.shadeMilliseconds << ", shadow " << timings.shadowMilliseconds << ", accumulate "
+            << timings.accumulateMilliseconds << "\n";
+  std::cout << timings.rayCount << " rays and " << timings.shadowRayCount << " shadow rays over "
+            << timings.bounceCount << " bounces\n";
+  return 0;
+}
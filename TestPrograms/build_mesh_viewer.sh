@@ -18,7 +18,7 @@ INCLUDES="-I . -I 3rdParty $TBB_INCLUDES"
 
 # Every library implementation, EXCEPT libraries/Scene/src/main.cpp, which is a
 # stale duplicate of World/Camera and provides no main().
-SOURCES="libraries/Utility/src/*.cpp libraries/Geometry/src/*.cpp libraries/Canvas/src/*.cpp libraries/Material/src/*.cpp libraries/Scene/src/Camera.cpp libraries/Scene/src/Renderer.cpp libraries/Scene/src/World.cpp TestPrograms/MeshViewer.cpp"
+SOURCES="libraries/Utility/src/*.cpp libraries/Geometry/src/*.cpp libraries/Canvas/src/*.cpp libraries/Material/src/*.cpp libraries/Scene/src/Camera.cpp libraries/Scene/src/Renderer.cpp libraries/Scene/src/Wavefront.cpp libraries/Scene/src/ProgressiveRender.cpp libraries/Scene/src/Sequence.cpp libraries/Scene/src/World.cpp libraries/Scene/src/MeshCache.cpp TestPrograms/MeshViewer.cpp"
 
 # Compile
 $CXX $CXXFLAGS $INCLUDES $SOURCES $TBB_LINK -o TestPrograms/MeshViewer
@@ -23,13 +23,20 @@ SOURCES="$SOURCES libraries/Utility/src/Color.cpp"
 SOURCES="$SOURCES libraries/Utility/src/LinearAllocator.cpp"
 SOURCES="$SOURCES libraries/Utility/src/Ray.cpp"
 SOURCES="$SOURCES libraries/Utility/src/Transformations.cpp"
+SOURCES="$SOURCES libraries/Utility/src/BVH.cpp"
+SOURCES="$SOURCES libraries/Utility/src/WideBVH.cpp"
+SOURCES="$SOURCES libraries/Utility/src/MappedFile.cpp"
 SOURCES="$SOURCES libraries/Geometry/src/Intersections.cpp"
 SOURCES="$SOURCES libraries/Geometry/src/Shape.cpp"
 SOURCES="$SOURCES libraries/Canvas/src/Canvas.cpp"
 SOURCES="$SOURCES libraries/Material/src/Pattern.cpp"
 SOURCES="$SOURCES libraries/Scene/src/Camera.cpp"
 SOURCES="$SOURCES libraries/Scene/src/Renderer.cpp"
+SOURCES="$SOURCES libraries/Scene/src/Wavefront.cpp"
+SOURCES="$SOURCES libraries/Scene/src/ProgressiveRender.cpp"
+SOURCES="$SOURCES libraries/Scene/src/Sequence.cpp"
 SOURCES="$SOURCES libraries/Scene/src/World.cpp"
+SOURCES="$SOURCES libraries/Scene/src/MeshCache.cpp"
 SOURCES="$SOURCES TestPrograms/SingleTriangle.cpp"
 
 # Compile
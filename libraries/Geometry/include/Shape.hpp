@@ -3,6 +3,9 @@
 
 #include "libraries/Material/include/Material.hpp"
 #include "libraries/Utility/include/AABB.hpp"
+#include "libraries/Utility/include/BVH.hpp"
+#include "libraries/Utility/include/RayPacket.hpp"
+#include "libraries/Utility/include/WideBVH.hpp"
 #include "libraries/Utility/include/Matrix.hpp"
 #include <cstdint>
 
@@ -34,6 +37,7 @@ struct WorldObject {
   int16_t parentIndex = -1;
   int16_t MaterialIndex = -1;
   bool hasShadow = true;
+  int32_t motionIndex = -1; ///< Where the object ends up when it moves while the shutter is open, see setObjectMotion.
 };
 
 struct GroupData {
@@ -51,16 +55,75 @@ struct TriangleData {
   Tuple n0, n1, n2; // per-vertex normals (for smooth shading)
 };
 
+// Triangle positions in SoA form with the edges precomputed, so consecutive triangles can be tested in one batch.
+// Indexed like the triangles of the mesh they belong to.
+struct TrianglePositions {
+  std::vector<float> v0[3];    ///< x, y and z of the first vertex.
+  std::vector<float> edge0[3]; ///< v1 - v0
+  std::vector<float> edge1[3]; ///< v2 - v0
+};
+
+// Closest triangle hit found so far, t doubles as the distance up to which further triangles are considered
+struct TriangleHit {
+  float t = INFINITY;
+  float u = 0.0f;
+  float v = 0.0f;
+  int32_t triangleIndex = -1;
+};
+
 // A mesh is a contiguous range of triangles in the world's triangle data vector
 struct MeshData {
   int32_t firstTriangleIndex = 0;
   int32_t triangleCount = 0;
+  TrianglePositions positions; ///< Copy of the triangle positions used for the intersection tests.
+  // Hierarchy over the mesh's triangles. The triangle range is reordered to match the hierarchy, so the leaves
+  // index triangles relative to firstTriangleIndex and the hierarchy keeps no primitive index list.
+  BVH bvh;
+  WideBVH<WIDE_BVH_WIDTH> wideBVH; ///< bvh collapsed for traversal.
 };
 
+// Fills the SoA positions from the mesh's range of triangleData, needs to be redone whenever that range changes
+void buildTrianglePositions(MeshData &mesh, const std::vector<TriangleData> &triangleData) noexcept;
+bool intersectTriangle(const TriangleData &tri, const Tuple &orig, const Tuple &dir, float &t, float &u,
+                       float &v) noexcept;
+// Tests the triangles [first, first + count) of the positions, 8 at a time when AVX2 is available. Updates hit when
+// one of them is closer than hit.t, with triangleIndex relative to the start of the positions.
+void intersectTriangles(const TrianglePositions &positions, uint32_t first, uint32_t count, const Ray &ray,
+                        TriangleHit &hit) noexcept;
+// Packet version of intersectTriangles: every triangle is tested against all rays in rayMask at once, hits[lane]
+// being the closest hit of the ray in that lane.
+void intersectTrianglesPacket(const TrianglePositions &positions, uint32_t first, uint32_t count,
+                              const RayPacket<RAY_PACKET_SIZE> &packet, uint32_t rayMask, TriangleHit *hits) noexcept;
+
 void localIntersect(const Ray &objectSpaceRay, const WorldObject &object, Arena<Intersection> &intersections,
                     const std::vector<CircularSolidData> &circularObjectData,
                     const std::vector<TriangleData> &triObjectData,
                     const std::vector<MeshData> &meshObjectData) noexcept;
+// Every crossing of the ray with the triangles of the mesh, where localIntersect only reports the closest. A closed
+// mesh contains the ray origin when the number of crossings is odd.
+void meshCrossings(const Ray &objectSpaceRay, const WorldObject &object, Arena<Intersection> &intersections,
+                   const std::vector<TriangleData> &triObjectData,
+                   const std::vector<MeshData> &meshObjectData) noexcept;
+// Closest hit query: the nearest hit of the object in (0, maxDistance), written to hit. Lowers maxDistance to the
+// distance of that hit and returns false (leaving hit untouched) when the object has nothing closer.
+bool localClosestHit(const Ray &objectSpaceRay, const WorldObject &object, float &maxDistance, Intersection &hit,
+                     const std::vector<CircularSolidData> &circularObjectData,
+                     const std::vector<TriangleData> &triObjectData,
+                     const std::vector<MeshData> &meshObjectData) noexcept;
+// localClosestHit for the rays in rayMask of an object space packet, with maxDistances and hits indexed by lane.
+// Meshes traverse their hierarchy with the whole packet (which has to be coherent), the other shapes are intersected
+// one ray at a time.
+void localClosestHits(const RayPacket<RAY_PACKET_SIZE> &objectSpacePacket, uint32_t rayMask, const WorldObject &object,
+                      float *maxDistances, Intersection *hits,
+                      const std::vector<CircularSolidData> &circularObjectData,
+                      const std::vector<TriangleData> &triObjectData,
+                      const std::vector<MeshData> &meshObjectData) noexcept;
+// Any hit query for shadow rays: whether the object is hit anywhere in [minDistance, maxDistance] along the ray.
+// Meshes stop at the first triangle found, the other shapes are cheap enough to intersect in full.
+bool localOccluded(const Ray &objectSpaceRay, const WorldObject &object, float minDistance, float maxDistance,
+                   const std::vector<CircularSolidData> &circularObjectData,
+                   const std::vector<TriangleData> &triObjectData,
+                   const std::vector<MeshData> &meshObjectData) noexcept;
 Tuple normalAt(const WorldObject &object, const Tuple &point, const std::vector<CircularSolidData> &circularObjectData,
                const std::vector<TriangleData> &triObjectData, float u = 0.0f, float v = 0.0f,
                int32_t triangleIndex = -1) noexcept;
@@ -1,8 +1,13 @@
 #include <algorithm>
+#include <bit>
 #include <cmath>
 #include <cstdint>
 #include <tuple>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #include "libraries/Geometry/include/Shape.hpp"
 #include "libraries/Scene/include/World.hpp"
 #include "libraries/Utility/include/FloatUtils.hpp"
@@ -59,37 +64,311 @@ static inline void addCircularSideIntersections(float a, float b, float c, const
 // https://www.scratchapixel.com/lessons/3d-basic-rendering/ray-tracing-rendering-a-triangle//moller-trumbore-ray-triangle-intersection.html
 // The main gist is that cramer's rule is used to solve a system of equations where the coordinates are in the
 // barycentric system
-static inline void addTriangleIntersection(const TriangleData &tri, const Tuple &orig, const Tuple &dir,
-                                           const WorldObject &object, const int32_t triangleIndex,
-                                           Arena<Intersection> &intersections) noexcept {
+bool intersectTriangle(const TriangleData &tri, const Tuple &orig, const Tuple &dir, float &t, float &u,
+                       float &v) noexcept {
   Tuple e0 = tri.v1 - tri.v0;
   Tuple e1 = tri.v2 - tri.v0;
   const Tuple perpVec = dir.cross(e1); // perpendicular to dir and edge2
   const float det = e0.dot(perpVec);
   if (fabs(det) < EPSILON<float> * EPSILON<float>)
-    return;
+    return false;
 
   // Replace the middle column vector by O - A
   const float invDet = 1.0f / det;
   const Tuple v0ToOrig = orig - tri.v0;
-  const float u = invDet * v0ToOrig.dot(perpVec);
+  u = invDet * v0ToOrig.dot(perpVec);
   if (u < 0.0f || u > 1.0f)
-    return;
+    return false;
 
   // replace the last column vector by O - A
   const Tuple origCrossEdge1 = v0ToOrig.cross(e0);
-  const float v = invDet * dir.dot(origCrossEdge1);
+  v = invDet * dir.dot(origCrossEdge1);
   if (v < 0.0f || u + v > 1.0f)
-    return;
+    return false;
 
   // Replace the first column by vector O-A
-  const float t = invDet * e1.dot(origCrossEdge1);
-  if (t > EPSILON<float>) {
+  t = invDet * e1.dot(origCrossEdge1);
+  return t > EPSILON<float>;
+}
+
+static inline void addTriangleIntersection(const TriangleData &tri, const Tuple &orig, const Tuple &dir,
+                                           const WorldObject &object, const int32_t triangleIndex,
+                                           Arena<Intersection> &intersections) noexcept {
+  float t, u, v;
+  if (intersectTriangle(tri, orig, dir, t, u, v)) {
     // Record the barycentric coordinates so the normal can be interpolated
     intersections.pushBack(Intersection{&object, t, u, v, triangleIndex});
   }
 }
 
+void buildTrianglePositions(MeshData &mesh, const std::vector<TriangleData> &triangleData) noexcept {
+  TrianglePositions &positions = mesh.positions;
+  for (int axis = 0; axis < 3; ++axis) {
+    positions.v0[axis].resize(mesh.triangleCount);
+    positions.edge0[axis].resize(mesh.triangleCount);
+    positions.edge1[axis].resize(mesh.triangleCount);
+  }
+  for (int32_t i = 0; i < mesh.triangleCount; ++i) {
+    const TriangleData &tri = triangleData[mesh.firstTriangleIndex + i];
+    const Tuple e0 = tri.v1 - tri.v0;
+    const Tuple e1 = tri.v2 - tri.v0;
+    for (int axis = 0; axis < 3; ++axis) {
+      positions.v0[axis][i] = (&tri.v0.x)[axis];
+      positions.edge0[axis][i] = (&e0.x)[axis];
+      positions.edge1[axis][i] = (&e1.x)[axis];
+    }
+  }
+}
+
+#if defined(__AVX2__)
+// The same Möller Trumbore test as intersectTriangle, for 8 triangles per instruction. Lanes past count are masked
+// off on load, so leaves do not need to be padded to a multiple of 8.
+void intersectTriangles(const TrianglePositions &positions, const uint32_t first, const uint32_t count, const Ray &ray,
+                        TriangleHit &hit) noexcept {
+  const __m256 dirX = _mm256_set1_ps(ray.direction.x);
+  const __m256 dirY = _mm256_set1_ps(ray.direction.y);
+  const __m256 dirZ = _mm256_set1_ps(ray.direction.z);
+  const __m256 origX = _mm256_set1_ps(ray.origin.x);
+  const __m256 origY = _mm256_set1_ps(ray.origin.y);
+  const __m256 origZ = _mm256_set1_ps(ray.origin.z);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 minDet = _mm256_set1_ps(EPSILON<float> * EPSILON<float>);
+  const __m256 minT = _mm256_set1_ps(EPSILON<float>);
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  for (uint32_t batch = first; batch < first + count; batch += 8) {
+    const int lanes = static_cast<int>(std::min(8u, first + count - batch));
+    const __m256i loadMask = _mm256_cmpgt_epi32(_mm256_set1_epi32(lanes), laneIndices);
+    const auto load = [&](const std::vector<float> &values) {
+      return _mm256_maskload_ps(values.data() + batch, loadMask);
+    };
+    const __m256 e0X = load(positions.edge0[0]), e0Y = load(positions.edge0[1]), e0Z = load(positions.edge0[2]);
+    const __m256 e1X = load(positions.edge1[0]), e1Y = load(positions.edge1[1]), e1Z = load(positions.edge1[2]);
+
+    // perpVec = dir x edge1
+    const __m256 perpX = _mm256_sub_ps(_mm256_mul_ps(dirY, e1Z), _mm256_mul_ps(dirZ, e1Y));
+    const __m256 perpY = _mm256_sub_ps(_mm256_mul_ps(dirZ, e1X), _mm256_mul_ps(dirX, e1Z));
+    const __m256 perpZ = _mm256_sub_ps(_mm256_mul_ps(dirX, e1Y), _mm256_mul_ps(dirY, e1X));
+    const __m256 det =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e0X, perpX), _mm256_mul_ps(e0Y, perpY)), _mm256_mul_ps(e0Z, perpZ));
+    __m256 valid = _mm256_and_ps(_mm256_castsi256_ps(loadMask),
+                                 _mm256_cmp_ps(_mm256_and_ps(det, absMask), minDet, _CMP_GE_OQ));
+    const __m256 invDet = _mm256_div_ps(one, det);
+
+    const __m256 toOrigX = _mm256_sub_ps(origX, load(positions.v0[0]));
+    const __m256 toOrigY = _mm256_sub_ps(origY, load(positions.v0[1]));
+    const __m256 toOrigZ = _mm256_sub_ps(origZ, load(positions.v0[2]));
+    const __m256 u = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(toOrigX, perpX),
+                                                                       _mm256_mul_ps(toOrigY, perpY)),
+                                                         _mm256_mul_ps(toOrigZ, perpZ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+    // origCrossEdge0 = toOrig x edge0
+    const __m256 crossX = _mm256_sub_ps(_mm256_mul_ps(toOrigY, e0Z), _mm256_mul_ps(toOrigZ, e0Y));
+    const __m256 crossY = _mm256_sub_ps(_mm256_mul_ps(toOrigZ, e0X), _mm256_mul_ps(toOrigX, e0Z));
+    const __m256 crossZ = _mm256_sub_ps(_mm256_mul_ps(toOrigX, e0Y), _mm256_mul_ps(toOrigY, e0X));
+    const __m256 v = _mm256_mul_ps(
+        invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, crossX), _mm256_mul_ps(dirY, crossY)),
+                              _mm256_mul_ps(dirZ, crossZ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ),
+                                               _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+
+    const __m256 t = _mm256_mul_ps(
+        invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1X, crossX), _mm256_mul_ps(e1Y, crossY)),
+                              _mm256_mul_ps(e1Z, crossZ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, minT, _CMP_GT_OQ),
+                                               _mm256_cmp_ps(t, _mm256_set1_ps(hit.t), _CMP_LT_OQ)));
+
+    int hitMask = _mm256_movemask_ps(valid);
+    if (hitMask == 0) {
+      continue;
+    }
+    alignas(32) float ts[8], us[8], vs[8];
+    _mm256_store_ps(ts, t);
+    _mm256_store_ps(us, u);
+    _mm256_store_ps(vs, v);
+    while (hitMask != 0) {
+      const int lane = __builtin_ctz(hitMask);
+      hitMask &= hitMask - 1;
+      if (ts[lane] < hit.t) {
+        hit = TriangleHit{ts[lane], us[lane], vs[lane], static_cast<int32_t>(batch) + lane};
+      }
+    }
+  }
+}
+#else
+void intersectTriangles(const TrianglePositions &positions, const uint32_t first, const uint32_t count, const Ray &ray,
+                        TriangleHit &hit) noexcept {
+  for (uint32_t i = first; i < first + count; ++i) {
+    TriangleData tri;
+    tri.v0 = Point(positions.v0[0][i], positions.v0[1][i], positions.v0[2][i]);
+    tri.v1 = tri.v0 + Vector(positions.edge0[0][i], positions.edge0[1][i], positions.edge0[2][i]);
+    tri.v2 = tri.v0 + Vector(positions.edge1[0][i], positions.edge1[1][i], positions.edge1[2][i]);
+    float t, u, v;
+    if (intersectTriangle(tri, ray.origin, ray.direction, t, u, v) && t < hit.t) {
+      hit = TriangleHit{t, u, v, static_cast<int32_t>(i)};
+    }
+  }
+}
+#endif
+
+#if defined(__AVX2__)
+// intersectTriangles turned around: one triangle is broadcast and tested against a ray per lane. The closest hit of
+// every lane is kept in registers until the whole range has been tested.
+void intersectTrianglesPacket(const TrianglePositions &positions, const uint32_t first, const uint32_t count,
+                              const RayPacket<RAY_PACKET_SIZE> &packet, const uint32_t rayMask,
+                              TriangleHit *hits) noexcept {
+  const __m256 dirX = _mm256_load_ps(packet.direction[0]);
+  const __m256 dirY = _mm256_load_ps(packet.direction[1]);
+  const __m256 dirZ = _mm256_load_ps(packet.direction[2]);
+  const __m256 origX = _mm256_load_ps(packet.origin[0]);
+  const __m256 origY = _mm256_load_ps(packet.origin[1]);
+  const __m256 origZ = _mm256_load_ps(packet.origin[2]);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 minDet = _mm256_set1_ps(EPSILON<float> * EPSILON<float>);
+  const __m256 minT = _mm256_set1_ps(EPSILON<float>);
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256i laneBits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  const __m256 active = _mm256_castsi256_ps(
+      _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(static_cast<int>(rayMask)), laneBits), laneBits));
+
+  alignas(32) float ts[8], us[8], vs[8];
+  alignas(32) int32_t indices[8];
+  for (int lane = 0; lane < 8; ++lane) {
+    ts[lane] = hits[lane].t;
+    us[lane] = hits[lane].u;
+    vs[lane] = hits[lane].v;
+    indices[lane] = hits[lane].triangleIndex;
+  }
+  __m256 bestT = _mm256_load_ps(ts);
+  __m256 bestU = _mm256_load_ps(us);
+  __m256 bestV = _mm256_load_ps(vs);
+  __m256i bestIndex = _mm256_load_si256(reinterpret_cast<const __m256i *>(indices));
+
+  for (uint32_t i = first; i < first + count; ++i) {
+    const __m256 e0X = _mm256_set1_ps(positions.edge0[0][i]);
+    const __m256 e0Y = _mm256_set1_ps(positions.edge0[1][i]);
+    const __m256 e0Z = _mm256_set1_ps(positions.edge0[2][i]);
+    const __m256 e1X = _mm256_set1_ps(positions.edge1[0][i]);
+    const __m256 e1Y = _mm256_set1_ps(positions.edge1[1][i]);
+    const __m256 e1Z = _mm256_set1_ps(positions.edge1[2][i]);
+
+    const __m256 perpX = _mm256_sub_ps(_mm256_mul_ps(dirY, e1Z), _mm256_mul_ps(dirZ, e1Y));
+    const __m256 perpY = _mm256_sub_ps(_mm256_mul_ps(dirZ, e1X), _mm256_mul_ps(dirX, e1Z));
+    const __m256 perpZ = _mm256_sub_ps(_mm256_mul_ps(dirX, e1Y), _mm256_mul_ps(dirY, e1X));
+    const __m256 det =
+        _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e0X, perpX), _mm256_mul_ps(e0Y, perpY)), _mm256_mul_ps(e0Z, perpZ));
+    __m256 valid = _mm256_and_ps(active, _mm256_cmp_ps(_mm256_and_ps(det, absMask), minDet, _CMP_GE_OQ));
+    const __m256 invDet = _mm256_div_ps(one, det);
+
+    const __m256 toOrigX = _mm256_sub_ps(origX, _mm256_set1_ps(positions.v0[0][i]));
+    const __m256 toOrigY = _mm256_sub_ps(origY, _mm256_set1_ps(positions.v0[1][i]));
+    const __m256 toOrigZ = _mm256_sub_ps(origZ, _mm256_set1_ps(positions.v0[2][i]));
+    const __m256 u = _mm256_mul_ps(invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(toOrigX, perpX),
+                                                                       _mm256_mul_ps(toOrigY, perpY)),
+                                                         _mm256_mul_ps(toOrigZ, perpZ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(u, one, _CMP_LE_OQ)));
+
+    const __m256 crossX = _mm256_sub_ps(_mm256_mul_ps(toOrigY, e0Z), _mm256_mul_ps(toOrigZ, e0Y));
+    const __m256 crossY = _mm256_sub_ps(_mm256_mul_ps(toOrigZ, e0X), _mm256_mul_ps(toOrigX, e0Z));
+    const __m256 crossZ = _mm256_sub_ps(_mm256_mul_ps(toOrigX, e0Y), _mm256_mul_ps(toOrigY, e0X));
+    const __m256 v = _mm256_mul_ps(
+        invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dirX, crossX), _mm256_mul_ps(dirY, crossY)),
+                              _mm256_mul_ps(dirZ, crossZ)));
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(v, zero, _CMP_GE_OQ),
+                                               _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ)));
+
+    const __m256 t = _mm256_mul_ps(
+        invDet, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1X, crossX), _mm256_mul_ps(e1Y, crossY)),
+                              _mm256_mul_ps(e1Z, crossZ)));
+    valid = _mm256_and_ps(valid,
+                          _mm256_and_ps(_mm256_cmp_ps(t, minT, _CMP_GT_OQ), _mm256_cmp_ps(t, bestT, _CMP_LT_OQ)));
+    if (_mm256_movemask_ps(valid) == 0) {
+      continue;
+    }
+    bestT = _mm256_blendv_ps(bestT, t, valid);
+    bestU = _mm256_blendv_ps(bestU, u, valid);
+    bestV = _mm256_blendv_ps(bestV, v, valid);
+    bestIndex = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(bestIndex), _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int32_t>(i))), valid));
+  }
+
+  _mm256_store_ps(ts, bestT);
+  _mm256_store_ps(us, bestU);
+  _mm256_store_ps(vs, bestV);
+  _mm256_store_si256(reinterpret_cast<__m256i *>(indices), bestIndex);
+  for (int lane = 0; lane < 8; ++lane) {
+    hits[lane] = TriangleHit{ts[lane], us[lane], vs[lane], indices[lane]};
+  }
+}
+#else
+void intersectTrianglesPacket(const TrianglePositions &positions, const uint32_t first, const uint32_t count,
+                              const RayPacket<RAY_PACKET_SIZE> &packet, const uint32_t rayMask,
+                              TriangleHit *hits) noexcept {
+  for (uint32_t mask = rayMask; mask != 0; mask &= mask - 1) {
+    const uint32_t lane = static_cast<uint32_t>(__builtin_ctz(mask));
+    intersectTriangles(positions, first, count, packet.ray(lane), hits[lane]);
+  }
+}
+#endif
+
+// Walks the mesh hierarchy front to back and only reports the closest hit, every hit found lowers the distance up to
+// which the remaining boxes and triangles are considered
+static inline void addMeshIntersection(const MeshData &mesh, const std::vector<TriangleData> &triObjectData,
+                                       const Ray &objectSpaceRay, const WorldObject &object,
+                                       Arena<Intersection> &intersections) noexcept {
+  TriangleHit hit;
+  const auto intersectLeaf = [&](const uint32_t first, const uint32_t count) {
+    if (!mesh.positions.v0[0].empty()) {
+      intersectTriangles(mesh.positions, first, count, objectSpaceRay, hit);
+      return;
+    }
+    // Meshes that were assembled by hand may lack the SoA positions
+    for (uint32_t i = first; i < first + count; ++i) {
+      float t, u, v;
+      if (intersectTriangle(triObjectData[mesh.firstTriangleIndex + i], objectSpaceRay.origin,
+                            objectSpaceRay.direction, t, u, v) &&
+          t < hit.t) {
+        hit = TriangleHit{t, u, v, static_cast<int32_t>(i)};
+      }
+    }
+  };
+  if (mesh.wideBVH.nodes.empty() && mesh.wideBVH.rootLeafCount == 0) {
+    // Meshes that were assembled by hand without a hierarchy are treated as one big leaf
+    intersectLeaf(0, static_cast<uint32_t>(mesh.triangleCount));
+  } else {
+    traverseWideBVHLeaves(mesh.wideBVH, objectSpaceRay, hit.t, intersectLeaf);
+  }
+  if (hit.triangleIndex != -1) {
+    intersections.pushBack(Intersection{&object, hit.t, hit.u, hit.v, mesh.firstTriangleIndex + hit.triangleIndex});
+  }
+}
+
+void meshCrossings(const Ray &objectSpaceRay, const WorldObject &object, Arena<Intersection> &intersections,
+                   const std::vector<TriangleData> &triObjectData,
+                   const std::vector<MeshData> &meshObjectData) noexcept {
+  const MeshData &mesh = meshObjectData[object.shapeTag.dataIndex];
+  const auto intersectLeaf = [&](const uint32_t first, const uint32_t count) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      const int32_t triangleIndex = mesh.firstTriangleIndex + static_cast<int32_t>(i);
+      float t, u, v;
+      if (intersectTriangle(triObjectData[triangleIndex], objectSpaceRay.origin, objectSpaceRay.direction, t, u, v)) {
+        intersections.pushBack(Intersection{&object, t, u, v, triangleIndex});
+      }
+    }
+  };
+  if (mesh.wideBVH.nodes.empty() && mesh.wideBVH.rootLeafCount == 0) {
+    intersectLeaf(0, static_cast<uint32_t>(mesh.triangleCount));
+  } else {
+    // Nothing lowers the distance, so every leaf the ray passes through is visited
+    float maxDistance = INFINITY;
+    traverseWideBVHLeaves(mesh.wideBVH, objectSpaceRay, maxDistance, intersectLeaf);
+  }
+}
+
 void localIntersect(const Ray &objectSpaceRay, const WorldObject &object, Arena<Intersection> &intersections,
                     const std::vector<CircularSolidData> &circularObjectData,
                     const std::vector<TriangleData> &triObjectData,
@@ -204,18 +483,13 @@ void localIntersect(const Ray &objectSpaceRay, const WorldObject &object, Arena<
     }
 
     case ShapeType::Mesh: {
-      const MeshData &mesh = meshObjectData[dataIdx];
-      for (int32_t i = 0; i < mesh.triangleCount; ++i) {
-        const int32_t triangleIndex = mesh.firstTriangleIndex + i;
-        addTriangleIntersection(triObjectData[triangleIndex], orig, dir, object, triangleIndex, intersections);
-      }
+      addMeshIntersection(meshObjectData[dataIdx], triObjectData, objectSpaceRay, object, intersections);
       break;
     }
 
     case ShapeType::Group: {
-      // TODO: have to go through all the shapes contained in the group
-      // and intersect with all of them
-      assert(false && "Group intersections have not been implemented yet");
+      // The renderer culls groups with their box and intersects their members, which carry the group's transform
+      assert(false && "Groups are intersected through their members");
       break;
     }
 
@@ -301,7 +575,7 @@ Tuple normalAt(const WorldObject &object, const Tuple &point, const std::vector<
     }
 
     case ShapeType::Group: {
-      assert(false && "Group normal calculation has not been implemented yet");
+      assert(false && "Groups are never hit themselves, only their members are");
       break;
     }
 
@@ -314,4 +588,173 @@ Tuple normalAt(const WorldObject &object, const Tuple &point, const std::vector<
   return object.transform * normal;
 }
 
+// Closest hit version of addMeshIntersection, boxes and triangles beyond the caller's current hit are culled as well
+static inline bool meshClosestHit(const MeshData &mesh, const std::vector<TriangleData> &triObjectData,
+                                  const Ray &objectSpaceRay, const WorldObject &object, float &maxDistance,
+                                  Intersection &closest) noexcept {
+  TriangleHit hit;
+  hit.t = maxDistance;
+  const auto intersectLeaf = [&](const uint32_t first, const uint32_t count) {
+    if (!mesh.positions.v0[0].empty()) {
+      intersectTriangles(mesh.positions, first, count, objectSpaceRay, hit);
+      return;
+    }
+    for (uint32_t i = first; i < first + count; ++i) {
+      float t, u, v;
+      if (intersectTriangle(triObjectData[mesh.firstTriangleIndex + i], objectSpaceRay.origin,
+                            objectSpaceRay.direction, t, u, v) &&
+          t < hit.t) {
+        hit = TriangleHit{t, u, v, static_cast<int32_t>(i)};
+      }
+    }
+  };
+  if (mesh.wideBVH.nodes.empty() && mesh.wideBVH.rootLeafCount == 0) {
+    intersectLeaf(0, static_cast<uint32_t>(mesh.triangleCount));
+  } else {
+    traverseWideBVHLeaves(mesh.wideBVH, objectSpaceRay, hit.t, intersectLeaf);
+  }
+  if (hit.triangleIndex == -1) {
+    return false;
+  }
+  maxDistance = hit.t;
+  closest = Intersection{&object, hit.t, hit.u, hit.v, mesh.firstTriangleIndex + hit.triangleIndex};
+  return true;
+}
+
+// Any hit version of addMeshIntersection, the traversal is cut off as soon as a leaf contains a blocker
+static inline bool meshOccluded(const MeshData &mesh, const std::vector<TriangleData> &triObjectData,
+                                const Ray &objectSpaceRay, const float minDistance, const float maxDistance) noexcept {
+  bool occluded = false;
+  float traversalDistance = maxDistance;
+  const auto testLeaf = [&](const uint32_t first, const uint32_t count) {
+    if (!mesh.positions.v0[0].empty()) {
+      TriangleHit hit;
+      hit.t = maxDistance;
+      intersectTriangles(mesh.positions, first, count, objectSpaceRay, hit);
+      if (hit.triangleIndex == -1) {
+        return;
+      }
+      if (hit.t >= minDistance) {
+        occluded = true;
+        traversalDistance = -INFINITY; // Every remaining node starts beyond this, which ends the traversal
+        return;
+      }
+    }
+    // The closest hit in the leaf is too close, one of the others might still be in range
+    for (uint32_t i = first; i < first + count; ++i) {
+      float t, u, v;
+      if (intersectTriangle(triObjectData[mesh.firstTriangleIndex + i], objectSpaceRay.origin,
+                            objectSpaceRay.direction, t, u, v) &&
+          t >= minDistance && t <= maxDistance) {
+        occluded = true;
+        traversalDistance = -INFINITY;
+        return;
+      }
+    }
+  };
+  if (mesh.wideBVH.nodes.empty() && mesh.wideBVH.rootLeafCount == 0) {
+    testLeaf(0, static_cast<uint32_t>(mesh.triangleCount));
+  } else {
+    traverseWideBVHLeaves(mesh.wideBVH, objectSpaceRay, traversalDistance, testLeaf);
+  }
+  return occluded;
+}
+
+bool localOccluded(const Ray &objectSpaceRay, const WorldObject &object, const float minDistance,
+                   const float maxDistance, const std::vector<CircularSolidData> &circularObjectData,
+                   const std::vector<TriangleData> &triObjectData,
+                   const std::vector<MeshData> &meshObjectData) noexcept {
+  if (object.shapeTag.type == ShapeType::Mesh) {
+    return meshOccluded(meshObjectData[object.shapeTag.dataIndex], triObjectData, objectSpaceRay, minDistance,
+                        maxDistance);
+  }
+
+  // The analytic shapes produce at most a handful of hits, kept apart from the caller's intersection buffer
+  static thread_local Arena<Intersection> occlusionBuffer(GB(1));
+  occlusionBuffer.clear();
+  localIntersect(objectSpaceRay, object, occlusionBuffer, circularObjectData, triObjectData, meshObjectData);
+  return std::any_of(occlusionBuffer.begin(), occlusionBuffer.end(), [&](const Intersection &intersection) {
+    return intersection.dist >= minDistance && intersection.dist <= maxDistance;
+  });
+}
+
+bool localClosestHit(const Ray &objectSpaceRay, const WorldObject &object, float &maxDistance, Intersection &hit,
+                     const std::vector<CircularSolidData> &circularObjectData,
+                     const std::vector<TriangleData> &triObjectData,
+                     const std::vector<MeshData> &meshObjectData) noexcept {
+  if (object.shapeTag.type == ShapeType::Mesh) {
+    return meshClosestHit(meshObjectData[object.shapeTag.dataIndex], triObjectData, objectSpaceRay, object,
+                          maxDistance, hit);
+  }
+
+  static thread_local Arena<Intersection> closestHitBuffer(GB(1));
+  closestHitBuffer.clear();
+  localIntersect(objectSpaceRay, object, closestHitBuffer, circularObjectData, triObjectData, meshObjectData);
+  bool found = false;
+  for (const auto &intersection : closestHitBuffer) {
+    if (intersection.dist > 0.0f && intersection.dist < maxDistance) {
+      maxDistance = static_cast<float>(intersection.dist);
+      hit = intersection;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Leaves reached by at most this many rays of a packet are intersected one ray at a time
+constexpr int PACKET_LEAF_MIN_RAYS = 2;
+
+void localClosestHits(const RayPacket<RAY_PACKET_SIZE> &objectSpacePacket, const uint32_t rayMask,
+                      const WorldObject &object, float *maxDistances, Intersection *hits,
+                      const std::vector<CircularSolidData> &circularObjectData,
+                      const std::vector<TriangleData> &triObjectData,
+                      const std::vector<MeshData> &meshObjectData) noexcept {
+  const MeshData *mesh = object.shapeTag.type == ShapeType::Mesh ? &meshObjectData[object.shapeTag.dataIndex] : nullptr;
+  if (mesh == nullptr || mesh->positions.v0[0].empty()) {
+    for (uint32_t mask = rayMask; mask != 0; mask &= mask - 1) {
+      const uint32_t lane = static_cast<uint32_t>(__builtin_ctz(mask));
+      localClosestHit(objectSpacePacket.ray(lane), object, maxDistances[lane], hits[lane], circularObjectData,
+                      triObjectData, meshObjectData);
+    }
+    return;
+  }
+
+  TriangleHit triangleHits[RAY_PACKET_SIZE];
+  float packetDistances[RAY_PACKET_SIZE];
+  for (uint32_t lane = 0; lane < RAY_PACKET_SIZE; ++lane) {
+    triangleHits[lane].t = maxDistances[lane];
+    packetDistances[lane] = maxDistances[lane];
+  }
+  const auto intersectLeaf = [&](const uint32_t first, const uint32_t count, const uint32_t leafRayMask) {
+    // Once the packet has diverged the few rays left are better served by testing several triangles per instruction
+    if (std::popcount(leafRayMask) <= PACKET_LEAF_MIN_RAYS) {
+      for (uint32_t mask = leafRayMask; mask != 0; mask &= mask - 1) {
+        const uint32_t lane = static_cast<uint32_t>(__builtin_ctz(mask));
+        intersectTriangles(mesh->positions, first, count, objectSpacePacket.ray(lane), triangleHits[lane]);
+      }
+    } else {
+      intersectTrianglesPacket(mesh->positions, first, count, objectSpacePacket, leafRayMask, triangleHits);
+    }
+    for (uint32_t lane = 0; lane < RAY_PACKET_SIZE; ++lane) {
+      packetDistances[lane] = triangleHits[lane].t;
+    }
+  };
+  if (mesh->wideBVH.nodes.empty() && mesh->wideBVH.rootLeafCount == 0) {
+    intersectLeaf(0, static_cast<uint32_t>(mesh->triangleCount), rayMask);
+  } else {
+    RayPacket<RAY_PACKET_SIZE> packet = objectSpacePacket;
+    packet.activeMask = rayMask;
+    traverseWideBVHLeaves(mesh->wideBVH, packet, packetDistances, intersectLeaf);
+  }
+
+  for (uint32_t mask = rayMask; mask != 0; mask &= mask - 1) {
+    const uint32_t lane = static_cast<uint32_t>(__builtin_ctz(mask));
+    const TriangleHit &hit = triangleHits[lane];
+    if (hit.triangleIndex != -1 && hit.t < maxDistances[lane]) {
+      maxDistances[lane] = hit.t;
+      hits[lane] = Intersection{&object, hit.t, hit.u, hit.v, mesh->firstTriangleIndex + hit.triangleIndex};
+    }
+  }
+}
+
 } // namespace raytracer::geometry
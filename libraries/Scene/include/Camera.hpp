@@ -1,6 +1,15 @@
+#ifndef CAMERA_HPP
+#define CAMERA_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
 #include "libraries/Utility/include/Matrix.hpp"
 #include "libraries/Utility/include/Ray.hpp"
 #include "libraries/Canvas/include/Canvas.hpp"
+#include "libraries/Scene/include/Renderer.hpp"
 #include "libraries/Scene/include/World.hpp"
 #include "libraries/Utility/include/Tuple.hpp"
 #include "libraries/Utility/include/Transformations.hpp"
@@ -8,6 +17,16 @@
 namespace raytracer {
 namespace scene {
 
+// A rectangle of pixels of the image, from its top left corner
+struct CropWindow {
+  unsigned int x = 0;
+  unsigned int y = 0;
+  unsigned int width = 0;
+  unsigned int height = 0;
+};
+
+struct IncrementalRenderCache;
+
 class Camera {
 public:
 
@@ -42,6 +61,18 @@ Camera(unsigned int numHorPixels, unsigned int numVerPixels, float fov) noexcept
  * \return The ray corresponding to the given pixel.
  */
 utility::Ray rayForPixel(const unsigned int x, const unsigned int y) const noexcept;
+// Same as above through the point offsetX, offsetY (both in [0, 1)) from the top left corner of the pixel, traced at
+// the time (in [0, 1]) of the shutter interval
+utility::Ray rayForPixel(const unsigned int x, const unsigned int y, const double offsetX, const double offsetY,
+                         const float time = 0.0f) const noexcept;
+/**
+ * \brief Time of the shutter interval the sample of the pixel is traced at when the world has moving objects.
+ *
+ * Sample 0 is the center ray, the supersamples follow. The times of a pixel start at a random point and step through
+ * the interval, so the samples of every pixel cover it evenly whatever their number. Without moving objects all rays
+ * are traced at time 0.
+ */
+float shutterTime(const unsigned int x, const unsigned int y, const uint32_t sample) const noexcept;
 
 /**
  * Renders the scene using the specified camera and world.
@@ -51,6 +82,87 @@ utility::Ray rayForPixel(const unsigned int x, const unsigned int y) const noexc
  */
 Canvas render(const World& world) noexcept;
 
+/**
+ * \brief The passes render is made of, for callers that want to show the image before it is finished.
+ *
+ * Each pass checks cancelled (when not null) before every tile and skips the remaining tiles once it is set, so the
+ * pass returns within about one tile per thread. A tile that started is always finished, so no ray is left halfway
+ * through the thread local intersection buffers. Every pass returns whether it ran to the end.
+ */
+// Fills every blockSize x blockSize block of the image with the color of the ray through its center
+bool renderPreview(const World& world, Canvas& image, unsigned int blockSize,
+                   const std::atomic<bool>* cancelled = nullptr) const noexcept;
+// One ray through the center of every pixel
+bool renderCenters(const World& world, Canvas& image, const std::atomic<bool>* cancelled = nullptr) noexcept;
+// Adds the adaptive samples of setMaxSamplesPerPixel to an image that holds the center rays
+bool renderSupersamples(const World& world, Canvas& image, const std::atomic<bool>* cancelled = nullptr) noexcept;
+
+/**
+ * \brief Renders only the pixels in the window, clipped to the image, into a canvas of the window's size.
+ *
+ * The rays are the ones render traces for these pixels, so the result matches the same part of a full render. With
+ * supersampling the center rays of a one pixel margin around the window are traced too, as the edges are found against
+ * the neighbours of a pixel.
+ */
+Canvas renderCrop(const World& world, const CropWindow& window) noexcept;
+// Same as above, written to the same pixels of an image of the full size, leaving the rest of it as it was
+void renderCrop(const World& world, const CropWindow& window, Canvas& image) noexcept;
+// The part of the window that lies inside of the image
+CropWindow clampToFrame(const CropWindow& window) const noexcept;
+
+/**
+ * \brief Renders the world again, tracing only the tiles that the changes since the last render through the cache can
+ * affect, and returns the image kept in the cache.
+ *
+ * Every tile records the objects its rays hit (or that blocked its shadow rays) and the bounds of its reflected,
+ * refracted and shadow rays. Objects whose transform, material (or its pattern) or shadow flag changed make the tiles
+ * that recorded them traced again, along with the tiles they now cover on the screen and those whose ray bounds their
+ * new bounds overlap. The image then matches a full render. Changes to the camera, the lights or the number of objects,
+ * materials or patterns trace every tile.
+ */
+const Canvas& renderIncremental(const World& world, IncrementalRenderCache& cache) noexcept;
+
+/**
+ * \brief Sets the edge length in pixels of the square tiles render splits the image into.
+ *
+ * Every tile is traced by a single thread, so neighbouring rays share caches. Smaller tiles balance the load better
+ * when a few regions (e.g. glass) are much more expensive than the rest.
+ */
+void setTileSize(const unsigned int tileSize) noexcept { tileSize_ = std::max(1u, tileSize); }
+
+// Number of threads render runs on, 0 uses all available cores
+void setThreadCount(const unsigned int threadCount) noexcept { threadCount_ = threadCount; }
+
+// Whether render traces the primary rays of neighbouring pixels as packets (on by default)
+void setPacketTracing(const bool packetTracing) noexcept { packetTracing_ = packetTracing; }
+
+/**
+ * \brief Sets the share of a pixel's color below which reflected and refracted rays are not traced.
+ *
+ * The default of 1/512 is half of the smallest step an 8 bit color channel can show, 0 traces every ray up to the
+ * recursion limit.
+ */
+void setMinContribution(const float minContribution) noexcept { minContribution_ = minContribution; }
+
+/**
+ * \brief Sets the most rays render traces through a single pixel, at most MAX_SAMPLES_PER_PIXEL.
+ *
+ * Every pixel gets one ray through its center first. Pixels whose color differs from one of their neighbours by more
+ * than the adaptive threshold get up to 4 more rays, one in each quadrant of the pixel. Pixels whose samples still
+ * differ by more than the threshold get the rest of the budget, spread over a finer grid. The default of 1 only traces
+ * the center rays. Pixels that moving objects pass over are refined the same way, which is what blurs them.
+ */
+void setMaxSamplesPerPixel(const unsigned int maxSamples) noexcept {
+  maxSamplesPerPixel_ = std::clamp(maxSamples, 1u, MAX_SAMPLES_PER_PIXEL);
+}
+
+// Largest difference in a color channel between neighbouring pixels (or the samples of a pixel) that needs no more rays
+void setAdaptiveThreshold(const float threshold) noexcept { adaptiveThreshold_ = threshold; }
+
+// Number of rays the last render traced through each pixel of its window (the crop window or the whole image), from
+// black for one to white for the maximum per pixel
+Canvas samplesPerPixelImage() const noexcept;
+
 void setTransform(const utility::Matrix<4,4>& transform) noexcept {
   transform_ = transform;
   inverseTransform_ = inverse(transform_);
@@ -66,7 +178,50 @@ utility::Tuple cameraOrigin_;            // Precomputed camera origin in world s
 float halfWidth_;
 float halfHeight_;
 float pixelSize_;
+unsigned int tileSize_ = 16;
+unsigned int threadCount_ = 0;
+bool packetTracing_ = true;
+float minContribution_ = 1.0f / 512.0f;
+static constexpr unsigned int MAX_SAMPLES_PER_PIXEL = 257; ///< The center ray and a grid of 16 x 16.
+unsigned int maxSamplesPerPixel_ = 1;
+float adaptiveThreshold_ = 0.1f;
+std::vector<uint16_t> samplesPerPixel_; ///< Rays traced per pixel by the last render, row by row.
+CropWindow samplesWindow_;              ///< Pixels samplesPerPixel_ covers.
+};
+
+/**
+ * \brief What Camera::renderIncremental keeps from one render to the next.
+ *
+ * Start from a default constructed cache, the first render through it traces every tile. Edits to the shape data
+ * (triangles, cylinder limits and the like) are not noticed, start from a new cache after them.
+ */
+struct IncrementalRenderCache {
+  Canvas image{0, 0};
+  Canvas centers{0, 0};                          ///< Center rays of every pixel, they decide where to supersample.
+  std::vector<RayDependencies> tileDependencies; ///< Per tile, row by row.
+  std::vector<uint64_t> tileObjects;             ///< The object bits of all tiles, objectWords per tile.
+  size_t objectWords = 0;
+  size_t retracedTiles = 0;                      ///< Tiles the last render traced again.
+
+  // The view and the scene the image shows
+  utility::Matrix<4,4> cameraTransform = utility::Matrix<4,4>::identity();
+  unsigned int width = 0;
+  unsigned int height = 0;
+  float fov = 0.0f;
+  unsigned int tileSize = 0;
+  unsigned int maxSamplesPerPixel = 0;
+  float adaptiveThreshold = 0.0f;
+  float minContribution = 0.0f;
+  bool packetTracing = false;
+  std::vector<WorldObject> objects;
+  std::vector<Material> materials;
+  std::vector<Pattern> patterns;
+  std::vector<PointLight> lights;
+  std::vector<MotionData> motionData;
+  float lightErrorBound = 0.0f;
 };
 
 } // namespace raytracer
-} // namespace scene
\ No newline at end of file
+} // namespace scene
+
+#endif // CAMERA_HPP
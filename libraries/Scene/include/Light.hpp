@@ -1,13 +1,64 @@
 #ifndef LIGHT_HPP
 #define LIGHT_HPP
 
+#include <algorithm>
+#include <cstdint>
+
+#include "libraries/Utility/include/Color.hpp"
+#include "libraries/Utility/include/Tuple.hpp"
+
 namespace raytracer::scene{
 
+// Shadow rays an area light takes where its probe rays disagree, rounded to a square grid
+constexpr uint32_t DEFAULT_AREA_LIGHT_SAMPLES = 16;
+
+enum class LightShape {
+  Point,
+  Rectangle, ///< Spanned by edgeU and edgeV, centered on the position.
+  Sphere,    ///< Of the given radius around the position.
+};
+
+/**
+ * \brief A light, a point unless given a shape.
+ *
+ * Area lights shade like a point light at their position and only differ in their shadows, which are soft: the
+ * visibility of the light is the fraction of shadow rays towards points spread over it that reach it.
+ */
 struct PointLight{
   utility::Color intensity;
   utility::Tuple position;
+  LightShape shape = LightShape::Point;
+  utility::Tuple edgeU = utility::Vector(0, 0, 0);
+  utility::Tuple edgeV = utility::Vector(0, 0, 0);
+  float radius = 0.0f;
+  uint32_t samples = 1; ///< Shadow rays in the penumbra, area lights take fewer where the shadow is uniform.
+  float attenuation = 0.0f; ///< Quadratic falloff, the light reaching distance d is scaled by 1 / (1 + attenuation
+                            ///< d^2). The default of 0 lights everything the same however far away.
 };
 
+// What the lights under a node of the light hierarchy add up to, see World::lightErrorBound
+struct LightCluster {
+  utility::Color intensity; ///< Sum of the intensities.
+  float power = 0.0f;       ///< Sum of the brightest channel of every intensity, lights are picked in proportion to it.
+  float minAttenuation = 0.0f;
+};
+
+inline float brightestChannel(const utility::Color &color) noexcept {
+  return std::max({color.red(), color.green(), color.blue()});
+}
+
+inline PointLight rectangleLight(const utility::Color &intensity, const utility::Tuple &center,
+                                 const utility::Tuple &edgeU, const utility::Tuple &edgeV,
+                                 const uint32_t samples = DEFAULT_AREA_LIGHT_SAMPLES) noexcept {
+  return PointLight{intensity, center, LightShape::Rectangle, edgeU, edgeV, 0.0f, samples};
+}
+
+inline PointLight sphereLight(const utility::Color &intensity, const utility::Tuple &center, const float radius,
+                              const uint32_t samples = DEFAULT_AREA_LIGHT_SAMPLES) noexcept {
+  return PointLight{intensity, center, LightShape::Sphere, utility::Vector(0, 0, 0),
+                    utility::Vector(0, 0, 0), radius, samples};
+}
+
 } // namespace raytracer::scene
 
-#endif // LIGHT_HPP
\ No newline at end of file
+#endif // LIGHT_HPP
@@ -0,0 +1,29 @@
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "libraries/Scene/include/World.hpp"
+
+namespace raytracer::scene {
+
+// Bump whenever the layout of the cache file or of the structures stored in it changes
+constexpr uint32_t MESH_CACHE_VERSION = 1;
+
+// Cache entries are named after the hash of the source file, so edited files miss the cache instead of reading stale data
+std::string meshCachePath(const std::string &cacheDirectory, uint64_t sourceHash);
+
+// Appends the triangles and hierarchies stored in the cache file to the world and returns the index of the new mesh.
+// Returns nullopt when the file does not exist, was written for another source, build method or data layout, or can
+// not be read, so the caller can fall back to parsing the source.
+std::optional<size_t> loadMeshFromCache(World &world, const std::string &cachePath, uint64_t sourceHash);
+
+// Stores the triangles and hierarchies of a mesh so loadMeshFromCache can skip parsing and building next time. Returns
+// false, leaving no partial entry behind, when the entry could not be written.
+bool writeMeshCache(const World &world, size_t meshIndex, const std::string &cachePath, uint64_t sourceHash);
+
+} // namespace raytracer::scene
+
+#endif // MESH_CACHE_HPP
@@ -0,0 +1,77 @@
+#ifndef PROGRESSIVE_RENDER_HPP
+#define PROGRESSIVE_RENDER_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "libraries/Canvas/include/Canvas.hpp"
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/World.hpp"
+
+namespace raytracer::scene {
+
+/**
+ * \brief A render running in the background that produces successively refined images.
+ *
+ * The passes run in order on a thread of their own, each on the camera's threads:
+ * - Preview: one ray per PREVIEW_BLOCK_SIZE x PREVIEW_BLOCK_SIZE block of pixels.
+ * - Full: one ray through the center of every pixel, the image Camera::render gives without supersampling.
+ * - Supersampled: adaptive samples at the edges, with the camera's sample budget or at least
+ *   PROGRESSIVE_SAMPLES_PER_PIXEL.
+ *
+ * Every finished pass replaces the latest image and is handed to the callback, on the render thread. A cancelled pass
+ * is dropped, so the latest image is always a complete one. The world has to outlive the render and must not change
+ * while it runs.
+ */
+class ProgressiveRender {
+public:
+  enum class Pass { Preview, Full, Supersampled };
+  using Callback = std::function<void(const Canvas&, Pass)>;
+
+  static constexpr unsigned int PREVIEW_BLOCK_SIZE = 8;
+  static constexpr unsigned int PROGRESSIVE_SAMPLES_PER_PIXEL = 5; ///< The center ray and one ray per quadrant.
+
+  ProgressiveRender(const Camera& camera, const World& world, Callback callback = {});
+  // Cancels the render and waits for the render thread to stop
+  ~ProgressiveRender();
+
+  ProgressiveRender(const ProgressiveRender&) = delete;
+  ProgressiveRender& operator=(const ProgressiveRender&) = delete;
+
+  // Stops the render after the tiles in flight, returns right away
+  void cancel() noexcept { cancelled_.store(true, std::memory_order_relaxed); }
+  // Blocks until all passes finished or the render stopped after cancel
+  void wait();
+  // Whether the render thread is done, because all passes finished or it was cancelled
+  bool finished() const noexcept { return finished_.load(std::memory_order_acquire); }
+  bool cancelled() const noexcept { return cancelled_.load(std::memory_order_relaxed); }
+  // Number of passes finished so far, 3 once the supersampled image is done
+  unsigned int completedPasses() const noexcept { return completedPasses_.load(std::memory_order_acquire); }
+  // Copy of the image of the last finished pass, an all black canvas before the preview is done
+  Canvas latestImage() const;
+
+private:
+  void run();
+  void publish(const Canvas& image, Pass pass);
+
+  Camera camera_;
+  const World& world_;
+  Callback callback_;
+  std::atomic<bool> cancelled_{false};
+  std::atomic<bool> finished_{false};
+  std::atomic<unsigned int> completedPasses_{0};
+  mutable std::mutex imageMutex_;
+  Canvas latestImage_;
+  std::thread thread_; ///< Started last, once everything it uses is constructed.
+};
+
+// Starts rendering the world with a copy of the camera in the background
+std::unique_ptr<ProgressiveRender> startProgressiveRender(const Camera& camera, const World& world,
+                                                          ProgressiveRender::Callback callback = {});
+
+} // namespace raytracer::scene
+
+#endif // PROGRESSIVE_RENDER_HPP
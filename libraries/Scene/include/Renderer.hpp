@@ -1,6 +1,9 @@
 #ifndef RENDERER_HPP
 #define RENDERER_HPP
 
+#include <algorithm>
+#include <cstdint>
+
 #include "libraries/Utility/include/Color.hpp"
 #include "libraries/Utility/include/Ray.hpp"
 #include "libraries/Scene/include/World.hpp"
@@ -8,7 +11,170 @@
 namespace raytracer::scene{ 
 using namespace utility;
 
+/**
+ * \brief The objects a ray travels inside of, innermost last.
+ *
+ * Carried along the ray path so the refractive indices at a hit follow from the media entered so far, instead of from
+ * every intersection along the ray. Refracted rays get a copy with the hit object entered or exited, reflected rays
+ * keep their parent's. Nesting deeper than MAX_DEPTH is treated as the outermost MAX_DEPTH media.
+ */
+struct MediumStack {
+  static constexpr uint32_t MAX_DEPTH = 16;
+
+  const WorldObject *objects[MAX_DEPTH];
+  uint32_t size = 0;
+  bool resolved = false; ///< Unresolved stacks are looked up from the ray origin once a transparent hit needs them.
+
+  // Refractive index of the innermost medium, air (1.0) outside of everything
+  float refractiveIndex(const World &world) const noexcept {
+    return size == 0 ? 1.0f : world.materials[objects[size - 1]->MaterialIndex].refractiveIndex;
+  }
+
+  // Exits the object when the ray is inside of it, enters it otherwise
+  void cross(const WorldObject *object) noexcept {
+    for (uint32_t i = size; i-- > 0;) {
+      if (objects[i] == object) {
+        std::copy(objects + i + 1, objects + size, objects + i);
+        --size;
+        return;
+      }
+    }
+    if (size < MAX_DEPTH) {
+      objects[size++] = object;
+    }
+  }
+};
+
+/**
+ * \brief What the shading of a hit needs to know about it, shared by colorAt and the wavefront renderer.
+ */
+struct ShadingPoint {
+  const WorldObject *object = nullptr;
+  Tuple point;
+  Tuple eyeVector;
+  Tuple normalVector;     ///< Flipped to face the eye.
+  Tuple reflectVector;
+  MediumStack outerMedia; ///< Media the ray travels in, resolved for transparent hits.
+  MediumStack innerMedia; ///< Media behind the surface, only set for transparent hits.
+  float n1 = 1.0f;
+  float n2 = 1.0f;
+  float time = 0.0f;      ///< Time of the ray that hit, the rays leaving the point keep it.
+};
+
+// Light a shading point receives from one light, split up so the shadow rays can be traced separately
+struct LightSample {
+  Color ambient;
+  Color diffuse;
+  Color specular;
+  Ray shadowRay;              ///< Towards the position of the light.
+  float lightDistance = 0.0f;
+  bool receivesShadow = true;
+  const PointLight *light = nullptr;
+
+  // Only the ambient part reaches a point in shadow, visibility is the fraction of the light that is not
+  Color color(const float visibility) const noexcept {
+    if (visibility >= 1.0f) {
+      return ambient + diffuse + specular;
+    }
+    return visibility <= 0.0f ? ambient : ambient + (diffuse + specular) * visibility;
+  }
+};
+
+// Probe rays an area light takes, in a 2 x 2 grid, before it decides whether the point is in its penumbra
+constexpr uint32_t AREA_LIGHT_PROBE_GRID = 2;
+
+// A reflected or refracted ray whose color contributes scale * fresnel to the color of the hit it leaves
+struct SecondaryRay {
+  Ray ray;
+  MediumStack media;
+  float scale;   ///< Reflectance or transparency of the material.
+  float fresnel; ///< Share given by the Schlick approximation, 1 when the material only reflects or refracts.
+};
+constexpr uint32_t MAX_SECONDARY_RAYS = 2;
+
+// Nearest intersection in front of the ray origin, or one with a null object when nothing is hit
+Intersection closestHit(const Ray& ray, const World& world) noexcept;
+// Whether any object that casts shadows is hit within [minDistance, maxDistance] along the ray
+bool occluded(const Ray& ray, const World& world, float minDistance, float maxDistance) noexcept;
+
+ShadingPoint prepareShading(const Ray& ray, const Intersection& hit, const World& world,
+                            const MediumStack& media) noexcept;
+LightSample sampleLight(const ShadingPoint& shading, const PointLight& light, const World& world) noexcept;
+/**
+ * \brief Samples that stand for all lights of the world at the shading point, written to samples (room for one per
+ * light) in place of calling sampleLight for every light.
+ *
+ * One per light in the order of the lights, unless the world has a lightErrorBound, see there.
+ *
+ * \return The number of samples written.
+ */
+uint32_t sampleLights(const ShadingPoint& shading, const World& world, LightSample* samples) noexcept;
+// Traces the sample's shadow ray
+bool shadowed(const LightSample& sample, const World& world) noexcept;
+/**
+ * \brief Fraction of the sample's light that reaches the shading point, 0 or 1 for point lights.
+ *
+ * Area lights first trace a probe ray into each cell of a coarse grid over the light. When the probes agree the point
+ * is taken to be fully lit or in the umbra, only when they disagree the light's full number of samples is traced over
+ * a finer grid, so soft shadows cost extra shadow rays only in the penumbra. Blockers small enough to slip between
+ * all probes are missed. The rays are jittered within their cells by a hash of the shading point, so renders are
+ * repeatable.
+ *
+ * \param shadowRayCount When not null, the number of shadow rays traced is added to it.
+ */
+float lightVisibility(const LightSample& sample, const World& world, uint32_t* shadowRayCount = nullptr) noexcept;
+// Writes the rays continuing from the shading point to rays (room for MAX_SECONDARY_RAYS) and returns their number
+uint32_t secondaryRays(const ShadingPoint& shading, const World& world, SecondaryRay* rays) noexcept;
+
+/**
+ * \brief Looks up the objects containing the origin of the ray.
+ *
+ * Intersects the ray with the whole scene, so it is meant to be done once per ray tree (or once per camera, as all
+ * primary rays share the origin) rather than per bounce.
+ */
+MediumStack mediaAt(const Ray& ray, const World& world) noexcept;
+
+/**
+ * \brief What the colors of the rays traced while recording into it depend on.
+ *
+ * Enough to tell whether the colors change when objects are edited or moved: an object that is neither marked nor has
+ * bounds that overlap rayBounds (or the camera's view of it) can not change the colors.
+ */
+struct RayDependencies {
+  uint64_t* objects = nullptr;       ///< A bit per object index for the objects hit, the media of the transparent hits
+                                     ///< and the object found to block each shadow ray.
+  AABB rayBounds = AABB::empty();    ///< Bounds of the traced reflected, refracted and shadow ray segments.
+  bool unboundedRays = false;        ///< Set once a reflected or refracted ray hit nothing and left the scene.
+};
+
+/**
+ * \brief Makes the rays traced on the calling thread record what they depend on, until called with null.
+ *
+ * Primary rays only record the objects they hit, their segments start at the camera, so whether a moved object shows
+ * up in them follows from its position on the screen.
+ */
+void recordRayDependencies(RayDependencies* dependencies) noexcept;
+
 Color colorAt(const Ray& ray, const World& world, size_t recursionLimit = 5) noexcept;
+/**
+ * \brief Same as above with the media at the ray origin already known.
+ *
+ * \param minContribution Reflected and refracted rays whose share in the returned color (the product of the
+ * reflectance or transparency and Fresnel factors along the way) is below this are not traced, 0 traces all of them
+ * up to the recursion limit.
+ */
+Color colorAt(const Ray& ray, const World& world, const MediumStack& media, size_t recursionLimit = 5,
+              float minContribution = 0.0f) noexcept;
+
+/**
+ * \brief Traces up to RAY_PACKET_SIZE rays that share the same media together and writes their colors.
+ *
+ * The rays find their first hits as a packet, which pays off for coherent rays such as the primary rays of
+ * neighbouring pixels. Packets whose rays do not point the same way along every axis are traced one ray at a time, as
+ * are all reflected and refracted rays.
+ */
+void colorAtPacket(const Ray* rays, uint32_t rayCount, const World& world, const MediumStack& media, Color* colors,
+                   size_t recursionLimit = 5, float minContribution = 0.0f) noexcept;
 
 } // namespace raytracer::scene
 
@@ -0,0 +1,53 @@
+#ifndef SEQUENCE_HPP
+#define SEQUENCE_HPP
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "libraries/Canvas/include/Canvas.hpp"
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/World.hpp"
+#include "libraries/Utility/include/Matrix.hpp"
+
+namespace raytracer::scene {
+
+// Transform an object has at every frame, replacing the one it had. Frames past the end keep the last transform.
+struct ObjectTrack {
+  size_t objectIndex;
+  std::vector<utility::Matrix<4, 4>> transforms;
+};
+
+struct SequenceFrameTimings {
+  double updateMilliseconds = 0.0; ///< Moving the camera and objects and refitting (or rebuilding) the hierarchy.
+  double renderMilliseconds = 0.0;
+  double stallMilliseconds = 0.0;  ///< Waiting for the previous frame to be written before handing this one over.
+  double writeMilliseconds = 0.0;  ///< Spent on the writer thread, while the next frame renders.
+  bool rebuilt = false;            ///< The object hierarchy was rebuilt instead of refit.
+};
+
+// Called with every frame in order, on a thread of its own
+using FrameWriter = std::function<void(const Canvas& image, size_t frame)>;
+
+/**
+ * \brief Renders an animation, one frame per entry of the longest track, and returns the time spent on every frame.
+ *
+ * The world is moved from frame to frame rather than built again: the objects with a track get their transform for
+ * the frame and the object hierarchy is refit to them (see updateAccelerationStructure), so the world keeps the
+ * transforms of the last frame. Frames are rendered with a copy of the camera, which takes the transform of the
+ * camera track when there is one. Every render runs on the same TBB worker threads, which keep their intersection
+ * buffers from one frame to the next. A frame is handed to writeFrame once it is rendered and written while the next
+ * one renders, so writing only adds to the time per frame when it is slower than rendering.
+ */
+std::vector<SequenceFrameTimings> renderSequence(const Camera& camera, World& world,
+                                                 const std::vector<utility::Matrix<4, 4>>& cameraTrack,
+                                                 const std::vector<ObjectTrack>& objectTracks,
+                                                 const FrameWriter& writeFrame);
+
+// Writes frame i to <pathPrefix><i with 4 digits>.ppm
+FrameWriter ppmFrameWriter(const std::string& pathPrefix);
+
+} // namespace raytracer::scene
+
+#endif // SEQUENCE_HPP
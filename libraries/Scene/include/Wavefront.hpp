@@ -0,0 +1,43 @@
+#ifndef WAVEFRONT_HPP
+#define WAVEFRONT_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+#include "libraries/Canvas/include/Canvas.hpp"
+#include "libraries/Scene/include/World.hpp"
+
+namespace raytracer::scene {
+
+class Camera;
+
+// Time renderWavefront spends in each stage, summed over all bounces
+struct WavefrontTimings {
+  double generateMilliseconds = 0.0;   ///< Creating the primary rays and gathering the rays of the next bounce.
+  double sortMilliseconds = 0.0;
+  double traceMilliseconds = 0.0;      ///< Closest hits of the primary, reflected and refracted rays.
+  double shadeMilliseconds = 0.0;
+  double shadowMilliseconds = 0.0;     ///< Shadow rays and the surface colors that depend on them.
+  double accumulateMilliseconds = 0.0; ///< Adding up the colors of the rays of every pixel.
+  size_t rayCount = 0;                 ///< Primary, reflected and refracted rays traced.
+  size_t shadowRayCount = 0;
+  uint32_t bounceCount = 0;            ///< Most bounces traced for a pixel, the primary rays count as the first.
+};
+
+/**
+ * \brief Renders the image one bounce at a time instead of following every ray tree depth first like colorAt.
+ *
+ * The rays of a bounce form a stream that is sorted by direction octant and origin cell, so rays traced after each
+ * other visit the same parts of the scene, then traced, shaded and their shadow rays traced, which emits the stream of
+ * the next bounce. The image is processed in chunks of pixels to bound the size of the streams. Rays are cut off at
+ * the camera's minimum contribution and the colors of a pixel are added up in the order colorAt adds them, so the
+ * image matches Camera::render.
+ *
+ * \param timings Receives the time spent per stage when not null.
+ */
+Canvas renderWavefront(const Camera& camera, const World& world, WavefrontTimings* timings = nullptr,
+                       size_t recursionLimit = 5) noexcept;
+
+} // namespace raytracer::scene
+
+#endif // WAVEFRONT_HPP
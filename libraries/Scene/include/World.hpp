@@ -5,6 +5,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "libraries/Geometry/include/Intersections.hpp"
@@ -13,6 +14,8 @@
 #include "libraries/Material/include/Pattern.hpp"
 #include "libraries/Scene/include/Light.hpp"
 #include "libraries/Utility/include/Arena.hpp"
+#include "libraries/Utility/include/BVH.hpp"
+#include "libraries/Utility/include/WideBVH.hpp"
 
 namespace raytracer::scene {
 
@@ -20,6 +23,16 @@ using namespace material;
 using namespace geometry;
 
 constexpr size_t MAX_INTERSECTIONS = 5;
+// updateAccelerationStructure rebuilds once refitting made the object hierarchy this much more expensive to trace
+constexpr float REFIT_REBUILD_COST_RATIO = 1.5f;
+// Most clusters a shading point splits the lights into, so the cost per point stays bounded with any error bound
+constexpr uint32_t MAX_LIGHT_CUT = 128;
+
+// Transform a moving object has when the shutter closes, the one in the object itself applies when it opens
+struct MotionData {
+  utility::Matrix<4, 4> endTransform = utility::Matrix<4, 4>::identity();
+};
+
 struct World {
 public:
   std::vector<PointLight> lights;
@@ -30,6 +43,33 @@ public:
   std::vector<CircularSolidData> circularSolidData;
   std::vector<TriangleData> triangleData;
   std::vector<MeshData> meshData;
+  std::vector<MotionData> motionData;
+  std::unordered_map<std::string, int32_t> meshIndexByFile; ///< Meshes loaded by loadMesh, so files load only once.
+  std::string meshCacheDirectory; ///< When set, loadMesh stores parsed and built meshes here, see MeshCache.hpp.
+
+  // Acceleration structure over the objects, see buildAccelerationStructure
+  BVH objectBVH;                          ///< Hierarchy over the world space bounds of the bounded objects.
+  WideBVH<WIDE_BVH_WIDTH> objectWideBVH;  ///< objectBVH collapsed for traversal.
+  std::vector<uint32_t> unboundedObjects; ///< Objects without finite bounds (e.g. planes), tested by every ray.
+  BVHBuildMethod bvhBuildMethod = BVHBuildMethod::SAH; ///< Used for the object hierarchy and newly loaded meshes.
+  float objectBVHBuildCost = 0.0f; ///< SAH cost of the object hierarchy right after it was last built.
+  bool objectBVHOutdated = false;  ///< Objects were transformed since the object hierarchy was last built or refit.
+  uint32_t groupMemberCount = 0;   ///< Objects in groups, the object hierarchy reaches them through their groups.
+
+  // Hierarchy over the lights, built along with the object hierarchy and used once lightErrorBound is set
+  BVH lightBVH;
+  std::vector<LightCluster> lightClusters; ///< Per node of lightBVH.
+  /**
+   * \brief How far the lighting of a shading point may be estimated instead of evaluating every light.
+   *
+   * 0 evaluates every light with its own shadow ray. Otherwise the lights are split into clusters from the root of the
+   * light hierarchy down, always splitting the cluster with the largest bound on its contribution (from its power,
+   * its closest distance and whether it is in front of the surface), until every bound is below this fraction of the
+   * summed bounds or MAX_LIGHT_CUT clusters are reached. Clusters of one light are evaluated exactly, the others by
+   * a single light picked in proportion to its power and scaled up to the cluster's intensity, clusters that can not
+   * contribute are skipped. The picks are hashed from the shading point, so renders are repeatable.
+   */
+  float lightErrorBound = 0.0f;
 };
 
 // Here we will have the functions that are going to construct the world
@@ -50,8 +90,64 @@ size_t addLight(World &world, const PointLight &light) noexcept;
 size_t addObjectWithMaterial(World &world, const WorldObject &object, const Material &material,
                              const std::optional<Pattern> &pattern = std::nullopt) noexcept;
 void addTransformToObject(World &world, size_t objectIndex, const utility::Matrix<4, 4> &transform) noexcept;
+// Replaces the transform of the object, where addTransformToObject adds to it. A moving object keeps its motion
+// relative to the new transform.
+void setObjectTransform(World &world, size_t objectIndex, const utility::Matrix<4, 4> &transform) noexcept;
 void setObjectShadow(World &world, const size_t objectIndex, const bool hasShadow) noexcept;
+/**
+ * \brief Adds an empty group, objects are put into it with addObjectToGroup.
+ *
+ * Groups are flattened: the transform of every member already includes the transforms of the groups it is in, so rays
+ * are transformed once per member however deep the groups are nested. The group itself keeps its members' world space
+ * bounds, which rays test before any member, so a group that is missed skips its whole subtree. Transforming a group
+ * transforms its members along with it.
+ */
+size_t addGroup(World &world, const utility::Matrix<4, 4> &transform = utility::Matrix<4, 4>::identity()) noexcept;
+// Puts an object that is not in a group yet into the group. The transforms given for the object, before and after,
+// are relative to the group, the same goes for groups nested in other groups.
+void addObjectToGroup(World &world, size_t groupIndex, size_t objectIndex) noexcept;
+/**
+ * \brief Makes the object move while the shutter is open, from its current transform to endTransform.
+ *
+ * The transform in between is interpolated linearly, which suits translations and small rotations. The object
+ * hierarchy bounds the object over the whole interval, so only the moving objects get larger boxes. Transforms added
+ * later with addTransformToObject apply to both ends of the motion. A moving group hands the motion to its members,
+ * which are what rays hit: each member moves by the change from the group's transform to endTransform.
+ */
+void setObjectMotion(World &world, size_t objectIndex, const utility::Matrix<4, 4> &endTransform) noexcept;
+inline bool hasMovingObjects(const World &world) noexcept {
+  return !world.motionData.empty();
+}
+// Copy of the object with the transform it has at the time (in [0, 1]) of the shutter interval, the same for objects
+// that do not move
+WorldObject placeObjectAt(const World &world, const WorldObject &object, float time) noexcept;
+// World space bounds of the object, over the whole shutter interval for moving objects and those in groups
+AABB worldBounds(const World &world, const WorldObject &object) noexcept;
+// Meshes are split into the shared triangle data (and its hierarchy) returned by loadMesh, and instances of it which
+// are regular world objects that only carry a transform and a material. loadMesh returns the index of the mesh data
+// and only reads a file the first time it is asked for it. With a meshCacheDirectory, files that were loaded before
+// (with the same bvhBuildMethod) are mapped from the cache instead of being parsed and built again.
+std::optional<size_t> loadMesh(World &world, const std::string &inputFile);
+size_t addMeshInstance(World &world, size_t meshIndex,
+                       const utility::Matrix<4, 4> &transform = utility::Matrix<4, 4>::identity()) noexcept;
+// Loads the mesh (if needed) and adds a single instance of it, returning the index of the instance object
 std::optional<size_t> loadMeshFromObjFile(World &world, const std::string &inputFile);
+// Rebuilds the hierarchy of a single mesh with the given method, independent of the world's bvhBuildMethod
+void setMeshBuildMethod(World &world, size_t meshIndex, BVHBuildMethod method) noexcept;
+
+// Builds the hierarchy used to find the objects a ray can hit, and the one over the lights. It should be called once
+// the scene is constructed, adding objects afterwards drops it and transforming objects marks it outdated, in both
+// cases rays fall back to testing every object until it is rebuilt or updated. Only the top level over the objects is
+// built here, the mesh hierarchies are built once by loadMesh, so moving mesh instances around only costs an update
+// over the objects.
+void buildAccelerationStructure(World &world) noexcept;
+bool hasAccelerationStructure(const World &world) noexcept;
+// Whether the light hierarchy covers the current lights, adding a light drops it until the next build or update
+bool hasLightHierarchy(const World &world) noexcept;
+// Brings the hierarchy up to date after objects were transformed (e.g. between the frames of an animation) by
+// refitting it to the new object bounds. Falls back to a full rebuild when objects were added or the refit made the
+// hierarchy more than maxCostRatio times as expensive to trace as it was when built. Returns true when it rebuilt.
+bool updateAccelerationStructure(World &world, float maxCostRatio = REFIT_REBUILD_COST_RATIO) noexcept;
 } // namespace raytracer::scene
 
 #endif // WORLD_HPP
@@ -1,13 +1,21 @@
 #include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <csignal>
-#include <execution>
+#include <cstdint>
+#include <iterator>
 #include <numeric>
 #include <vector>
 
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
 #include "libraries/Geometry/include/Intersections.hpp"
 #include "libraries/Scene/include/Camera.hpp"
 #include "libraries/Scene/include/Renderer.hpp"
 #include "libraries/Utility/include/Arena.hpp"
+#include "libraries/Utility/include/Hash.hpp"
 
 namespace raytracer {
 namespace scene {
@@ -15,39 +23,632 @@ namespace scene {
 using namespace utility;
 
 Ray Camera::rayForPixel(const unsigned int x, const unsigned int y) const noexcept {
-  const auto xOffsetToPixelCenter = (x + 0.5) * this->pixelSize_;
-  const auto yOffsetToPixelCenter = (y + 0.5) * this->pixelSize_;
+  return this->rayForPixel(x, y, 0.5, 0.5);
+}
+
+Ray Camera::rayForPixel(const unsigned int x, const unsigned int y, const double offsetX, const double offsetY,
+                        const float time) const noexcept {
+  const auto xOffsetToSample = (x + offsetX) * this->pixelSize_;
+  const auto yOffsetToSample = (y + offsetY) * this->pixelSize_;
 
-  const auto worldX = this->halfWidth_ - xOffsetToPixelCenter;
-  const auto worldY = this->halfHeight_ - yOffsetToPixelCenter;
+  const auto worldX = this->halfWidth_ - xOffsetToSample;
+  const auto worldY = this->halfHeight_ - yOffsetToSample;
   // z-coord is -1 because the canvas is always 1 unit away from the camera
   const auto pixel = this->inverseTransform_ * Point(worldX, worldY, -1);
   const auto direction = (pixel - this->cameraOrigin_).normalize();
 
-  return Ray{this->cameraOrigin_, direction};
+  return Ray{this->cameraOrigin_, direction, time};
+}
+
+// Bounces render follows, the default of colorAt
+constexpr size_t RECURSION_LIMIT = 5;
+
+// Pixels traced as one packet, as square as the packet size allows
+constexpr unsigned int PACKET_BLOCK_WIDTH = RAY_PACKET_SIZE == 8 ? 4 : 2;
+constexpr unsigned int PACKET_BLOCK_HEIGHT = RAY_PACKET_SIZE / PACKET_BLOCK_WIDTH;
+
+// Interleaves the bits of the tile coordinates, so tiles that are close in the image are close in the order
+static inline uint32_t tileMortonCode(uint32_t x, uint32_t y) noexcept {
+  const auto spreadBits = [](uint32_t value) {
+    value &= 0x0000ffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+  };
+  return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+// Mixes the pixel and sample index into well distributed bits for the jitter of the sample
+static inline uint32_t hashSample(const uint32_t x, const uint32_t y, const uint32_t sample) noexcept {
+  return mixBits(x * 0x8da6b343u ^ y * 0xd8163841u ^ sample * 0xcb1ab31fu);
+}
+
+// Cell of a 2^gridBits x 2^gridBits grid over the pixel that the extra sample lands in. The sample index is bit
+// reversed and read as a Morton code, so the first 4 samples fall into different quadrants, the first 16 into
+// different cells of a 4 x 4 grid and so on.
+static inline void sampleCell(const uint32_t sample, const uint32_t gridBits, uint32_t &cellX,
+                              uint32_t &cellY) noexcept {
+  uint32_t code = 0;
+  for (uint32_t bit = 0; bit < 2 * gridBits; ++bit) {
+    code |= ((sample >> bit) & 1) << (2 * gridBits - 1 - bit);
+  }
+  cellX = 0;
+  cellY = 0;
+  for (uint32_t bit = 0; bit < gridBits; ++bit) {
+    cellX |= ((code >> (2 * bit)) & 1) << bit;
+    cellY |= ((code >> (2 * bit + 1)) & 1) << bit;
+  }
+}
+
+float Camera::shutterTime(const unsigned int x, const unsigned int y, const uint32_t sample) const noexcept {
+  // Steps of the golden ratio from a random start per pixel, so any number of samples covers the interval evenly
+  constexpr double GOLDEN_RATIO_FRACTION = 0.6180339887498949;
+  const double start = hashSample(x, y, 0x9e3779b9u) / 4294967296.0;
+  const double time = start + sample * GOLDEN_RATIO_FRACTION;
+  return static_cast<float>(time - std::floor(time));
+}
+
+// Largest difference between two colors in any channel
+static inline float colorDifference(const Color &a, const Color &b) noexcept {
+  return std::max({std::abs(a.red() - b.red()), std::abs(a.green() - b.green()), std::abs(a.blue() - b.blue())});
+}
+
+// Pixels [startX, endX) x [startY, endY) of a tile, index is its position in the row by row order of its region
+struct TileBounds {
+  unsigned int startX;
+  unsigned int startY;
+  unsigned int endX;
+  unsigned int endY;
+  uint32_t index;
+};
+
+// Tiles of the region in the order they are handed out, along a Z curve so the ranges TBB splits off (and steals)
+// cover compact image regions
+static std::vector<TileBounds> tilesOf(const Camera &camera, const CropWindow &region) {
+  const unsigned int tilesX = (region.width + camera.tileSize_ - 1) / camera.tileSize_;
+  const unsigned int tilesY = (region.height + camera.tileSize_ - 1) / camera.tileSize_;
+  std::vector<uint32_t> tileOrder(tilesX * tilesY);
+  std::iota(tileOrder.begin(), tileOrder.end(), 0);
+  std::ranges::sort(tileOrder, {},
+                    [tilesX](const uint32_t tile) { return tileMortonCode(tile % tilesX, tile / tilesX); });
+
+  std::vector<TileBounds> tiles;
+  tiles.reserve(tileOrder.size());
+  for (const uint32_t tile : tileOrder) {
+    const unsigned int startX = region.x + (tile % tilesX) * camera.tileSize_;
+    const unsigned int startY = region.y + (tile / tilesX) * camera.tileSize_;
+    tiles.push_back(TileBounds{startX, startY, std::min(startX + camera.tileSize_, region.x + region.width),
+                               std::min(startY + camera.tileSize_, region.y + region.height), tile});
+  }
+  return tiles;
+}
+
+// Runs processTile on the tiles on the camera's threads. Tiles that have not started when cancelled is set are
+// skipped, returns whether all of them ran.
+template <typename ProcessTile>
+static bool forTiles(const Camera &camera, const std::vector<TileBounds> &tiles, const std::atomic<bool> *cancelled,
+                     const ProcessTile &processTile) {
+  const auto isCancelled = [cancelled] { return cancelled != nullptr && cancelled->load(std::memory_order_relaxed); };
+  tbb::task_arena arena(camera.threadCount_ == 0 ? tbb::task_arena::automatic
+                                                 : static_cast<int>(camera.threadCount_));
+  arena.execute([&] {
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles.size()), [&](const tbb::blocked_range<size_t> &range) {
+      for (size_t i = range.begin(); i != range.end() && !isCancelled(); ++i) {
+        processTile(tiles[i]);
+      }
+    });
+  });
+  return !isCancelled();
+}
+
+template <typename ProcessTile>
+static bool forEachTile(const Camera &camera, const CropWindow &region, const std::atomic<bool> *cancelled,
+                        const ProcessTile &processTile) {
+  return forTiles(camera, tilesOf(camera, region), cancelled, processTile);
+}
+
+// Traces the center rays of the pixels of the tile into image, which holds the pixels of window (a part of the frame
+// that contains the tile)
+static void traceCenterTile(const Camera &camera, const World &world, const MediumStack &cameraMedia, Canvas &image,
+                            const CropWindow &window, const TileBounds &tile) noexcept {
+  // With moving objects every center ray samples its own time of the shutter interval
+  const bool motionBlur = hasMovingObjects(world);
+  const auto centerRay = [&](const unsigned int x, const unsigned int y) {
+    return motionBlur ? camera.rayForPixel(x, y, 0.5, 0.5, camera.shutterTime(x, y, 0)) : camera.rayForPixel(x, y);
+  };
+  if (!camera.packetTracing_) {
+    for (unsigned int y = tile.startY; y < tile.endY; ++y) {
+      for (unsigned int x = tile.startX; x < tile.endX; ++x) {
+        image.pixelWrite(colorAt(centerRay(x, y), world, cameraMedia, RECURSION_LIMIT, camera.minContribution_),
+                         x - window.x, y - window.y);
+      }
+    }
+    return;
+  }
+
+  // Blocks cut off by the tile edge trace a partial packet
+  for (unsigned int blockY = tile.startY; blockY < tile.endY; blockY += PACKET_BLOCK_HEIGHT) {
+    for (unsigned int blockX = tile.startX; blockX < tile.endX; blockX += PACKET_BLOCK_WIDTH) {
+      Ray rays[RAY_PACKET_SIZE];
+      unsigned int pixelX[RAY_PACKET_SIZE];
+      unsigned int pixelY[RAY_PACKET_SIZE];
+      uint32_t rayCount = 0;
+      for (unsigned int y = blockY; y < std::min(blockY + PACKET_BLOCK_HEIGHT, tile.endY); ++y) {
+        for (unsigned int x = blockX; x < std::min(blockX + PACKET_BLOCK_WIDTH, tile.endX); ++x) {
+          rays[rayCount] = centerRay(x, y);
+          pixelX[rayCount] = x;
+          pixelY[rayCount] = y;
+          ++rayCount;
+        }
+      }
+      Color colors[RAY_PACKET_SIZE];
+      colorAtPacket(rays, rayCount, world, cameraMedia, colors, RECURSION_LIMIT, camera.minContribution_);
+      for (uint32_t i = 0; i < rayCount; ++i) {
+        image.pixelWrite(colors[i], pixelX[i] - window.x, pixelY[i] - window.y);
+      }
+    }
+  }
+}
+
+static bool traceCenters(const Camera &camera, const World &world, Canvas &image, const CropWindow &window,
+                         const CropWindow &region, const std::atomic<bool> *cancelled) noexcept {
+  // All primary rays start at the camera, so the objects around it only need to be looked up once
+  const MediumStack cameraMedia = mediaAt(camera.rayForPixel(0, 0), world);
+  return forEachTile(camera, region, cancelled, [&](const TileBounds &tile) {
+    traceCenterTile(camera, world, cameraMedia, image, window, tile);
+  });
+}
+
+// Pixels the box covers on the screen, grown by a pixel, or the whole frame when part of it is behind the camera
+static CropWindow screenFootprint(const Camera &camera, const AABB &bounds) noexcept {
+  const CropWindow frame{0, 0, camera.numHorPixels_, camera.numVerPixels_};
+  float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+  for (uint32_t corner = 0; corner < 8; ++corner) {
+    const Tuple point = camera.transform_ * Point((corner & 1) ? bounds.max.x : bounds.min.x,
+                                                  (corner & 2) ? bounds.max.y : bounds.min.y,
+                                                  (corner & 4) ? bounds.max.z : bounds.min.z);
+    if (point.z > -EPSILON<float>) {
+      return frame;
+    }
+    // Inverse of rayForPixel, where the point crosses the canvas 1 unit in front of the camera
+    const float pixelX = (camera.halfWidth_ - point.x / -point.z) / camera.pixelSize_;
+    const float pixelY = (camera.halfHeight_ - point.y / -point.z) / camera.pixelSize_;
+    minX = std::min(minX, pixelX);
+    maxX = std::max(maxX, pixelX);
+    minY = std::min(minY, pixelY);
+    maxY = std::max(maxY, pixelY);
+  }
+  const float startX = std::clamp(std::floor(minX) - 1.0f, 0.0f, static_cast<float>(camera.numHorPixels_));
+  const float startY = std::clamp(std::floor(minY) - 1.0f, 0.0f, static_cast<float>(camera.numVerPixels_));
+  const float endX = std::clamp(std::ceil(maxX) + 1.0f, startX, static_cast<float>(camera.numHorPixels_));
+  const float endY = std::clamp(std::ceil(maxY) + 1.0f, startY, static_cast<float>(camera.numVerPixels_));
+  return CropWindow{static_cast<unsigned int>(startX), static_cast<unsigned int>(startY),
+                    static_cast<unsigned int>(endX - startX), static_cast<unsigned int>(endY - startY)};
+}
+
+/**
+ * \brief Adaptive supersampling of pixels whose center rays are known.
+ *
+ * centers holds the center rays of window, which has to contain the neighbours (in the frame) of the pixels asked
+ * about, as edges are found against them. Pixels that moving objects cover at some time of the shutter interval are
+ * supersampled as well, to blur them. Sample counts are written to samples, which covers samplesWindow, when not
+ * null.
+ */
+struct AdaptiveSampler {
+  AdaptiveSampler(const Camera &camera, const World &world, const Canvas &centers, const CropWindow &window,
+                  uint16_t *samples, const CropWindow &samplesWindow) noexcept
+      : camera{camera}, world{world}, centers{centers}, window{window}, samples{samples}, samplesWindow{samplesWindow},
+        cameraMedia{mediaAt(camera.rayForPixel(0, 0), world)}, extraSamples{camera.maxSamplesPerPixel_ - 1},
+        motionBlur{hasMovingObjects(world)} {
+    // The extra samples of a pixel are jittered inside the cells of the smallest power of two grid that fits them all
+    while ((1u << (2 * gridBits)) < extraSamples) {
+      ++gridBits;
+    }
+    cellSize = 1.0 / static_cast<double>(1u << gridBits);
+    for (const WorldObject &object : world.objects) {
+      if (object.motionIndex >= 0) {
+        motionFootprints.push_back(screenFootprint(camera, worldBounds(world, object)));
+      }
+    }
+  }
+
+  const Color &centerAt(const unsigned int x, const unsigned int y) const noexcept {
+    return centers.pixelAt(x - window.x, y - window.y);
+  }
+
+  // Edges show up as a large difference to one of the four neighbours
+  bool isEdge(const unsigned int x, const unsigned int y) const noexcept {
+    const float threshold = camera.adaptiveThreshold_;
+    const Color &center = centerAt(x, y);
+    return (x > 0 && colorDifference(center, centerAt(x - 1, y)) > threshold) ||
+           (x + 1 < camera.numHorPixels_ && colorDifference(center, centerAt(x + 1, y)) > threshold) ||
+           (y > 0 && colorDifference(center, centerAt(x, y - 1)) > threshold) ||
+           (y + 1 < camera.numVerPixels_ && colorDifference(center, centerAt(x, y + 1)) > threshold);
+  }
+
+  bool needsSamples(const unsigned int x, const unsigned int y) const noexcept {
+    return isEdge(x, y) || std::ranges::any_of(motionFootprints, [x, y](const CropWindow &footprint) {
+             return x >= footprint.x && x < footprint.x + footprint.width && y >= footprint.y &&
+                    y < footprint.y + footprint.height;
+           });
+  }
+
+  Color supersample(const unsigned int x, const unsigned int y) const noexcept {
+    Color sum = centerAt(x, y);
+    Color minColor = sum;
+    Color maxColor = sum;
+    uint32_t sampleCount = 1;
+    const auto traceSamples = [&](const uint32_t firstSample, const uint32_t endSample) {
+      for (uint32_t sample = firstSample; sample < endSample; sample += RAY_PACKET_SIZE) {
+        Ray rays[RAY_PACKET_SIZE];
+        const uint32_t rayCount = std::min<uint32_t>(RAY_PACKET_SIZE, endSample - sample);
+        for (uint32_t i = 0; i < rayCount; ++i) {
+          uint32_t cellX, cellY;
+          sampleCell(sample + i, gridBits, cellX, cellY);
+          const uint32_t jitter = hashSample(x, y, sample + i);
+          rays[i] = camera.rayForPixel(x, y, (cellX + (jitter & 0xffff) / 65536.0) * cellSize,
+                                       (cellY + (jitter >> 16) / 65536.0) * cellSize,
+                                       motionBlur ? camera.shutterTime(x, y, sample + i + 1) : 0.0f);
+        }
+        Color colors[RAY_PACKET_SIZE];
+        if (camera.packetTracing_) {
+          colorAtPacket(rays, rayCount, world, cameraMedia, colors, RECURSION_LIMIT, camera.minContribution_);
+        } else {
+          for (uint32_t i = 0; i < rayCount; ++i) {
+            colors[i] = colorAt(rays[i], world, cameraMedia, RECURSION_LIMIT, camera.minContribution_);
+          }
+        }
+        for (uint32_t i = 0; i < rayCount; ++i) {
+          sum += colors[i];
+          minColor = Color(std::min(minColor.red(), colors[i].red()), std::min(minColor.green(), colors[i].green()),
+                           std::min(minColor.blue(), colors[i].blue()));
+          maxColor = Color(std::max(maxColor.red(), colors[i].red()), std::max(maxColor.green(), colors[i].green()),
+                           std::max(maxColor.blue(), colors[i].blue()));
+        }
+        sampleCount += rayCount;
+      }
+    };
+
+    traceSamples(0, std::min(extraSamples, 4u));
+    if (extraSamples > 4 && colorDifference(minColor, maxColor) > camera.adaptiveThreshold_) {
+      traceSamples(4, extraSamples);
+    }
+    if (samples != nullptr) {
+      samples[size_t{y - samplesWindow.y} * samplesWindow.width + (x - samplesWindow.x)] =
+          static_cast<uint16_t>(sampleCount);
+    }
+    return sum * (1.0f / static_cast<float>(sampleCount));
+  }
+
+  const Camera &camera;
+  const World &world;
+  const Canvas &centers;
+  CropWindow window;
+  uint16_t *samples;
+  CropWindow samplesWindow;
+  MediumStack cameraMedia;
+  uint32_t extraSamples;
+  uint32_t gridBits = 0;
+  double cellSize;
+  bool motionBlur;
+  std::vector<CropWindow> motionFootprints; ///< Screen footprints of the moving objects over the shutter interval.
+};
+
+// Adds the adaptive samples to the pixels in region of image, which holds the center rays of window. The sample counts
+// go to camera.samplesPerPixel_, which covers camera.samplesWindow_.
+static bool traceSupersamples(Camera &camera, const World &world, Canvas &image, const CropWindow &window,
+                              const CropWindow &region, const std::atomic<bool> *cancelled) noexcept {
+  if (camera.maxSamplesPerPixel_ == 1) {
+    return cancelled == nullptr || !cancelled->load(std::memory_order_relaxed);
+  }
+
+  // Decisions are made on the center samples, so they do not depend on the order the tiles are refined in
+  const Canvas centers = image;
+  const AdaptiveSampler sampler(camera, world, centers, window, camera.samplesPerPixel_.data(), camera.samplesWindow_);
+  return forEachTile(camera, region, cancelled, [&](const TileBounds &tile) {
+    for (unsigned int y = tile.startY; y < tile.endY; ++y) {
+      for (unsigned int x = tile.startX; x < tile.endX; ++x) {
+        if (sampler.needsSamples(x, y)) {
+          image.pixelWrite(sampler.supersample(x, y), x - window.x, y - window.y);
+        }
+      }
+    }
+  });
 }
 
 Canvas Camera::render(const World &world) noexcept {
   auto image = Canvas(this->numHorPixels_, this->numVerPixels_);
+  this->renderCenters(world, image);
+  this->renderSupersamples(world, image);
+  return image;
+}
 
-  std::vector<size_t> pixelIndices(this->numHorPixels_ * this->numVerPixels_);
-  std::iota(pixelIndices.begin(), pixelIndices.end(), 0);
-  // for (const auto index : pixelIndices) {
-  //   const auto x = index % this->numHorPixels_;
-  //   const auto y = index / this->numHorPixels_;
-  //   const auto ray = this->rayForPixel(x, y);
-  //   const auto color = colorAt(ray, world);
-  //   image.pixelWrite(color, x, y);
-  // }
-  for_each(std::execution::par_unseq, pixelIndices.begin(), pixelIndices.end(),
-           [this, &image, &world](const auto index) {
-             const auto x = index % this->numHorPixels_;
-             const auto y = index / this->numHorPixels_;
-             const auto ray = this->rayForPixel(x, y);
-             const auto color = colorAt(ray, world);
-             image.pixelWrite(color, x, y);
-           });
+bool Camera::renderPreview(const World &world, Canvas &image, const unsigned int blockSize,
+                           const std::atomic<bool> *cancelled) const noexcept {
+  const unsigned int size = std::max(1u, blockSize);
+  const MediumStack cameraMedia = mediaAt(this->rayForPixel(0, 0), world);
+  // Tiles are laid over the grid of blocks, every block is one ray through the center of the pixels it covers
+  const CropWindow blocks{0, 0, (this->numHorPixels_ + size - 1) / size, (this->numVerPixels_ + size - 1) / size};
+  return forEachTile(*this, blocks, cancelled, [&](const TileBounds &tile) {
+    for (unsigned int blockY = tile.startY; blockY < tile.endY; ++blockY) {
+      for (unsigned int blockX = tile.startX; blockX < tile.endX; ++blockX) {
+        const unsigned int x0 = blockX * size;
+        const unsigned int y0 = blockY * size;
+        const unsigned int x1 = std::min(x0 + size, this->numHorPixels_);
+        const unsigned int y1 = std::min(y0 + size, this->numVerPixels_);
+        const auto color = colorAt(this->rayForPixel(x0, y0, 0.5 * (x1 - x0), 0.5 * (y1 - y0)), world, cameraMedia,
+                                   RECURSION_LIMIT, this->minContribution_);
+        for (unsigned int y = y0; y < y1; ++y) {
+          for (unsigned int x = x0; x < x1; ++x) {
+            image.pixelWrite(color, x, y);
+          }
+        }
+      }
+    }
+  });
+}
+
+bool Camera::renderCenters(const World &world, Canvas &image, const std::atomic<bool> *cancelled) noexcept {
+  const CropWindow frame{0, 0, this->numHorPixels_, this->numVerPixels_};
+  this->samplesWindow_ = frame;
+  this->samplesPerPixel_.assign(size_t{frame.width} * frame.height, 1);
+  return traceCenters(*this, world, image, frame, frame, cancelled);
+}
+
+bool Camera::renderSupersamples(const World &world, Canvas &image, const std::atomic<bool> *cancelled) noexcept {
+  const CropWindow frame{0, 0, this->numHorPixels_, this->numVerPixels_};
+  if (this->samplesWindow_.width != frame.width || this->samplesWindow_.height != frame.height ||
+      this->samplesWindow_.x != 0 || this->samplesWindow_.y != 0) {
+    this->samplesWindow_ = frame;
+    this->samplesPerPixel_.assign(size_t{frame.width} * frame.height, 1);
+  }
+  return traceSupersamples(*this, world, image, frame, frame, cancelled);
+}
+
+CropWindow Camera::clampToFrame(const CropWindow &window) const noexcept {
+  const unsigned int x = std::min(window.x, this->numHorPixels_);
+  const unsigned int y = std::min(window.y, this->numVerPixels_);
+  return CropWindow{x, y, std::min(window.width, this->numHorPixels_ - x),
+                    std::min(window.height, this->numVerPixels_ - y)};
+}
+
+Canvas Camera::renderCrop(const World &world, const CropWindow &window) noexcept {
+  const CropWindow crop = this->clampToFrame(window);
+  // Supersampling looks at the center rays around the crop, so they are traced one pixel beyond it
+  const unsigned int marginX = crop.x > 0 ? crop.x - 1 : 0;
+  const unsigned int marginY = crop.y > 0 ? crop.y - 1 : 0;
+  const CropWindow traced =
+      this->maxSamplesPerPixel_ == 1
+          ? crop
+          : this->clampToFrame(CropWindow{marginX, marginY, crop.x + crop.width + 1 - marginX,
+                                          crop.y + crop.height + 1 - marginY});
+
+  auto image = Canvas(traced.width, traced.height);
+  this->samplesWindow_ = crop;
+  this->samplesPerPixel_.assign(size_t{crop.width} * crop.height, 1);
+  traceCenters(*this, world, image, traced, traced, nullptr);
+  traceSupersamples(*this, world, image, traced, crop, nullptr);
+  if (traced.width == crop.width && traced.height == crop.height) {
+    return image;
+  }
+
+  auto cropped = Canvas(crop.width, crop.height);
+  for (unsigned int y = 0; y < crop.height; ++y) {
+    for (unsigned int x = 0; x < crop.width; ++x) {
+      cropped.pixelWrite(image.pixelAt(x + crop.x - traced.x, y + crop.y - traced.y), x, y);
+    }
+  }
+  return cropped;
+}
+
+void Camera::renderCrop(const World &world, const CropWindow &window, Canvas &image) noexcept {
+  const CropWindow crop = this->clampToFrame(window);
+  const auto cropped = this->renderCrop(world, crop);
+  for (unsigned int y = 0; y < crop.height && crop.y + y < image.height; ++y) {
+    for (unsigned int x = 0; x < crop.width && crop.x + x < image.width; ++x) {
+      image.pixelWrite(cropped.pixelAt(x, y), crop.x + x, crop.y + y);
+    }
+  }
+}
+
+// Exact comparisons, unlike the operators of Tuple and Matrix which allow for rounding
+static bool sameTuple(const Tuple &a, const Tuple &b) noexcept {
+  return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+}
+
+static bool sameColor(const Color &a, const Color &b) noexcept {
+  return a.red() == b.red() && a.green() == b.green() && a.blue() == b.blue();
+}
+
+static bool sameLight(const PointLight &a, const PointLight &b) noexcept {
+  return sameColor(a.intensity, b.intensity) && sameTuple(a.position, b.position) && a.shape == b.shape &&
+         sameTuple(a.edgeU, b.edgeU) && sameTuple(a.edgeV, b.edgeV) && a.radius == b.radius && a.samples == b.samples &&
+         a.attenuation == b.attenuation;
+}
+
+static bool sameMaterial(const Material &a, const Material &b) noexcept {
+  return sameColor(a.surfaceColor, b.surfaceColor) && a.ambient == b.ambient && a.diffuse == b.diffuse &&
+         a.specular == b.specular && a.shininess == b.shininess && a.reflectance == b.reflectance &&
+         a.transparency == b.transparency && a.refractiveIndex == b.refractiveIndex && a.patternIndex == b.patternIndex;
+}
+
+static bool samePattern(const Pattern &a, const Pattern &b) noexcept {
+  return a.type == b.type && sameColor(a.data.a, b.data.a) && sameColor(a.data.b, b.data.b) &&
+         a.transform.data == b.transform.data && a.preturb == b.preturb;
+}
+
+static bool sameObject(const WorldObject &a, const WorldObject &b) noexcept {
+  return a.shapeTag.type == b.shapeTag.type && a.shapeTag.dataIndex == b.shapeTag.dataIndex &&
+         a.transform.data == b.transform.data && sameTuple(a.boundingBox.min, b.boundingBox.min) &&
+         sameTuple(a.boundingBox.max, b.boundingBox.max) && a.parentIndex == b.parentIndex &&
+         a.MaterialIndex == b.MaterialIndex && a.hasShadow == b.hasShadow && a.motionIndex == b.motionIndex;
+}
+
+// Whether the cache holds an image of the same view of a scene with the same lights and number of objects, materials
+// and patterns, so only the objects that changed need to be looked at
+static bool sameSetup(const Camera &camera, const World &world, const IncrementalRenderCache &cache) noexcept {
+  return cache.width == camera.numHorPixels_ && cache.height == camera.numVerPixels_ && cache.fov == camera.fov_ &&
+         cache.cameraTransform.data == camera.transform_.data && cache.tileSize == camera.tileSize_ &&
+         cache.maxSamplesPerPixel == camera.maxSamplesPerPixel_ &&
+         cache.adaptiveThreshold == camera.adaptiveThreshold_ && cache.minContribution == camera.minContribution_ &&
+         cache.packetTracing == camera.packetTracing_ && cache.objects.size() == world.objects.size() &&
+         cache.materials.size() == world.materials.size() && cache.patterns.size() == world.patterns.size() &&
+         cache.motionData.size() == world.motionData.size() && cache.lightErrorBound == world.lightErrorBound &&
+         std::ranges::equal(cache.lights, world.lights, sameLight);
+}
+
+static bool overlaps(const AABB &a, const AABB &b) noexcept {
+  // Padded, as the ends of the recorded segments are rounded
+  constexpr float PADDING = 1e-3f;
+  return a.min.x <= b.max.x + PADDING && b.min.x <= a.max.x + PADDING && a.min.y <= b.max.y + PADDING &&
+         b.min.y <= a.max.y + PADDING && a.min.z <= b.max.z + PADDING && b.min.z <= a.max.z + PADDING;
+}
+
+const Canvas &Camera::renderIncremental(const World &world, IncrementalRenderCache &cache) noexcept {
+  const CropWindow frame{0, 0, this->numHorPixels_, this->numVerPixels_};
+  const unsigned int tilesX = (frame.width + this->tileSize_ - 1) / this->tileSize_;
+  const auto tiles = tilesOf(*this, frame);
+  std::vector<uint8_t> retrace(tiles.size(), 0);
+
+  if (!sameSetup(*this, world, cache)) {
+    cache.image = Canvas(frame.width, frame.height);
+    cache.centers = Canvas(frame.width, frame.height);
+    cache.objectWords = (world.objects.size() + 63) / 64;
+    cache.tileDependencies.assign(tiles.size(), RayDependencies{});
+    cache.tileObjects.assign(tiles.size() * cache.objectWords, 0);
+    std::ranges::fill(retrace, 1);
+  } else {
+    std::vector<uint8_t> materialChanged(world.materials.size());
+    for (size_t i = 0; i < world.materials.size(); ++i) {
+      const Material &material = world.materials[i];
+      materialChanged[i] = !sameMaterial(material, cache.materials[i]) ||
+                           (material.patternIndex >= 0 &&
+                            !samePattern(world.patterns[material.patternIndex], cache.patterns[material.patternIndex]));
+    }
+
+    std::vector<uint64_t> changedObjects(cache.objectWords, 0);
+    for (size_t i = 0; i < world.objects.size(); ++i) {
+      const WorldObject &object = world.objects[i];
+      const bool changed =
+          !sameObject(object, cache.objects[i]) ||
+          (object.MaterialIndex >= 0 && materialChanged[object.MaterialIndex]) ||
+          (object.motionIndex >= 0 && world.motionData[object.motionIndex].endTransform.data !=
+                                          cache.motionData[object.motionIndex].endTransform.data);
+      if (!changed) {
+        continue;
+      }
+      changedObjects[i / 64] |= uint64_t{1} << (i % 64);
+
+      // Where the object is now, it may show up in tiles that never saw it
+      const AABB bounds = worldBounds(world, object);
+      if (!bounds.isFinite()) {
+        std::ranges::fill(retrace, 1);
+        break;
+      }
+      const CropWindow footprint = screenFootprint(*this, bounds);
+      for (const TileBounds &tile : tiles) {
+        const RayDependencies &dependencies = cache.tileDependencies[tile.index];
+        const bool covered = tile.startX < footprint.x + footprint.width && footprint.x < tile.endX &&
+                             tile.startY < footprint.y + footprint.height && footprint.y < tile.endY;
+        if (covered || dependencies.unboundedRays || overlaps(dependencies.rayBounds, bounds)) {
+          retrace[tile.index] = 1;
+        }
+      }
+    }
+
+    for (const TileBounds &tile : tiles) {
+      const uint64_t *objects = &cache.tileObjects[tile.index * cache.objectWords];
+      for (size_t word = 0; word < cache.objectWords && !retrace[tile.index]; ++word) {
+        retrace[tile.index] = (objects[word] & changedObjects[word]) != 0;
+      }
+    }
+  }
+
+  std::vector<TileBounds> retraced;
+  std::ranges::copy_if(tiles, std::back_inserter(retraced),
+                       [&](const TileBounds &tile) { return retrace[tile.index] != 0; });
+  cache.retracedTiles = retraced.size();
+
+  // Each tile records what it depends on from scratch while its center rays are traced
+  const auto startRecording = [&](const TileBounds &tile, RayDependencies &dependencies) {
+    dependencies.objects = &cache.tileObjects[tile.index * cache.objectWords];
+    recordRayDependencies(&dependencies);
+  };
+  const MediumStack cameraMedia = mediaAt(this->rayForPixel(0, 0), world);
+  forTiles(*this, retraced, nullptr, [&](const TileBounds &tile) {
+    RayDependencies &dependencies = cache.tileDependencies[tile.index];
+    dependencies = RayDependencies{};
+    std::fill_n(&cache.tileObjects[tile.index * cache.objectWords], cache.objectWords, 0);
+    startRecording(tile, dependencies);
+    traceCenterTile(*this, world, cameraMedia, cache.centers, frame, tile);
+    recordRayDependencies(nullptr);
+    for (unsigned int y = tile.startY; y < tile.endY; ++y) {
+      for (unsigned int x = tile.startX; x < tile.endX; ++x) {
+        cache.image.pixelWrite(cache.centers.pixelAt(x, y), x, y);
+      }
+    }
+  });
+
+  if (this->maxSamplesPerPixel_ > 1 && !retraced.empty()) {
+    // Pixels next to a traced tile may have turned into edges or stopped being ones, so the tiles around the traced
+    // ones are looked at too
+    const auto retracedAt = [&](const unsigned int x, const unsigned int y) {
+      return retrace[(y / this->tileSize_) * tilesX + x / this->tileSize_] != 0;
+    };
+    std::vector<TileBounds> refined;
+    std::ranges::copy_if(tiles, std::back_inserter(refined), [&](const TileBounds &tile) {
+      return retrace[tile.index] || (tile.startX > 0 && retracedAt(tile.startX - 1, tile.startY)) ||
+             (tile.endX < frame.width && retracedAt(tile.endX, tile.startY)) ||
+             (tile.startY > 0 && retracedAt(tile.startX, tile.startY - 1)) ||
+             (tile.endY < frame.height && retracedAt(tile.startX, tile.endY));
+    });
+
+    const AdaptiveSampler sampler(*this, world, cache.centers, frame, nullptr, frame);
+    forTiles(*this, refined, nullptr, [&](const TileBounds &tile) {
+      startRecording(tile, cache.tileDependencies[tile.index]);
+      const bool tileRetraced = retrace[tile.index] != 0;
+      for (unsigned int y = tile.startY; y < tile.endY; ++y) {
+        for (unsigned int x = tile.startX; x < tile.endX; ++x) {
+          const bool update = tileRetraced || (x > 0 && retracedAt(x - 1, y)) ||
+                              (x + 1 < frame.width && retracedAt(x + 1, y)) || (y > 0 && retracedAt(x, y - 1)) ||
+                              (y + 1 < frame.height && retracedAt(x, y + 1));
+          if (update) {
+            cache.image.pixelWrite(
+                sampler.needsSamples(x, y) ? sampler.supersample(x, y) : cache.centers.pixelAt(x, y), x, y);
+          }
+        }
+      }
+      recordRayDependencies(nullptr);
+    });
+  }
+
+  cache.width = this->numHorPixels_;
+  cache.height = this->numVerPixels_;
+  cache.fov = this->fov_;
+  cache.cameraTransform = this->transform_;
+  cache.tileSize = this->tileSize_;
+  cache.maxSamplesPerPixel = this->maxSamplesPerPixel_;
+  cache.adaptiveThreshold = this->adaptiveThreshold_;
+  cache.minContribution = this->minContribution_;
+  cache.packetTracing = this->packetTracing_;
+  cache.objects = world.objects;
+  cache.materials = world.materials;
+  cache.patterns = world.patterns;
+  cache.lights = world.lights;
+  cache.motionData = world.motionData;
+  cache.lightErrorBound = world.lightErrorBound;
+  return cache.image;
+}
 
+Canvas Camera::samplesPerPixelImage() const noexcept {
+  auto image = Canvas(this->samplesWindow_.width, this->samplesWindow_.height);
+  const float scale = this->maxSamplesPerPixel_ > 1 ? 1.0f / static_cast<float>(this->maxSamplesPerPixel_ - 1) : 0.0f;
+  for (size_t i = 0; i < this->samplesPerPixel_.size() && i < image.pixels.size(); ++i) {
+    const float brightness = static_cast<float>(this->samplesPerPixel_[i] - 1) * scale;
+    image.pixels[i] = Color(brightness, brightness, brightness);
+  }
   return image;
 }
 
@@ -0,0 +1,200 @@
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <type_traits>
+
+#include "libraries/Scene/include/MeshCache.hpp"
+#include "libraries/Utility/include/LinearAllocator.hpp"
+#include "libraries/Utility/include/MappedFile.hpp"
+
+namespace raytracer::scene {
+
+using utility::BVHNode;
+using utility::WideBVHNode;
+using WideNode = WideBVHNode<utility::WIDE_BVH_WIDTH>;
+
+// The sections are copied byte for byte, which is only valid for trivially copyable types
+static_assert(std::is_trivially_copyable_v<TriangleData>);
+static_assert(std::is_trivially_copyable_v<BVHNode>);
+static_assert(std::is_trivially_copyable_v<WideNode>);
+
+constexpr char MESH_CACHE_MAGIC[8] = {'R', 'T', 'M', 'E', 'S', 'H', '\0', '\0'};
+// Every section starts on a cache line of its own. The sections are copied out of the mapping into the world's
+// vectors, so this only keeps the copies from starting mid-line, nothing reads the mapped data in place.
+constexpr size_t MESH_CACHE_SECTION_ALIGNMENT = 64;
+
+// The file is this header followed by the triangles, the binary nodes and the wide nodes
+struct MeshCacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t triangleSize; ///< The struct sizes catch layout changes, e.g. a different WIDE_BVH_WIDTH.
+  uint32_t nodeSize;
+  uint32_t wideNodeSize;
+  uint64_t sourceHash;
+  uint32_t buildMethod;
+  uint32_t triangleCount;
+  uint32_t nodeCount;
+  uint32_t wideNodeCount;
+  uint32_t wideRootLeafCount;
+  uint32_t padding;
+};
+
+struct MeshCacheLayout {
+  size_t trianglesOffset;
+  size_t nodesOffset;
+  size_t wideNodesOffset;
+  size_t fileSize;
+};
+
+static MeshCacheLayout cacheLayout(const MeshCacheHeader &header) noexcept {
+  MeshCacheLayout layout;
+  layout.trianglesOffset = utility::roundup(sizeof(MeshCacheHeader), MESH_CACHE_SECTION_ALIGNMENT);
+  layout.nodesOffset = utility::roundup(layout.trianglesOffset + size_t{header.triangleCount} * sizeof(TriangleData),
+                                        MESH_CACHE_SECTION_ALIGNMENT);
+  layout.wideNodesOffset = utility::roundup(layout.nodesOffset + size_t{header.nodeCount} * sizeof(BVHNode),
+                                            MESH_CACHE_SECTION_ALIGNMENT);
+  layout.fileSize = layout.wideNodesOffset + size_t{header.wideNodeCount} * sizeof(WideNode);
+  return layout;
+}
+
+static MeshCacheHeader expectedHeader(const uint64_t sourceHash, const BVHBuildMethod buildMethod) noexcept {
+  MeshCacheHeader header{};
+  std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(MESH_CACHE_MAGIC));
+  header.version = MESH_CACHE_VERSION;
+  header.triangleSize = sizeof(TriangleData);
+  header.nodeSize = sizeof(BVHNode);
+  header.wideNodeSize = sizeof(WideNode);
+  header.sourceHash = sourceHash;
+  header.buildMethod = static_cast<uint32_t>(buildMethod);
+  return header;
+}
+
+template <typename T>
+static void copySection(std::vector<T> &destination, const std::byte *source, const size_t count) {
+  const size_t first = destination.size();
+  destination.resize(first + count);
+  std::memcpy(static_cast<void *>(destination.data() + first), source, count * sizeof(T));
+}
+
+std::string meshCachePath(const std::string &cacheDirectory, const uint64_t sourceHash) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.meshcache", static_cast<unsigned long long>(sourceHash));
+  return (std::filesystem::path(cacheDirectory) / name).string();
+}
+
+// loadMeshFromCache without the error handling, allocations may throw
+static std::optional<size_t> readMeshCache(World &world, const std::string &cachePath, const uint64_t sourceHash) {
+  const utility::MappedFile file(cachePath);
+  if (!file.isOpen() || file.size < sizeof(MeshCacheHeader)) {
+    return std::nullopt;
+  }
+
+  MeshCacheHeader header;
+  std::memcpy(&header, file.data, sizeof(header));
+  const MeshCacheHeader expected = expectedHeader(sourceHash, world.bvhBuildMethod);
+  if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.version != expected.version ||
+      header.triangleSize != expected.triangleSize || header.nodeSize != expected.nodeSize ||
+      header.wideNodeSize != expected.wideNodeSize || header.sourceHash != expected.sourceHash ||
+      header.buildMethod != expected.buildMethod) {
+    return std::nullopt;
+  }
+  const MeshCacheLayout layout = cacheLayout(header);
+  if (file.size < layout.fileSize) {
+    return std::nullopt; // Truncated, e.g. the disk ran full while writing it
+  }
+
+  MeshData mesh;
+  mesh.firstTriangleIndex = static_cast<int32_t>(world.triangleData.size());
+  mesh.triangleCount = static_cast<int32_t>(header.triangleCount);
+  copySection(world.triangleData, file.data + layout.trianglesOffset, header.triangleCount);
+  copySection(mesh.bvh.nodes, file.data + layout.nodesOffset, header.nodeCount);
+  copySection(mesh.wideBVH.nodes, file.data + layout.wideNodesOffset, header.wideNodeCount);
+  mesh.wideBVH.rootLeafCount = header.wideRootLeafCount;
+  // Cheap to derive from the triangles, so the positions are not stored
+  buildTrianglePositions(mesh, world.triangleData);
+  world.meshData.push_back(std::move(mesh));
+  return world.meshData.size() - 1;
+}
+
+std::optional<size_t> loadMeshFromCache(World &world, const std::string &cachePath, const uint64_t sourceHash) {
+  const size_t triangleCount = world.triangleData.size();
+  try {
+    return readMeshCache(world, cachePath, sourceHash);
+  } catch (const std::exception &exception) {
+    // The mesh is only added last, so dropping the triangles copied so far leaves the world as it was
+    std::cerr << "Failed to read mesh cache '" << cachePath << "': " << exception.what() << '\n';
+    world.triangleData.resize(triangleCount);
+    return std::nullopt;
+  }
+}
+
+// writeMeshCache without the error handling for throwing calls, writes the entry through temporaryPath
+static bool writeCacheFile(const World &world, const size_t meshIndex, const std::string &cachePath,
+                           const std::string &temporaryPath, const uint64_t sourceHash) {
+  const MeshData &mesh = world.meshData[meshIndex];
+  MeshCacheHeader header = expectedHeader(sourceHash, world.bvhBuildMethod);
+  header.triangleCount = static_cast<uint32_t>(mesh.triangleCount);
+  header.nodeCount = static_cast<uint32_t>(mesh.bvh.nodes.size());
+  header.wideNodeCount = static_cast<uint32_t>(mesh.wideBVH.nodes.size());
+  header.wideRootLeafCount = mesh.wideBVH.rootLeafCount;
+  const MeshCacheLayout layout = cacheLayout(header);
+
+  // Write to a temporary file and move it in place, so a concurrent run never maps a half written cache
+  std::error_code error;
+  std::filesystem::create_directories(std::filesystem::path(cachePath).parent_path(), error);
+  std::ofstream out{temporaryPath, std::ios::binary | std::ios::trunc};
+  if (!out) {
+    std::cerr << "Failed to create mesh cache '" << temporaryPath << "'\n";
+    return false;
+  }
+  const auto writeSection = [&out](const size_t offset, const void *data, const size_t size) {
+    const std::vector<char> padding(offset - static_cast<size_t>(out.tellp()), '\0');
+    out.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+    out.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+  };
+  writeSection(0, &header, sizeof(header));
+  writeSection(layout.trianglesOffset, world.triangleData.data() + mesh.firstTriangleIndex,
+               header.triangleCount * sizeof(TriangleData));
+  writeSection(layout.nodesOffset, mesh.bvh.nodes.data(), header.nodeCount * sizeof(BVHNode));
+  writeSection(layout.wideNodesOffset, mesh.wideBVH.nodes.data(), header.wideNodeCount * sizeof(WideNode));
+  out.close();
+
+  if (!out) {
+    std::cerr << "Failed to write mesh cache '" << temporaryPath << "'\n";
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+  std::filesystem::rename(temporaryPath, cachePath, error);
+  if (error) {
+    std::cerr << "Failed to write mesh cache '" << cachePath << "': " << error.message() << '\n';
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+  return true;
+}
+
+bool writeMeshCache(const World &world, const size_t meshIndex, const std::string &cachePath,
+                    const uint64_t sourceHash) {
+  std::string temporaryPath;
+  try {
+    // The random suffix keeps runs that write the same cache at once from writing into the same temporary file
+    std::random_device random;
+    char suffix[24];
+    std::snprintf(suffix, sizeof(suffix), ".%08x%08x.tmp", random(), random());
+    temporaryPath = cachePath + suffix;
+    return writeCacheFile(world, meshIndex, cachePath, temporaryPath, sourceHash);
+  } catch (const std::exception &exception) {
+    std::cerr << "Failed to write mesh cache '" << cachePath << "': " << exception.what() << '\n';
+    if (!temporaryPath.empty()) {
+      std::error_code error;
+      std::filesystem::remove(temporaryPath, error);
+    }
+    return false;
+  }
+}
+
+} // namespace raytracer::scene
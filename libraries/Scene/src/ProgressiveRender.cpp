@@ -0,0 +1,62 @@
+#include <algorithm>
+#include <utility>
+
+#include "libraries/Scene/include/ProgressiveRender.hpp"
+
+namespace raytracer::scene {
+
+ProgressiveRender::ProgressiveRender(const Camera& camera, const World& world, Callback callback)
+    : camera_{camera}, world_{world}, callback_{std::move(callback)},
+      latestImage_(camera.numHorPixels_, camera.numVerPixels_), thread_{[this] { this->run(); }} {}
+
+ProgressiveRender::~ProgressiveRender() {
+  this->cancel();
+  this->wait();
+}
+
+void ProgressiveRender::wait() {
+  if (this->thread_.joinable()) {
+    this->thread_.join();
+  }
+}
+
+Canvas ProgressiveRender::latestImage() const {
+  const std::lock_guard lock(this->imageMutex_);
+  return this->latestImage_;
+}
+
+void ProgressiveRender::publish(const Canvas& image, const Pass pass) {
+  {
+    const std::lock_guard lock(this->imageMutex_);
+    this->latestImage_ = image;
+  }
+  this->completedPasses_.fetch_add(1, std::memory_order_release);
+  if (this->callback_) {
+    this->callback_(image, pass);
+  }
+}
+
+// The thread local intersection buffers this thread picks up while taking part in the passes are released when it
+// exits. The TBB workers keep theirs for the next render, the same as after Camera::render.
+void ProgressiveRender::run() {
+  Canvas image(this->camera_.numHorPixels_, this->camera_.numVerPixels_);
+  if (this->camera_.renderPreview(this->world_, image, PREVIEW_BLOCK_SIZE, &this->cancelled_)) {
+    this->publish(image, Pass::Preview);
+    if (this->camera_.renderCenters(this->world_, image, &this->cancelled_)) {
+      this->publish(image, Pass::Full);
+      this->camera_.setMaxSamplesPerPixel(
+          std::max(this->camera_.maxSamplesPerPixel_, PROGRESSIVE_SAMPLES_PER_PIXEL));
+      if (this->camera_.renderSupersamples(this->world_, image, &this->cancelled_)) {
+        this->publish(image, Pass::Supersampled);
+      }
+    }
+  }
+  this->finished_.store(true, std::memory_order_release);
+}
+
+std::unique_ptr<ProgressiveRender> startProgressiveRender(const Camera& camera, const World& world,
+                                                          ProgressiveRender::Callback callback) {
+  return std::make_unique<ProgressiveRender>(camera, world, std::move(callback));
+}
+
+} // namespace raytracer::scene
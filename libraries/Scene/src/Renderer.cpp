@@ -1,12 +1,18 @@
 #include <algorithm>
+#include <bit>
+#include <cmath>
+#include <numbers>
 #include <optional>
+#include <span>
 #include <utility>
 
 #include "libraries/Geometry/include/Intersections.hpp"
 #include "libraries/Geometry/include/Shape.hpp"
 #include "libraries/Material/include/Material.hpp"
+#include "libraries/Scene/include/Renderer.hpp"
 #include "libraries/Scene/include/World.hpp"
 #include "libraries/Utility/include/FloatUtils.hpp"
+#include "libraries/Utility/include/Hash.hpp"
 #include "libraries/Utility/include/Transformations.hpp"
 
 namespace raytracer {
@@ -21,71 +27,575 @@ using utility::Tuple;
 // Buffer reused across recursive calls to avoid allocations
 static thread_local Arena<Intersection> intersectionsBuffer(GB(10));
 // static Arena<Intersection> intersectionsBuffer(GB(10));
+// Light samples of the point being shaded, sampleLights writes up to one per light
+static thread_local std::vector<LightSample> lightSampleBuffer;
+// Where the rays traced on this thread record what they depend on, null when nobody asked for it
+static thread_local RayDependencies *rayDependencies = nullptr;
 
-static inline void intersect(const Ray &ray, const World &world) noexcept {
+void recordRayDependencies(RayDependencies *dependencies) noexcept {
+  rayDependencies = dependencies;
+}
+
+static inline void recordObject(const World &world, const WorldObject *object) noexcept {
+  const auto index = static_cast<size_t>(object - world.objects.data());
+  rayDependencies->objects[index / 64] |= uint64_t{1} << (index % 64);
+}
+
+static inline void recordSegment(const Ray &ray, const float distance) noexcept {
+  rayDependencies->rayBounds.expandToInclude(ray.origin);
+  rayDependencies->rayBounds.expandToInclude(ray.position(distance));
+}
+
+// Groups only cull their members with their world space box, the members already carry the group's transform
+static inline bool missesGroup(const Ray &ray, const WorldObject &group, const float maxDistance) noexcept {
+  if (!group.boundingBox.isFinite()) {
+    return false;
+  }
+  const Tuple inverseDirection = Vector(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+  return group.boundingBox.intersectDistance(ray.origin, inverseDirection, maxDistance) == INFINITY;
+}
+
+static inline const std::vector<uint32_t> &membersOf(const WorldObject &group, const World &world) noexcept {
+  return world.groupData[group.shapeTag.dataIndex].childerenIndices;
+}
+
+static inline void intersectObject(const Ray &ray, const WorldObject &object, const World &world) noexcept {
+  if (object.shapeTag.type == ShapeType::Group) [[unlikely]] {
+    if (!missesGroup(ray, object, INFINITY)) {
+      for (const auto memberIndex : membersOf(object, world)) {
+        intersectObject(ray, world.objects[memberIndex], world);
+      }
+    }
+    return;
+  }
+  // Moving objects are intersected through a copy placed where they are at the ray's time
+  if (object.motionIndex >= 0) [[unlikely]] {
+    const WorldObject placed = placeObjectAt(world, object, ray.time);
+    const size_t firstIntersection = intersectionsBuffer.size;
+    intersectObject(ray, placed, world);
+    for (size_t i = firstIntersection; i < intersectionsBuffer.size; ++i) {
+      intersectionsBuffer[i].object = &object;
+    }
+    return;
+  }
+  Ray transformedRay{object.inverseTransform * ray.origin, object.inverseTransform * ray.direction};
+  // Unbounded objects (planes) have no box worth testing
+  if (object.boundingBox.isFinite() && !object.boundingBox.intersect(transformedRay)) {
+    return;
+  }
+  localIntersect(transformedRay, object, intersectionsBuffer, world.circularSolidData, world.triangleData,
+                 world.meshData);
+}
+
+// Collects the intersections of every object whose bounds the ray enters before maxDistance
+static inline void intersect(const Ray &ray, const World &world, float maxDistance = INFINITY) noexcept {
   intersectionsBuffer.clear();
-  for (const auto &object : world.objects) {
-    Ray transformedRay{object.inverseTransform * ray.origin, object.inverseTransform * ray.direction};
-    if (!object.boundingBox.intersect(transformedRay)) {
-      continue;
+  if (!hasAccelerationStructure(world)) {
+    for (const auto &object : world.objects) {
+      if (object.parentIndex < 0) {
+        intersectObject(ray, object, world);
+      }
+    }
+    return;
+  }
+
+  for (const auto objectIndex : world.unboundedObjects) {
+    intersectObject(ray, world.objects[objectIndex], world);
+  }
+  traverseWideBVHLeaves(world.objectWideBVH, ray, maxDistance, [&](const uint32_t first, const uint32_t count) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      intersectObject(ray, world.objects[world.objectBVH.primitiveIndices[i]], world);
+    }
+  });
+}
+
+static inline void closestHitInObject(const Ray &ray, const WorldObject &object, const World &world,
+                                      float &maxDistance, Intersection &hit) noexcept {
+  if (object.shapeTag.type == ShapeType::Group) [[unlikely]] {
+    if (!missesGroup(ray, object, maxDistance)) {
+      for (const auto memberIndex : membersOf(object, world)) {
+        closestHitInObject(ray, world.objects[memberIndex], world, maxDistance, hit);
+      }
+    }
+    return;
+  }
+  if (object.motionIndex >= 0) [[unlikely]] {
+    const WorldObject placed = placeObjectAt(world, object, ray.time);
+    closestHitInObject(ray, placed, world, maxDistance, hit);
+    if (hit.object == &placed) {
+      hit.object = &object;
     }
-    localIntersect(transformedRay, object, intersectionsBuffer, world.circularSolidData, world.triangleData,
+    return;
+  }
+  Ray transformedRay{object.inverseTransform * ray.origin, object.inverseTransform * ray.direction};
+  // The object space ray keeps the world space parametrization, so the box can be culled against maxDistance directly
+  if (object.boundingBox.isFinite()) {
+    const Tuple inverseDirection = Vector(1.0f / transformedRay.direction.x, 1.0f / transformedRay.direction.y,
+                                          1.0f / transformedRay.direction.z);
+    if (object.boundingBox.intersectDistance(transformedRay.origin, inverseDirection, maxDistance) == INFINITY) {
+      return;
+    }
+  }
+  localClosestHit(transformedRay, object, maxDistance, hit, world.circularSolidData, world.triangleData,
+                  world.meshData);
+}
+
+// Nearest intersection in front of the ray origin, or one with a null object when nothing is hit. Only the best hit
+// is kept and every hit found shrinks the distance up to which the remaining boxes and shapes are tested. Like
+// occluded, this leaves intersectionsBuffer untouched.
+Intersection closestHit(const Ray &ray, const World &world) noexcept {
+  Intersection hit{nullptr, std::numeric_limits<float>::max()};
+  float maxDistance = INFINITY;
+  if (!hasAccelerationStructure(world)) {
+    for (const auto &object : world.objects) {
+      if (object.parentIndex < 0) {
+        closestHitInObject(ray, object, world, maxDistance, hit);
+      }
+    }
+    return hit;
+  }
+
+  for (const auto objectIndex : world.unboundedObjects) {
+    closestHitInObject(ray, world.objects[objectIndex], world, maxDistance, hit);
+  }
+  traverseWideBVHLeaves(world.objectWideBVH, ray, maxDistance, [&](const uint32_t first, const uint32_t count) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      closestHitInObject(ray, world.objects[world.objectBVH.primitiveIndices[i]], world, maxDistance, hit);
+    }
+  });
+  return hit;
+}
+
+static inline void closestHitsInObject(const RayPacket<RAY_PACKET_SIZE> &packet, const Ray *rays, uint32_t rayMask,
+                                       const WorldObject &object, const World &world, float *maxDistances,
+                                       Intersection *hits) noexcept {
+  if (object.shapeTag.type == ShapeType::Group) [[unlikely]] {
+    if (object.boundingBox.isFinite()) {
+      const AABB &box = object.boundingBox;
+      const float bounds[6] = {box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z};
+      float minEntry;
+      rayMask &= intersectPacketBox(bounds, packet, maxDistances, minEntry);
+    }
+    if (rayMask == 0) {
+      return;
+    }
+    for (const auto memberIndex : membersOf(object, world)) {
+      closestHitsInObject(packet, rays, rayMask, world.objects[memberIndex], world, maxDistances, hits);
+    }
+    return;
+  }
+  // The rays of a packet are traced at different times, so each of them sees a moving object somewhere else
+  if (object.motionIndex >= 0) [[unlikely]] {
+    for (; rayMask != 0; rayMask &= rayMask - 1) {
+      const uint32_t lane = static_cast<uint32_t>(__builtin_ctz(rayMask));
+      closestHitInObject(rays[lane], object, world, maxDistances[lane], hits[lane]);
+    }
+    return;
+  }
+  Ray objectRays[RAY_PACKET_SIZE];
+  for (uint32_t lane = 0; lane < RAY_PACKET_SIZE; ++lane) {
+    const Ray ray = packet.ray(lane);
+    objectRays[lane] = Ray{object.inverseTransform * ray.origin, object.inverseTransform * ray.direction};
+  }
+  const RayPacket<RAY_PACKET_SIZE> objectPacket(objectRays, RAY_PACKET_SIZE);
+  // The object's transform can turn a coherent packet into one that is not
+  if (!objectPacket.coherent) {
+    for (; rayMask != 0; rayMask &= rayMask - 1) {
+      const uint32_t lane = static_cast<uint32_t>(__builtin_ctz(rayMask));
+      closestHitInObject(packet.ray(lane), object, world, maxDistances[lane], hits[lane]);
+    }
+    return;
+  }
+  if (object.boundingBox.isFinite()) {
+    const AABB &box = object.boundingBox;
+    const float bounds[6] = {box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z};
+    float minEntry;
+    rayMask &= intersectPacketBox(bounds, objectPacket, maxDistances, minEntry);
+    if (rayMask == 0) {
+      return;
+    }
+  }
+  localClosestHits(objectPacket, rayMask, object, maxDistances, hits, world.circularSolidData, world.triangleData,
                    world.meshData);
+}
+
+// closestHit for every ray of a coherent packet, the packet traverses the object hierarchy as a whole
+static inline void closestHits(const RayPacket<RAY_PACKET_SIZE> &packet, const Ray *rays, const World &world,
+                               Intersection *hits) noexcept {
+  float maxDistances[RAY_PACKET_SIZE];
+  for (uint32_t lane = 0; lane < RAY_PACKET_SIZE; ++lane) {
+    hits[lane] = Intersection{nullptr, std::numeric_limits<float>::max()};
+    maxDistances[lane] = INFINITY;
   }
+  if (!hasAccelerationStructure(world)) {
+    for (const auto &object : world.objects) {
+      if (object.parentIndex < 0) {
+        closestHitsInObject(packet, rays, packet.activeMask, object, world, maxDistances, hits);
+      }
+    }
+    return;
+  }
+
+  for (const auto objectIndex : world.unboundedObjects) {
+    closestHitsInObject(packet, rays, packet.activeMask, world.objects[objectIndex], world, maxDistances, hits);
+  }
+  traverseWideBVHLeaves(world.objectWideBVH, packet, maxDistances,
+                        [&](const uint32_t first, const uint32_t count, const uint32_t rayMask) {
+                          for (uint32_t i = first; i < first + count; ++i) {
+                            closestHitsInObject(packet, rays, rayMask,
+                                                world.objects[world.objectBVH.primitiveIndices[i]], world,
+                                                maxDistances, hits);
+                          }
+                        });
 }
 
-inline Color lighting(const WorldObject &object, const PointLight &light, const utility::Tuple &point,
-                      const utility::Tuple &eyeVector, const utility::Tuple &normalVector,
-                      const World &world) noexcept {
+// Shadow rays start on the surface they leave, hits closer than this are that surface itself
+const float SHADOW_EPSILON = utility::EPSILON<float>;
+
+// The object, or for a group the member, that is hit within [minDistance, maxDistance], null when there is none
+static inline const WorldObject *findOccluderIn(const Ray &ray, const WorldObject &object, const World &world,
+                                                const float minDistance, const float maxDistance) noexcept {
+  if (object.shapeTag.type == ShapeType::Group) [[unlikely]] {
+    if (missesGroup(ray, object, maxDistance)) {
+      return nullptr;
+    }
+    for (const auto memberIndex : membersOf(object, world)) {
+      const WorldObject *blocker = findOccluderIn(ray, world.objects[memberIndex], world, minDistance, maxDistance);
+      if (blocker != nullptr) {
+        return blocker;
+      }
+    }
+    return nullptr;
+  }
+  if (!object.hasShadow) {
+    return nullptr;
+  }
+  if (object.motionIndex >= 0) [[unlikely]] {
+    const WorldObject placed = placeObjectAt(world, object, ray.time);
+    return findOccluderIn(ray, placed, world, minDistance, maxDistance) != nullptr ? &object : nullptr;
+  }
+  Ray transformedRay{object.inverseTransform * ray.origin, object.inverseTransform * ray.direction};
+  if (object.boundingBox.isFinite() && !object.boundingBox.intersect(transformedRay)) {
+    return nullptr;
+  }
+  return localOccluded(transformedRay, object, minDistance, maxDistance, world.circularSolidData, world.triangleData,
+                       world.meshData)
+             ? &object
+             : nullptr;
+}
+
+// Whether any object that casts shadows is hit within [minDistance, maxDistance]. Stops at the first blocker found
+// and leaves intersectionsBuffer untouched, so it can run while the buffer holds the hits being shaded.
+static const WorldObject *findOccluder(const Ray &ray, const World &world, const float minDistance,
+                                       const float maxDistance) noexcept {
+  if (!hasAccelerationStructure(world)) {
+    for (const auto &object : world.objects) {
+      if (object.parentIndex < 0) {
+        if (const WorldObject *blocker = findOccluderIn(ray, object, world, minDistance, maxDistance)) {
+          return blocker;
+        }
+      }
+    }
+    return nullptr;
+  }
+
+  for (const auto objectIndex : world.unboundedObjects) {
+    if (const WorldObject *blocker = findOccluderIn(ray, world.objects[objectIndex], world, minDistance, maxDistance)) {
+      return blocker;
+    }
+  }
+  const WorldObject *found = nullptr;
+  float traversalDistance = maxDistance;
+  traverseWideBVHLeaves(world.objectWideBVH, ray, traversalDistance, [&](const uint32_t first, const uint32_t count) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      const WorldObject &object = world.objects[world.objectBVH.primitiveIndices[i]];
+      if (const WorldObject *blocker = findOccluderIn(ray, object, world, minDistance, maxDistance)) {
+        found = blocker;
+        traversalDistance = -INFINITY; // Every remaining node starts beyond this, which ends the traversal
+        return;
+      }
+    }
+  });
+  return found;
+}
+
+bool occluded(const Ray &ray, const World &world, const float minDistance, const float maxDistance) noexcept {
+  const WorldObject *blocker = findOccluder(ray, world, minDistance, maxDistance);
+  if (rayDependencies != nullptr) {
+    recordSegment(ray, maxDistance);
+    if (blocker != nullptr) {
+      recordObject(world, blocker);
+    }
+  }
+  return blocker != nullptr;
+}
+
+LightSample sampleLight(const ShadingPoint &shading, const PointLight &light, const World &world) noexcept {
+  const WorldObject &object = *shading.object;
   Color color;
   const auto &material = world.materials[object.MaterialIndex];
   if (material.patternIndex != -1) {
-    // TODO: Handle groups where multiple transformations are applied(those from the parents)
-    auto objectPoint = object.inverseTransform * point;
+    // The transforms of group members include those of their groups, so this is the object's own space
+    auto objectPoint = object.motionIndex >= 0
+                           ? placeObjectAt(world, object, shading.time).inverseTransform * shading.point
+                           : object.inverseTransform * shading.point;
     color = drawPatternAt(world.patterns[material.patternIndex], objectPoint);
   } else {
     color = material.surfaceColor;
   }
-  const auto pointToLightVector = light.position - point;
+  const auto pointToLightVector = light.position - shading.point;
   const auto pointToLightDistance = pointToLightVector.magnitude();
   const auto pointToLightDirection = pointToLightVector.normalize();
-  const auto effectiveColor = color * light.intensity;
+  const auto intensity =
+      light.attenuation > 0.0f
+          ? light.intensity * (1.0f / (1.0f + light.attenuation * pointToLightDistance * pointToLightDistance))
+          : light.intensity;
+  const auto effectiveColor = color * intensity;
   const auto lightVector = pointToLightDirection;
-  const auto ambient = effectiveColor * material.ambient;
 
-  bool inShadow = false;
-  intersect(Ray(point, pointToLightDirection), world);
-  for (const auto &intersection : intersectionsBuffer) {
-    if (object.hasShadow && intersection.dist > 0.0f && intersection.dist < pointToLightDistance) {
-      inShadow = true;
-      break;
-    }
-  }
-
-  if (inShadow) {
-    return ambient; // specular and diffuse lighting are not relevant if the point is in shadow
-  }
+  LightSample sample;
+  sample.ambient = effectiveColor * material.ambient;
+  sample.shadowRay = Ray(shading.point, pointToLightDirection, shading.time);
+  sample.lightDistance = pointToLightDistance;
+  // Objects without shadows neither cast nor receive them
+  sample.receivesShadow = object.hasShadow;
+  sample.light = &light;
 
-  auto lightDotNormal = lightVector.dot(normalVector);
-  Color diffuse;
-  Color specular;
+  auto lightDotNormal = lightVector.dot(shading.normalVector);
   if (lightDotNormal < 0) {
-    diffuse = Color(0, 0, 0);
-    specular = Color(0, 0, 0);
+    sample.diffuse = Color(0, 0, 0);
+    sample.specular = Color(0, 0, 0);
   } else {
-    diffuse = effectiveColor * material.diffuse * lightDotNormal;
+    sample.diffuse = effectiveColor * material.diffuse * lightDotNormal;
 
-    auto reflectVector = (-lightVector).reflect(normalVector);
-    auto reflectDotEye = reflectVector.dot(eyeVector);
+    auto reflectVector = (-lightVector).reflect(shading.normalVector);
+    auto reflectDotEye = reflectVector.dot(shading.eyeVector);
     if (reflectDotEye <= 0) {
-      specular = Color(0, 0, 0);
+      sample.specular = Color(0, 0, 0);
     } else {
       auto factor = std::pow(reflectDotEye, material.shininess);
-      specular = light.intensity * material.specular * factor;
+      sample.specular = intensity * material.specular * factor;
+    }
+  }
+  return sample;
+}
+
+bool shadowed(const LightSample &sample, const World &world) noexcept {
+  return sample.receivesShadow && occluded(sample.shadowRay, world, SHADOW_EPSILON, sample.lightDistance);
+}
+
+// Seeds the jitter of the area light samples and the lights picked for clusters, so a point always gets the same
+// shadow rays
+static inline uint32_t hashPoint(const Tuple &point) noexcept {
+  return mixBits(std::bit_cast<uint32_t>(point.x) * 0x8da6b343u ^ std::bit_cast<uint32_t>(point.y) * 0xd8163841u ^
+                 std::bit_cast<uint32_t>(point.z) * 0xcb1ab31fu);
+}
+
+// Point of the area light at (s, t) in [0, 1)^2. Spheres are sampled on the disk they show the shading point, which
+// the concentric mapping covers with compact cells of equal area, so the probes land in its four quadrants.
+static inline Tuple pointOnLight(const PointLight &light, const Tuple &towardsLight, const float s,
+                                 const float t) noexcept {
+  if (light.shape == LightShape::Rectangle) {
+    return light.position + light.edgeU * (s - 0.5f) + light.edgeV * (t - 0.5f);
+  }
+  const float a = 2.0f * s - 1.0f;
+  const float b = 2.0f * t - 1.0f;
+  if (a == 0.0f && b == 0.0f) {
+    return light.position;
+  }
+  constexpr float QUARTER_PI = std::numbers::pi_v<float> / 4.0f;
+  const float r = light.radius * (std::abs(a) > std::abs(b) ? a : b);
+  const float phi = std::abs(a) > std::abs(b) ? QUARTER_PI * (b / a) : 2.0f * QUARTER_PI - QUARTER_PI * (a / b);
+  const Tuple helper = std::abs(towardsLight.x) < 0.9f ? Vector(1, 0, 0) : Vector(0, 1, 0);
+  const Tuple u = towardsLight.cross(helper).normalize();
+  const Tuple v = towardsLight.cross(u);
+  return light.position + u * (r * std::cos(phi)) + v * (r * std::sin(phi));
+}
+
+// Shadow rays out of gridSize x gridSize, one jittered ray per cell, that reach the light
+static uint32_t visibleLightSamples(const LightSample &sample, const World &world, const uint32_t gridSize,
+                                    const uint32_t seed) noexcept {
+  const Tuple &origin = sample.shadowRay.origin;
+  const uint32_t pointHash = hashPoint(origin);
+  uint32_t visible = 0;
+  for (uint32_t cell = 0; cell < gridSize * gridSize; ++cell) {
+    const uint32_t jitter = mixBits(pointHash ^ (seed + cell) * 0x9e3779b9u);
+    const float s = ((cell % gridSize) + (jitter & 0xffff) / 65536.0f) / gridSize;
+    const float t = ((cell / gridSize) + (jitter >> 16) / 65536.0f) / gridSize;
+    const Tuple toPoint = pointOnLight(*sample.light, sample.shadowRay.direction, s, t) - origin;
+    const float distance = toPoint.magnitude();
+    visible += !occluded(Ray(origin, toPoint / distance, sample.shadowRay.time), world, SHADOW_EPSILON, distance);
+  }
+  return visible;
+}
+
+float lightVisibility(const LightSample &sample, const World &world, uint32_t *shadowRayCount) noexcept {
+  if (!sample.receivesShadow) {
+    return 1.0f;
+  }
+  const PointLight &light = *sample.light;
+  if (light.shape == LightShape::Point || light.samples <= 1) {
+    if (shadowRayCount != nullptr) {
+      *shadowRayCount += 1;
+    }
+    return shadowed(sample, world) ? 0.0f : 1.0f;
+  }
+  constexpr uint32_t PROBE_COUNT = AREA_LIGHT_PROBE_GRID * AREA_LIGHT_PROBE_GRID;
+  const uint32_t visibleProbes = visibleLightSamples(sample, world, AREA_LIGHT_PROBE_GRID, 0);
+  if (visibleProbes == 0 || visibleProbes == PROBE_COUNT) {
+    if (shadowRayCount != nullptr) {
+      *shadowRayCount += PROBE_COUNT;
+    }
+    return visibleProbes == 0 ? 0.0f : 1.0f;
+  }
+  // In the penumbra, the probes count along with the finer grid
+  const auto gridSize = std::max(AREA_LIGHT_PROBE_GRID,
+                                 static_cast<uint32_t>(std::lround(std::sqrt(static_cast<float>(light.samples)))));
+  if (shadowRayCount != nullptr) {
+    *shadowRayCount += PROBE_COUNT + gridSize * gridSize;
+  }
+  const uint32_t visible = visibleLightSamples(sample, world, gridSize, PROBE_COUNT);
+  return static_cast<float>(visibleProbes + visible) / static_cast<float>(PROBE_COUNT + gridSize * gridSize);
+}
+
+// Bound on what the lights of the cluster add to the shading point, from their power, the closest point of their
+// bounds and how far in front of the surface the bounds reach. Lights behind it only add their ambient part.
+static inline float clusterBound(const LightCluster &cluster, const AABB &bounds, const ShadingPoint &shading,
+                                 const Material &material) noexcept {
+  const Tuple &point = shading.point;
+  const Tuple closest = Point(std::clamp(point.x, bounds.min.x, bounds.max.x),
+                              std::clamp(point.y, bounds.min.y, bounds.max.y),
+                              std::clamp(point.z, bounds.min.z, bounds.max.z));
+  const Tuple toClosest = closest - point;
+  const float squaredDistance = toClosest.dot(toClosest);
+  const float falloff = 1.0f / (1.0f + cluster.minAttenuation * squaredDistance);
+  // No light of the box is further in front than its farthest corner, nor closer than its closest point
+  const Tuple &normal = shading.normalVector;
+  const Tuple farthest = Point(normal.x > 0 ? bounds.max.x : bounds.min.x, normal.y > 0 ? bounds.max.y : bounds.min.y,
+                               normal.z > 0 ? bounds.max.z : bounds.min.z);
+  const float height = (farthest - point).dot(normal);
+  if (height <= 0.0f) {
+    return cluster.power * falloff * material.ambient;
+  }
+  const float cosine = squaredDistance > 0.0f ? std::min(1.0f, height / std::sqrt(squaredDistance)) : 1.0f;
+  return cluster.power * falloff * (material.ambient + material.diffuse * cosine + material.specular);
+}
+
+// Picks a light under the node, descending into each child in proportion to the bound on its contribution, and
+// returns it along with the probability it was picked with
+static std::pair<uint32_t, float> pickLight(const World &world, uint32_t node, const ShadingPoint &shading,
+                                            const Material &material, uint32_t hash) noexcept {
+  const auto &nodes = world.lightBVH.nodes;
+  const auto uniform = [&hash] {
+    hash = mixBits(hash + 0x9e3779b9u);
+    return (hash >> 8) / 16777216.0f;
+  };
+  float probability = 1.0f;
+  while (!nodes[node].isLeaf()) {
+    const uint32_t left = nodes[node].leftOrFirst;
+    float leftBound = clusterBound(world.lightClusters[left], nodes[left].bounds, shading, material);
+    float rightBound = clusterBound(world.lightClusters[left + 1], nodes[left + 1].bounds, shading, material);
+    if (leftBound + rightBound <= 0.0f) {
+      leftBound = world.lightClusters[left].power;
+      rightBound = world.lightClusters[left + 1].power;
+    }
+    const float leftShare = leftBound / (leftBound + rightBound);
+    const bool goLeft = uniform() < leftShare;
+    probability *= goLeft ? leftShare : 1.0f - leftShare;
+    node = goLeft ? left : left + 1;
+  }
+  // Lights the hierarchy could not separate share a position, their power decides
+  const uint32_t first = nodes[node].leftOrFirst;
+  const uint32_t last = first + nodes[node].count - 1;
+  float remaining = uniform() * world.lightClusters[node].power;
+  uint32_t picked = first;
+  for (; picked < last; ++picked) {
+    remaining -= brightestChannel(world.lights[world.lightBVH.primitiveIndices[picked]].intensity);
+    if (remaining < 0.0f) {
+      break;
+    }
+  }
+  const uint32_t lightIndex = world.lightBVH.primitiveIndices[picked];
+  probability *= brightestChannel(world.lights[lightIndex].intensity) / world.lightClusters[node].power;
+  return {lightIndex, probability};
+}
+
+uint32_t sampleLights(const ShadingPoint &shading, const World &world, LightSample *samples) noexcept {
+  if (world.lightErrorBound <= 0.0f || !hasLightHierarchy(world)) {
+    for (size_t i = 0; i < world.lights.size(); ++i) {
+      samples[i] = sampleLight(shading, world.lights[i], world);
     }
+    return static_cast<uint32_t>(world.lights.size());
   }
 
-  return ambient + diffuse + specular;
+  // The cut through the light hierarchy. Clusters wait in a heap ordered by their bound, the one with the largest
+  // bound is split next, settled entries have every light under them evaluated.
+  struct CutEntry {
+    uint32_t node;
+    float bound;
+  };
+  const auto smallerBound = [](const CutEntry &a, const CutEntry &b) { return a.bound < b.bound; };
+  const auto &nodes = world.lightBVH.nodes;
+  const Material &material = world.materials[shading.object->MaterialIndex];
+  CutEntry open[MAX_LIGHT_CUT];
+  CutEntry settled[MAX_LIGHT_CUT];
+  uint32_t openCount = 0;
+  uint32_t settledCount = 0;
+  float totalBound = 0.0f;
+  const auto addToCut = [&](const uint32_t node) {
+    const CutEntry entry{node, clusterBound(world.lightClusters[node], nodes[node].bounds, shading, material)};
+    totalBound += entry.bound;
+    if (nodes[node].isLeaf() && nodes[node].count == 1) {
+      settled[settledCount++] = entry;
+    } else {
+      open[openCount++] = entry;
+      std::push_heap(open, open + openCount, smallerBound);
+    }
+  };
+  addToCut(0);
+  while (openCount > 0 && open[0].bound > world.lightErrorBound * totalBound) {
+    const CutEntry worst = open[0];
+    const BVHNode &node = nodes[worst.node];
+    if (!node.isLeaf() && openCount + settledCount + 1 > MAX_LIGHT_CUT) {
+      break;
+    }
+    std::pop_heap(open, open + openCount, smallerBound);
+    --openCount;
+    if (node.isLeaf()) {
+      settled[settledCount++] = worst;
+      continue;
+    }
+    totalBound -= worst.bound;
+    addToCut(node.leftOrFirst);
+    addToCut(node.leftOrFirst + 1);
+  }
+
+  // Entries that can not add anything are culled
+  uint32_t count = 0;
+  for (const CutEntry &entry : std::span(settled, settledCount)) {
+    if (entry.bound <= 0.0f) {
+      continue;
+    }
+    const BVHNode &node = nodes[entry.node];
+    for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i) {
+      samples[count++] = sampleLight(shading, world.lights[world.lightBVH.primitiveIndices[i]], world);
+    }
+  }
+  const uint32_t pointHash = hashPoint(shading.point);
+  for (const CutEntry &entry : std::span(open, openCount)) {
+    if (entry.bound <= 0.0f) {
+      continue;
+    }
+    const auto [lightIndex, probability] =
+        pickLight(world, entry.node, shading, material, pointHash ^ entry.node * 0x85ebca6bu);
+    // Divided by the probability of the pick, the picked light stands for the whole cluster on average
+    LightSample sample = sampleLight(shading, world.lights[lightIndex], world);
+    sample.ambient = sample.ambient * (1.0f / probability);
+    sample.diffuse = sample.diffuse * (1.0f / probability);
+    sample.specular = sample.specular * (1.0f / probability);
+    samples[count++] = sample;
+  }
+  return count;
 }
 
 static inline float schlick(const Tuple &eyeVector, const Tuple &normalVector, float n1, float n2) {
@@ -104,79 +614,101 @@ static inline float schlick(const Tuple &eyeVector, const Tuple &normalVector, f
   return r0 + (1 - r0) * std::pow(1 - cos, 5);
 }
 
-static inline std::pair<float, float> calculateRefractiveIndices(const World &world, Intersection intersection) {
-  static thread_local Arena<const WorldObject *> unexitedShapes(GB(1));
-  unexitedShapes.clear();
-  float n1, n2;
-  for (const auto &i : intersectionsBuffer) {
-    if (i == intersection) {
-      size_t size = unexitedShapes.size;
-      n1 = size == 0 ? 1.0 : world.materials[unexitedShapes[size - 1]->MaterialIndex].refractiveIndex;
+MediumStack mediaAt(const Ray &ray, const World &world) noexcept {
+  MediumStack media;
+  media.resolved = true;
+  intersect(ray, world);
+  // Meshes only report their closest hit, so the crossings behind the origin are added separately: in the order of the
+  // line they are the crossings of the reversed ray at negative distances
+  const Ray reversed(ray.origin, -ray.direction, ray.time);
+  for (const auto &object : world.objects) {
+    if (object.shapeTag.type != ShapeType::Mesh) {
+      continue;
     }
-
-    auto found = std::find(unexitedShapes.begin(), unexitedShapes.end(), i.object);
-    if (found != unexitedShapes.end()) {
-      size_t size = unexitedShapes.size;
-      size_t index = found - unexitedShapes.begin();
-      unexitedShapes[index] = unexitedShapes[size - 1];
-      unexitedShapes.popBack();
-    } else {
-      unexitedShapes.pushBack(i.object);
+    const WorldObject placed = placeObjectAt(world, object, ray.time);
+    const Ray objectSpaceRay{placed.inverseTransform * reversed.origin, placed.inverseTransform * reversed.direction};
+    if (!placed.boundingBox.intersect(objectSpaceRay)) {
+      continue;
     }
-
-    if (i == intersection) {
-      size_t size = unexitedShapes.size;
-      n2 = size == 0 ? 1.0 : world.materials[unexitedShapes[size - 1]->MaterialIndex].refractiveIndex;
-      break;
+    const size_t firstCrossing = intersectionsBuffer.size;
+    meshCrossings(objectSpaceRay, placed, intersectionsBuffer, world.triangleData, world.meshData);
+    for (size_t i = firstCrossing; i < intersectionsBuffer.size; ++i) {
+      intersectionsBuffer[i].object = &object;
+      intersectionsBuffer[i].dist = -intersectionsBuffer[i].dist;
     }
   }
-  return {n1, n2};
-}
-
-Color colorAt(const Ray &ray, const World &world, size_t recursionLimit) noexcept {
-  if (recursionLimit == 0)
-    return Color{0, 0, 0};
-  intersect(ray, world);
   std::ranges::sort(intersectionsBuffer, {}, [](const auto &intersection) { return intersection.dist; });
-  Intersection hit{nullptr, std::numeric_limits<float>::max()};
-  for (auto &i : intersectionsBuffer) {
-    if (i.dist < hit.dist && i.dist > 0.0f) {
-      hit = i;
+  // Objects entered and exited behind the origin cancel out, the ones left over contain it
+  for (const auto &intersection : intersectionsBuffer) {
+    if (intersection.dist > 0.0f) {
+      break;
     }
+    media.cross(intersection.object);
   }
-  if (hit.object == nullptr || hit.dist < 0.0f)
-    return Color{0, 0, 0};
+  return media;
+}
 
-  auto point = ray.position(hit.dist);
-  auto normalVector =
-      normalAt(*hit.object, point, world.circularSolidData, world.triangleData, hit.u, hit.v, hit.triangleIndex)
-          .normalize();
-  auto reflectVector = ray.direction.reflect(normalVector);
-  auto eyeVector = -ray.direction;
-  if (normalVector.dot(eyeVector) < 0) {
+ShadingPoint prepareShading(const Ray &ray, const Intersection &hit, const World &world,
+                            const MediumStack &media) noexcept {
+  ShadingPoint shading;
+  shading.object = hit.object;
+  shading.point = ray.position(hit.dist);
+  shading.time = ray.time;
+  const auto normalOf = [&](const WorldObject &object) {
+    return normalAt(object, shading.point, world.circularSolidData, world.triangleData, hit.u, hit.v,
+                    hit.triangleIndex)
+        .normalize();
+  };
+  // Moving objects are shaded where the ray found them
+  auto normalVector = hit.object->motionIndex >= 0 ? normalOf(placeObjectAt(world, *hit.object, ray.time))
+                                                   : normalOf(*hit.object);
+  shading.reflectVector = ray.direction.reflect(normalVector);
+  shading.eyeVector = -ray.direction;
+  if (normalVector.dot(shading.eyeVector) < 0) {
     normalVector = -normalVector;
   }
-  auto surfaceOffsetPoint = point + normalVector * SHADOW_OFFSET;
-  auto internalOffsetPoint = point - normalVector * SHADOW_OFFSET;
+  shading.normalVector = normalVector;
 
-  auto surfaceColor = Color{0, 0, 0};
-  auto refractedColor = Color{0, 0, 0};
-  auto reflectedColor = Color{0, 0, 0};
-  // This function has to be called before any calls to lighting or recursive calls to colorAt because the
-  // intersectionBuffer will then be modified
-  auto [n1, n2] = calculateRefractiveIndices(world, hit);
-  for (const auto &light : world.lights) {
-    surfaceColor += scene::lighting(*hit.object, light, point, eyeVector, normalVector, world);
+  // Only transparent hits need the refractive indices, n1 is the medium the ray travels in and n2 the one it enters
+  // (or returns to) when crossing the hit surface
+  shading.outerMedia = media;
+  if (world.materials[hit.object->MaterialIndex].transparency != 0) {
+    if (!shading.outerMedia.resolved) {
+      shading.outerMedia = mediaAt(ray, world);
+    }
+    shading.innerMedia = shading.outerMedia;
+    shading.innerMedia.cross(hit.object);
+    shading.n1 = shading.outerMedia.refractiveIndex(world);
+    shading.n2 = shading.innerMedia.refractiveIndex(world);
+    if (rayDependencies != nullptr) {
+      for (uint32_t i = 0; i < shading.outerMedia.size; ++i) {
+        recordObject(world, shading.outerMedia.objects[i]);
+      }
+    }
   }
+  if (rayDependencies != nullptr) {
+    recordObject(world, hit.object);
+  }
+  return shading;
+}
+
+uint32_t secondaryRays(const ShadingPoint &shading, const World &world, SecondaryRay *rays) noexcept {
+  const auto &material = world.materials[shading.object->MaterialIndex];
+  const auto &normalVector = shading.normalVector;
+  const auto &eyeVector = shading.eyeVector;
+  // Fresnel only applies to surfaces that both reflect and refract
+  const bool fresnel = material.reflectance > 0 && material.transparency > 0;
+  const float reflectance = fresnel ? schlick(eyeVector, normalVector, shading.n1, shading.n2) : 1.0f;
 
-  const auto &material = world.materials[hit.object->MaterialIndex];
+  uint32_t count = 0;
   if (material.reflectance != 0) {
-    auto reflectedRay = Ray(surfaceOffsetPoint, reflectVector);
-    reflectedColor += colorAt(reflectedRay, world, recursionLimit - 1) * material.reflectance;
+    auto surfaceOffsetPoint = shading.point + normalVector * SHADOW_OFFSET;
+    rays[count++] = SecondaryRay{Ray(surfaceOffsetPoint, shading.reflectVector, shading.time), shading.outerMedia,
+                                 material.reflectance, reflectance};
   }
 
   if (material.transparency != 0) {
-    auto nRatio = n1 / n2;
+    auto nRatio = shading.n1 / shading.n2;
     auto cosI = eyeVector.dot(normalVector);
     auto sin2T = nRatio * nRatio * (1 - cosI * cosI); // basically solving snell's law
 
@@ -185,17 +717,108 @@ Color colorAt(const Ray &ray, const World &world, size_t recursionLimit) noexcep
       // Calculate refracted ray then its color
       auto cosT = std::sqrt(1.0 - sin2T);
       auto direction = normalVector * (nRatio * cosI - cosT) - eyeVector * nRatio;
-      auto refractedRay = Ray(internalOffsetPoint, direction);
-      refractedColor += colorAt(refractedRay, world, recursionLimit - 1) * material.transparency;
+      auto internalOffsetPoint = shading.point - normalVector * SHADOW_OFFSET;
+      rays[count++] = SecondaryRay{Ray(internalOffsetPoint, direction, shading.time), shading.innerMedia,
+                                   material.transparency, fresnel ? 1 - reflectance : 1.0f};
     }
   }
+  return count;
+}
 
-  if (material.reflectance > 0 && material.transparency > 0) {
-    auto reflectance = schlick(eyeVector, normalVector, n1, n2);
-    return surfaceColor + reflectedColor * reflectance + refractedColor * (1 - reflectance);
-  } else {
-    return surfaceColor + reflectedColor + refractedColor;
+// A reflected or refracted ray colorAt still has to trace. Its throughput is the share its color has in the color of
+// the ray colorAt was called with, recursionLimit the number of bounces left including its own.
+struct PendingRay {
+  Ray ray;
+  MediumStack media;
+  float throughput;
+  size_t recursionLimit;
+};
+// Tracing a ray replaces it with at most two, so walking the ray tree depth first never needs more pending rays than
+// bounces. Deeper recursion limits are clamped to this.
+constexpr size_t MAX_PENDING_RAYS = 32;
+
+// Color seen along the ray when it hits the surface at hit. The ray tree is walked depth first with an explicit stack,
+// branches whose throughput drops below minContribution are not traced.
+static Color shadeHit(const Ray &ray, const Intersection &hit, const World &world, const MediumStack &media,
+                      const size_t recursionLimit, const float minContribution) noexcept {
+  PendingRay pending[MAX_PENDING_RAYS];
+  size_t pendingCount = 0;
+  auto color = Color{0, 0, 0};
+  const auto shadeAndContinue = [&](const Ray &ray, const Intersection &hit, const MediumStack &media,
+                                    const float throughput, const size_t recursionLimit) {
+    const ShadingPoint shading = prepareShading(ray, hit, world, media);
+    auto surfaceColor = Color{0, 0, 0};
+    lightSampleBuffer.resize(world.lights.size());
+    const uint32_t lightSampleCount = sampleLights(shading, world, lightSampleBuffer.data());
+    for (const LightSample &sample : std::span(lightSampleBuffer.data(), lightSampleCount)) {
+      surfaceColor += sample.color(lightVisibility(sample, world));
+    }
+    color += surfaceColor * throughput;
+    if (recursionLimit <= 1) {
+      return;
+    }
+
+    SecondaryRay secondary[MAX_SECONDARY_RAYS];
+    const uint32_t secondaryCount = secondaryRays(shading, world, secondary);
+    // Pushed in reverse, so the reflected ray is traced first
+    for (uint32_t i = secondaryCount; i-- > 0;) {
+      const float secondaryThroughput = throughput * secondary[i].scale * secondary[i].fresnel;
+      if (secondaryThroughput < minContribution) {
+        continue;
+      }
+      pending[pendingCount++] =
+          PendingRay{secondary[i].ray, secondary[i].media, secondaryThroughput, recursionLimit - 1};
+    }
+  };
+
+  shadeAndContinue(ray, hit, media, 1.0f, std::min(recursionLimit, MAX_PENDING_RAYS));
+  while (pendingCount > 0) {
+    const PendingRay next = pending[--pendingCount];
+    const Intersection nextHit = closestHit(next.ray, world);
+    if (rayDependencies != nullptr) {
+      if (nextHit.object != nullptr) {
+        recordSegment(next.ray, nextHit.dist);
+      } else {
+        rayDependencies->unboundedRays = true;
+      }
+    }
+    if (nextHit.object != nullptr) {
+      shadeAndContinue(next.ray, nextHit, next.media, next.throughput, next.recursionLimit);
+    }
+  }
+  return color;
+}
+
+Color colorAt(const Ray &ray, const World &world, const MediumStack &media, const size_t recursionLimit,
+              const float minContribution) noexcept {
+  if (recursionLimit == 0)
+    return Color{0, 0, 0};
+  const Intersection hit = closestHit(ray, world);
+  if (hit.object == nullptr)
+    return Color{0, 0, 0};
+  return shadeHit(ray, hit, world, media, recursionLimit, minContribution);
+}
+
+void colorAtPacket(const Ray *rays, const uint32_t rayCount, const World &world, const MediumStack &media,
+                   Color *colors, const size_t recursionLimit, const float minContribution) noexcept {
+  const RayPacket<RAY_PACKET_SIZE> packet(rays, rayCount);
+  if (recursionLimit == 0 || !packet.coherent) {
+    for (uint32_t i = 0; i < rayCount; ++i) {
+      colors[i] = colorAt(rays[i], world, media, recursionLimit, minContribution);
+    }
+    return;
   }
+
+  Intersection hits[RAY_PACKET_SIZE];
+  closestHits(packet, rays, world, hits);
+  for (uint32_t i = 0; i < rayCount; ++i) {
+    colors[i] = hits[i].object == nullptr ? Color{0, 0, 0}
+                                          : shadeHit(rays[i], hits[i], world, media, recursionLimit, minContribution);
+  }
+}
+
+Color colorAt(const Ray &ray, const World &world, size_t recursionLimit) noexcept {
+  return colorAt(ray, world, MediumStack{}, recursionLimit);
 }
 
 } // namespace scene
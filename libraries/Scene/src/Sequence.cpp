@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <utility>
+
+#include "libraries/Scene/include/Sequence.hpp"
+
+namespace raytracer::scene {
+
+using Clock = std::chrono::high_resolution_clock;
+
+static double millisecondsSince(const Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+std::vector<SequenceFrameTimings> renderSequence(const Camera& camera, World& world,
+                                                 const std::vector<utility::Matrix<4, 4>>& cameraTrack,
+                                                 const std::vector<ObjectTrack>& objectTracks,
+                                                 const FrameWriter& writeFrame) {
+  size_t frameCount = cameraTrack.size();
+  for (const auto& track : objectTracks) {
+    frameCount = std::max(frameCount, track.transforms.size());
+  }
+
+  Camera frameCamera = camera;
+  std::vector<SequenceFrameTimings> timings(frameCount);
+  // Writes the previous frame, at most one frame waits to be written at any time
+  std::future<double> pendingWrite;
+  for (size_t frame = 0; frame < frameCount; ++frame) {
+    SequenceFrameTimings& frameTimings = timings[frame];
+    const auto updateStart = Clock::now();
+    if (!cameraTrack.empty()) {
+      frameCamera.setTransform(cameraTrack[std::min(frame, cameraTrack.size() - 1)]);
+    }
+    for (const auto& track : objectTracks) {
+      if (!track.transforms.empty()) {
+        setObjectTransform(world, track.objectIndex, track.transforms[std::min(frame, track.transforms.size() - 1)]);
+      }
+    }
+    // Builds the hierarchy for the first frame, refits it afterwards
+    frameTimings.rebuilt = updateAccelerationStructure(world);
+    frameTimings.updateMilliseconds = millisecondsSince(updateStart);
+
+    const auto renderStart = Clock::now();
+    Canvas image = frameCamera.render(world);
+    frameTimings.renderMilliseconds = millisecondsSince(renderStart);
+
+    const auto stallStart = Clock::now();
+    if (pendingWrite.valid()) {
+      timings[frame - 1].writeMilliseconds = pendingWrite.get();
+    }
+    frameTimings.stallMilliseconds = millisecondsSince(stallStart);
+    pendingWrite = std::async(std::launch::async, [&writeFrame, image = std::move(image), frame] {
+      const auto writeStart = Clock::now();
+      writeFrame(image, frame);
+      return millisecondsSince(writeStart);
+    });
+  }
+  if (pendingWrite.valid()) {
+    timings.back().writeMilliseconds = pendingWrite.get();
+  }
+  return timings;
+}
+
+FrameWriter ppmFrameWriter(const std::string& pathPrefix) {
+  return [pathPrefix](const Canvas& image, const size_t frame) {
+    char number[16];
+    std::snprintf(number, sizeof(number), "%04zu", frame);
+    std::ofstream file(pathPrefix + number + ".ppm");
+    image.canvasToPPM(file);
+  };
+}
+
+} // namespace raytracer::scene
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#include <tbb/task_arena.h>
+
+#include "libraries/Scene/include/Camera.hpp"
+#include "libraries/Scene/include/Renderer.hpp"
+#include "libraries/Scene/include/Wavefront.hpp"
+#include "libraries/Utility/include/AABB.hpp"
+
+namespace raytracer::scene {
+
+using namespace utility;
+
+// Pixels whose ray trees are in flight at the same time. Small enough for the streams of a bounce to stay in cache,
+// larger chunks sort better but were slower on the scenes in WavefrontBenchmark.
+constexpr size_t STREAM_PIXELS = size_t{1} << 12;
+// Sort keys hold the direction octant, then the Morton code of the origin cell, then the index of the ray
+constexpr uint32_t CELL_BITS_PER_AXIS = 10;
+constexpr uint32_t INDEX_BITS = 31;
+
+// A ray of the stream, throughput is the share of its color in the color of the pixel
+struct StreamRay {
+  Ray ray;
+  MediumStack media;
+  float throughput = 1.0f;
+};
+
+// The rays of one bounce and what is left to do for them once the deeper bounces are done
+struct Bounce {
+  std::vector<StreamRay> rays;
+  std::vector<Intersection> hits;
+  std::vector<Color> contributions;      ///< Surface color of the hit weighted by the throughput of the ray.
+  std::vector<uint32_t> firstChild;      ///< Index of the first ray in the next bounce that continues from this one.
+  std::vector<uint8_t> childCount;
+};
+
+// Scratch space shared by all bounces, so every bounce does not have to allocate (and fault in) its own
+struct StreamBuffers {
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> order;
+  std::vector<LightSample> lightSamples; ///< Room for one per ray and light, filled in for rays that hit something.
+  std::vector<uint32_t> lightSampleCounts; ///< Samples sampleLights wrote for each ray.
+  std::vector<uint32_t> shadowRayCounts; ///< Shadow rays lightVisibility traced for the samples of each ray.
+  std::vector<StreamRay> continuations; ///< MAX_SECONDARY_RAYS slots per ray, gathered into the next bounce.
+};
+
+static double millisecondsSince(const std::chrono::steady_clock::time_point start) noexcept {
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Spreads the lowest 10 bits of value so that there are two zero bits between each of them
+static inline uint32_t expandCellBits(uint32_t value) noexcept {
+  value &= 0x3ff;
+  value = (value | value << 16) & 0x030000ff;
+  value = (value | value << 8) & 0x0300f00f;
+  value = (value | value << 4) & 0x030c30c3;
+  value = (value | value << 2) & 0x09249249;
+  return value;
+}
+
+// Order in which the rays are traced, rays going the same way from nearby origins end up next to each other
+static void sortRays(const std::vector<StreamRay> &rays, std::vector<uint64_t> &keys,
+                     std::vector<uint32_t> &order) noexcept {
+  AABB originBounds = AABB::empty();
+  for (const auto &streamRay : rays) {
+    originBounds.expandToInclude(streamRay.ray.origin);
+  }
+  const auto cell = [&](const float value, const float axisMin, const float axisMax) {
+    constexpr float scale = static_cast<float>((1u << CELL_BITS_PER_AXIS) - 1);
+    const float extent = axisMax - axisMin;
+    return static_cast<uint32_t>(extent > 0.0f ? std::clamp((value - axisMin) / extent, 0.0f, 1.0f) * scale : 0.0f);
+  };
+
+  keys.resize(rays.size());
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rays.size()), [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t i = range.begin(); i != range.end(); ++i) {
+      const Ray &ray = rays[i].ray;
+      const uint64_t octant = (ray.direction.x < 0 ? 4 : 0) | (ray.direction.y < 0 ? 2 : 0) |
+                              (ray.direction.z < 0 ? 1 : 0);
+      const uint64_t originCell = expandCellBits(cell(ray.origin.x, originBounds.min.x, originBounds.max.x)) << 2 |
+                                  expandCellBits(cell(ray.origin.y, originBounds.min.y, originBounds.max.y)) << 1 |
+                                  expandCellBits(cell(ray.origin.z, originBounds.min.z, originBounds.max.z));
+      keys[i] = octant << (3 * CELL_BITS_PER_AXIS + INDEX_BITS) | originCell << INDEX_BITS | i;
+    }
+  });
+  tbb::parallel_sort(keys.begin(), keys.end());
+
+  order.resize(rays.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    order[i] = static_cast<uint32_t>(keys[i] & ((uint64_t{1} << INDEX_BITS) - 1));
+  }
+}
+
+// Traces and shades the rays of the bounce and fills in the rays of the next one (if any) in the order of their parents
+static void traceBounce(Bounce &bounce, Bounce *next, const World &world, const float minContribution,
+                        StreamBuffers &buffers, WavefrontTimings &timings) noexcept {
+  const size_t rayCount = bounce.rays.size();
+  const size_t lightCount = world.lights.size();
+  const auto &order = buffers.order;
+  auto start = std::chrono::steady_clock::now();
+  sortRays(bounce.rays, buffers.keys, buffers.order);
+  timings.sortMilliseconds += millisecondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  bounce.hits.resize(rayCount);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rayCount), [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t i = range.begin(); i != range.end(); ++i) {
+      bounce.hits[order[i]] = closestHit(bounce.rays[order[i]].ray, world);
+    }
+  });
+  timings.traceMilliseconds += millisecondsSince(start);
+  timings.rayCount += rayCount;
+
+  // Every ray leaves room for MAX_SECONDARY_RAYS continuations, which are gathered afterwards
+  start = std::chrono::steady_clock::now();
+  auto &continuations = buffers.continuations;
+  if (next != nullptr) {
+    continuations.resize(std::max(continuations.size(), rayCount * MAX_SECONDARY_RAYS));
+  }
+  auto &lightSamples = buffers.lightSamples;
+  lightSamples.resize(std::max(lightSamples.size(), rayCount * lightCount));
+  auto &lightSampleCounts = buffers.lightSampleCounts;
+  lightSampleCounts.assign(rayCount, 0);
+  bounce.childCount.assign(rayCount, 0);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rayCount), [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t i = range.begin(); i != range.end(); ++i) {
+      const uint32_t index = order[i];
+      const Intersection &hit = bounce.hits[index];
+      if (hit.object == nullptr) {
+        continue;
+      }
+      const StreamRay &streamRay = bounce.rays[index];
+      const ShadingPoint shading = prepareShading(streamRay.ray, hit, world, streamRay.media);
+      lightSampleCounts[index] = sampleLights(shading, world, lightSamples.data() + index * lightCount);
+      if (next == nullptr) {
+        continue;
+      }
+      SecondaryRay secondary[MAX_SECONDARY_RAYS];
+      const uint32_t secondaryCount = secondaryRays(shading, world, secondary);
+      uint8_t childCount = 0;
+      for (const auto &[ray, media, scale, fresnel] : std::span(secondary, secondaryCount)) {
+        // Cut off like in colorAt
+        const float throughput = streamRay.throughput * scale * fresnel;
+        if (throughput >= minContribution) {
+          continuations[index * MAX_SECONDARY_RAYS + childCount++] = StreamRay{ray, media, throughput};
+        }
+      }
+      bounce.childCount[index] = childCount;
+    }
+  });
+  timings.shadeMilliseconds += millisecondsSince(start);
+
+  // Lights are added up in the order colorAt uses, the shadow rays follow the sorted order of the rays they left
+  start = std::chrono::steady_clock::now();
+  bounce.contributions.resize(rayCount);
+  auto &shadowRayCounts = buffers.shadowRayCounts;
+  shadowRayCounts.assign(rayCount, 0);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rayCount), [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t i = range.begin(); i != range.end(); ++i) {
+      const uint32_t index = order[i];
+      if (bounce.hits[index].object == nullptr) {
+        continue;
+      }
+      auto surfaceColor = Color{0, 0, 0};
+      for (const LightSample &sample : std::span(lightSamples.data() + index * lightCount, lightSampleCounts[index])) {
+        surfaceColor += sample.color(lightVisibility(sample, world, &shadowRayCounts[index]));
+      }
+      bounce.contributions[index] = surfaceColor * bounce.rays[index].throughput;
+    }
+  });
+  timings.shadowMilliseconds += millisecondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  bounce.firstChild.resize(rayCount);
+  uint32_t nextRayCount = 0;
+  for (size_t index = 0; index < rayCount; ++index) {
+    timings.shadowRayCount += shadowRayCounts[index];
+    bounce.firstChild[index] = nextRayCount;
+    nextRayCount += bounce.childCount[index];
+  }
+  if (next == nullptr) {
+    timings.generateMilliseconds += millisecondsSince(start);
+    return;
+  }
+  next->rays.resize(nextRayCount);
+  tbb::parallel_for(tbb::blocked_range<size_t>(0, rayCount), [&](const tbb::blocked_range<size_t> &range) {
+    for (size_t index = range.begin(); index != range.end(); ++index) {
+      std::copy_n(continuations.begin() + index * MAX_SECONDARY_RAYS, bounce.childCount[index],
+                  next->rays.begin() + bounce.firstChild[index]);
+    }
+  });
+  timings.generateMilliseconds += millisecondsSince(start);
+}
+
+// Adds up the contributions of a ray and the rays continuing from it in the order colorAt visits them, reflected
+// before refracted and depth first, so the sum is rounded the same way
+static void addRayTree(const std::vector<Bounce> &bounces, const size_t depth, const uint32_t index,
+                       Color &color) noexcept {
+  const Bounce &bounce = bounces[depth];
+  if (bounce.hits[index].object == nullptr) {
+    return;
+  }
+  color += bounce.contributions[index];
+  for (uint8_t child = 0; child < bounce.childCount[index]; ++child) {
+    addRayTree(bounces, depth + 1, bounce.firstChild[index] + child, color);
+  }
+}
+
+Canvas renderWavefront(const Camera &camera, const World &world, WavefrontTimings *timings,
+                       const size_t recursionLimit) noexcept {
+  auto image = Canvas(camera.numHorPixels_, camera.numVerPixels_);
+  WavefrontTimings stageTimings;
+  const size_t pixelCount = size_t{camera.numHorPixels_} * camera.numVerPixels_;
+  const MediumStack cameraMedia = mediaAt(camera.rayForPixel(0, 0), world);
+  const bool motionBlur = hasMovingObjects(world);
+
+  std::vector<Bounce> bounces(recursionLimit);
+  StreamBuffers buffers;
+  tbb::task_arena arena(camera.threadCount_ == 0 ? tbb::task_arena::automatic : static_cast<int>(camera.threadCount_));
+  arena.execute([&] {
+    for (size_t firstPixel = 0; firstPixel < pixelCount && recursionLimit > 0; firstPixel += STREAM_PIXELS) {
+      const size_t chunkPixels = std::min(STREAM_PIXELS, pixelCount - firstPixel);
+      auto start = std::chrono::steady_clock::now();
+      bounces[0].rays.resize(chunkPixels);
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, chunkPixels), [&](const tbb::blocked_range<size_t> &range) {
+        for (size_t i = range.begin(); i != range.end(); ++i) {
+          const size_t pixel = firstPixel + i;
+          const auto x = static_cast<unsigned int>(pixel % camera.numHorPixels_);
+          const auto y = static_cast<unsigned int>(pixel / camera.numHorPixels_);
+          // Same times as the center rays of Camera::render
+          bounces[0].rays[i] = StreamRay{
+              motionBlur ? camera.rayForPixel(x, y, 0.5, 0.5, camera.shutterTime(x, y, 0)) : camera.rayForPixel(x, y),
+              cameraMedia};
+        }
+      });
+      stageTimings.generateMilliseconds += millisecondsSince(start);
+
+      // A ray at bounce depth has recursionLimit - depth bounces left, the last bounce has no continuations
+      size_t depth = 0;
+      for (; depth < recursionLimit && !bounces[depth].rays.empty(); ++depth) {
+        traceBounce(bounces[depth], depth + 1 < recursionLimit ? &bounces[depth + 1] : nullptr, world,
+                    camera.minContribution_, buffers, stageTimings);
+      }
+      stageTimings.bounceCount = std::max(stageTimings.bounceCount, static_cast<uint32_t>(depth));
+
+      start = std::chrono::steady_clock::now();
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, chunkPixels), [&](const tbb::blocked_range<size_t> &range) {
+        for (size_t i = range.begin(); i != range.end(); ++i) {
+          auto color = Color{0, 0, 0};
+          if (depth > 0) {
+            addRayTree(bounces, 0, static_cast<uint32_t>(i), color);
+          }
+          const size_t pixel = firstPixel + i;
+          image.pixelWrite(color, pixel % camera.numHorPixels_, pixel / camera.numHorPixels_);
+        }
+      });
+      stageTimings.accumulateMilliseconds += millisecondsSince(start);
+    }
+  });
+
+  if (timings != nullptr) {
+    *timings = stageTimings;
+  }
+  return image;
+}
+
+} // namespace raytracer::scene
@@ -1,6 +1,10 @@
 #include "libraries/Scene/include/World.hpp"
 #include "libraries/Geometry/include/Shape.hpp"
+#include "libraries/Scene/include/MeshCache.hpp"
+#include "libraries/Utility/include/Hash.hpp"
+#include "libraries/Utility/include/MappedFile.hpp"
 
+#include <cassert>
 #include <cstddef>
 #include <iostream>
 
@@ -9,6 +13,12 @@
 
 namespace raytracer::scene {
 
+static void invalidateAccelerationStructure(World &world) noexcept {
+  world.objectBVH = BVH{};
+  world.objectWideBVH = {};
+  world.unboundedObjects.clear();
+}
+
 void setBoundingBox(const World &world, WorldObject &node) noexcept {
   switch (node.shapeTag.type) {
     case ShapeType::Sphere: {
@@ -47,6 +57,10 @@ void setBoundingBox(const World &world, WorldObject &node) noexcept {
     }
     case ShapeType::Mesh: {
       const MeshData &mesh = world.meshData[node.shapeTag.dataIndex];
+      if (!mesh.bvh.nodes.empty()) {
+        node.boundingBox = mesh.bvh.nodes[0].bounds;
+        break;
+      }
       for (int32_t i = 0; i < mesh.triangleCount; ++i) {
         const TriangleData &tri = world.triangleData[mesh.firstTriangleIndex + i];
         if (i == 0) {
@@ -60,10 +74,11 @@ void setBoundingBox(const World &world, WorldObject &node) noexcept {
       break;
     }
     case ShapeType::Group: {
+      // The members carry the group's transform, so unlike other shapes the group's box is kept in world space
       int32_t dataIndex = node.shapeTag.dataIndex;
+      node.boundingBox = AABB::empty();
       for (auto &childIndex : world.groupData[dataIndex].childerenIndices) {
-        node.boundingBox.expandToInclude(
-            world.objects[childIndex].boundingBox.transform(world.objects[childIndex].transform));
+        node.boundingBox.expandToInclude(worldBounds(world, world.objects[childIndex]));
       }
       break;
     }
@@ -91,6 +106,7 @@ size_t addObject(World &world, const WorldObject &object) noexcept {
   setBoundingBox(world, newObject);
 
   world.objects.push_back(std::move(newObject));
+  invalidateAccelerationStructure(world);
   return world.objects.size() - 1;
 }
 
@@ -121,6 +137,8 @@ size_t addTriangle(World &world, const utility::Tuple &v0, const utility::Tuple
 
 size_t addLight(World &world, const PointLight &light) noexcept {
   world.lights.push_back(light);
+  world.lightBVH = BVH{};
+  world.lightClusters.clear();
   return world.lights.size() - 1;
 }
 
@@ -136,11 +154,67 @@ size_t addObjectWithMaterial(World &world, const WorldObject &object, const Mate
   return addObject(world, newObject);
 }
 
+// Applies a change in world space to the object, and to the members of a group along with it
+static void applyWorldTransform(World &world, WorldObject &object, const utility::Matrix<4, 4> &change,
+                                const utility::Matrix<4, 4> &inverseChange) noexcept {
+  object.transform = change * object.transform;
+  object.inverseTransform = object.inverseTransform * inverseChange;
+  if (object.motionIndex >= 0) {
+    auto &endTransform = world.motionData[object.motionIndex].endTransform;
+    endTransform = change * endTransform;
+  }
+  if (object.shapeTag.type == ShapeType::Group) {
+    for (const auto memberIndex : world.groupData[object.shapeTag.dataIndex].childerenIndices) {
+      applyWorldTransform(world, world.objects[memberIndex], change, inverseChange);
+    }
+  }
+  setBoundingBox(world, object);
+}
+
+// The boxes of the groups the object is in have to follow it
+static void updateGroupBounds(World &world, int16_t groupIndex) noexcept {
+  for (; groupIndex >= 0; groupIndex = world.objects[groupIndex].parentIndex) {
+    setBoundingBox(world, world.objects[groupIndex]);
+  }
+}
+
 void addTransformToObject(World &world, const size_t objectIndex, const utility::Matrix<4, 4> &transform) noexcept {
   WorldObject &object = world.objects[objectIndex];
-  object.transform = transform * object.transform;
-  object.inverseTransform = object.inverseTransform * inverse(transform);
+  if (object.parentIndex < 0) {
+    applyWorldTransform(world, object, transform, inverse(transform));
+  } else {
+    // The transform applies within the group, which in world space is group * transform * group^-1
+    const WorldObject &group = world.objects[object.parentIndex];
+    applyWorldTransform(world, object, group.transform * transform * group.inverseTransform,
+                        group.transform * inverse(transform) * group.inverseTransform);
+    updateGroupBounds(world, object.parentIndex);
+  }
+  // The set of objects is unchanged, so the hierarchy can still be refit by updateAccelerationStructure
+  world.objectBVHOutdated = true;
+}
+
+void setObjectTransform(World &world, const size_t objectIndex, const utility::Matrix<4, 4> &transform) noexcept {
+  WorldObject &object = world.objects[objectIndex];
+  const auto worldTransform =
+      object.parentIndex < 0 ? transform : world.objects[object.parentIndex].transform * transform;
+  if (object.shapeTag.type == ShapeType::Group) {
+    // The members move by the difference between the old and the new transform of the group
+    const auto change = worldTransform * object.inverseTransform;
+    const auto inverseChange = object.transform * inverse(worldTransform);
+    for (const auto memberIndex : world.groupData[object.shapeTag.dataIndex].childerenIndices) {
+      applyWorldTransform(world, world.objects[memberIndex], change, inverseChange);
+    }
+  }
+  if (object.motionIndex >= 0) {
+    // The end of the motion moves along, otherwise the object would be smeared back to where it was before
+    auto &endTransform = world.motionData[object.motionIndex].endTransform;
+    endTransform = worldTransform * object.inverseTransform * endTransform;
+  }
+  object.transform = worldTransform;
+  object.inverseTransform = inverse(worldTransform);
   setBoundingBox(world, object);
+  updateGroupBounds(world, object.parentIndex);
+  world.objectBVHOutdated = true;
 }
 
 void setObjectShadow(World &world, const size_t objectIndex, const bool hasShadow) noexcept {
@@ -148,7 +222,117 @@ void setObjectShadow(World &world, const size_t objectIndex, const bool hasShado
   object.hasShadow = hasShadow;
 }
 
-std::optional<size_t> loadMeshFromObjFile(World &world, const std::string &inputFile) {
+size_t addGroup(World &world, const utility::Matrix<4, 4> &transform) noexcept {
+  world.groupData.push_back(GroupData{});
+  WorldObject group;
+  group.shapeTag = ShapeTypeTag{ShapeType::Group, static_cast<int32_t>(world.groupData.size() - 1)};
+  group.transform = transform;
+  return addObject(world, group);
+}
+
+void addObjectToGroup(World &world, const size_t groupIndex, const size_t objectIndex) noexcept {
+  WorldObject &group = world.objects[groupIndex];
+  WorldObject &object = world.objects[objectIndex];
+  assert(group.shapeTag.type == ShapeType::Group && object.parentIndex < 0 && groupIndex != objectIndex &&
+         groupIndex <= INT16_MAX);
+  world.groupData[group.shapeTag.dataIndex].childerenIndices.push_back(static_cast<uint32_t>(objectIndex));
+  object.parentIndex = static_cast<int16_t>(groupIndex);
+  ++world.groupMemberCount;
+  // Whatever transform the object had so far was relative to the group
+  applyWorldTransform(world, object, group.transform, group.inverseTransform);
+  setBoundingBox(world, group);
+  updateGroupBounds(world, group.parentIndex);
+  // The object is no longer reached through the hierarchy itself but through its group
+  invalidateAccelerationStructure(world);
+}
+
+// Sets where the object ends up in world space. Groups are never traced, so their members get the motion instead, each
+// one ending up moved by the change of the group (on top of a motion of its own).
+static void setWorldMotion(World &world, WorldObject &object, const utility::Matrix<4, 4> &worldEndTransform) noexcept {
+  if (object.shapeTag.type == ShapeType::Group) {
+    const auto change = worldEndTransform * object.inverseTransform;
+    for (const auto memberIndex : world.groupData[object.shapeTag.dataIndex].childerenIndices) {
+      WorldObject &member = world.objects[memberIndex];
+      setWorldMotion(world, member,
+                     change * (member.motionIndex >= 0 ? world.motionData[member.motionIndex].endTransform
+                                                       : member.transform));
+    }
+  } else {
+    if (object.motionIndex < 0) {
+      world.motionData.push_back(MotionData{});
+      object.motionIndex = static_cast<int32_t>(world.motionData.size() - 1);
+    }
+    world.motionData[object.motionIndex].endTransform = worldEndTransform;
+  }
+  setBoundingBox(world, object);
+}
+
+void setObjectMotion(World &world, const size_t objectIndex, const utility::Matrix<4, 4> &endTransform) noexcept {
+  WorldObject &object = world.objects[objectIndex];
+  setWorldMotion(world, object,
+                 object.parentIndex < 0 ? endTransform : world.objects[object.parentIndex].transform * endTransform);
+  updateGroupBounds(world, object.parentIndex);
+  world.objectBVHOutdated = true;
+}
+
+WorldObject placeObjectAt(const World &world, const WorldObject &object, const float time) noexcept {
+  WorldObject placed = object;
+  if (object.motionIndex < 0) {
+    return placed;
+  }
+  const auto &endTransform = world.motionData[object.motionIndex].endTransform;
+  for (size_t i = 0; i < placed.transform.data.size(); ++i) {
+    placed.transform.data[i] = object.transform.data[i] + (endTransform.data[i] - object.transform.data[i]) * time;
+  }
+  placed.inverseTransform = inverse(placed.transform);
+  placed.motionIndex = -1;
+  return placed;
+}
+
+// Builds the hierarchy over the mesh's triangles and reorders the triangle range to match its leaves, so triangles
+// that are tested together also sit next to each other in memory
+static void buildMeshBVH(World &world, MeshData &mesh, const BVHBuildMethod method) noexcept {
+  const auto firstTriangle = world.triangleData.begin() + mesh.firstTriangleIndex;
+  std::vector<AABB> triangleBounds;
+  triangleBounds.reserve(mesh.triangleCount);
+  for (auto tri = firstTriangle; tri != firstTriangle + mesh.triangleCount; ++tri) {
+    AABB bounds(tri->v0, tri->v1);
+    bounds.expandToInclude(tri->v2);
+    triangleBounds.push_back(bounds);
+  }
+
+  mesh.bvh = buildBVH(triangleBounds, method);
+  std::vector<TriangleData> reordered;
+  reordered.reserve(mesh.triangleCount);
+  for (const auto triangleIndex : mesh.bvh.primitiveIndices) {
+    reordered.push_back(firstTriangle[triangleIndex]);
+  }
+  std::copy(reordered.begin(), reordered.end(), firstTriangle);
+  mesh.bvh.primitiveIndices = {};
+  mesh.wideBVH = collapseBVH<WIDE_BVH_WIDTH>(mesh.bvh);
+  buildTrianglePositions(mesh, world.triangleData);
+}
+
+std::optional<size_t> loadMesh(World &world, const std::string &inputFile) {
+  const auto loaded = world.meshIndexByFile.find(inputFile);
+  if (loaded != world.meshIndexByFile.end()) {
+    return loaded->second;
+  }
+
+  std::string cachePath;
+  uint64_t sourceHash = 0;
+  if (!world.meshCacheDirectory.empty()) {
+    const utility::MappedFile source(inputFile);
+    if (source.isOpen()) {
+      sourceHash = utility::fnv1aHash(source.data, source.size);
+      cachePath = meshCachePath(world.meshCacheDirectory, sourceHash);
+      if (const auto cachedIndex = loadMeshFromCache(world, cachePath, sourceHash)) {
+        world.meshIndexByFile.emplace(inputFile, static_cast<int32_t>(*cachedIndex));
+        return cachedIndex;
+      }
+    }
+  }
+
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
   std::vector<tinyobj::material_t> objMaterials;
@@ -201,12 +385,178 @@ std::optional<size_t> loadMeshFromObjFile(World &world, const std::string &input
   MeshData mesh;
   mesh.firstTriangleIndex = firstTriangleIndex;
   mesh.triangleCount = static_cast<int32_t>(world.triangleData.size()) - firstTriangleIndex;
-  world.meshData.push_back(mesh);
+  buildMeshBVH(world, mesh, world.bvhBuildMethod);
+  world.meshData.push_back(std::move(mesh));
   const int32_t meshIndex = static_cast<int32_t>(world.meshData.size() - 1);
+  world.meshIndexByFile.emplace(inputFile, meshIndex);
+  if (!cachePath.empty()) {
+    writeMeshCache(world, meshIndex, cachePath, sourceHash);
+  }
+  return meshIndex;
+}
 
+size_t addMeshInstance(World &world, const size_t meshIndex, const utility::Matrix<4, 4> &transform) noexcept {
   WorldObject object;
-  object.shapeTag = ShapeTypeTag{ShapeType::Mesh, meshIndex};
+  object.shapeTag = ShapeTypeTag{ShapeType::Mesh, static_cast<int32_t>(meshIndex)};
+  object.transform = transform;
   return addObject(world, object);
 }
 
+std::optional<size_t> loadMeshFromObjFile(World &world, const std::string &inputFile) {
+  const auto meshIndex = loadMesh(world, inputFile);
+  if (!meshIndex.has_value()) {
+    return std::nullopt;
+  }
+  return addMeshInstance(world, *meshIndex);
+}
+
+void setMeshBuildMethod(World &world, const size_t meshIndex, const BVHBuildMethod method) noexcept {
+  buildMeshBVH(world, world.meshData[meshIndex], method);
+}
+
+AABB worldBounds(const World &world, const WorldObject &object) noexcept {
+  if (object.shapeTag.type == ShapeType::Group) {
+    return object.boundingBox;
+  }
+  AABB bounds = object.boundingBox.transform(object.transform);
+  // Every point of the object moves along a straight line between its two ends, which both boxes contain
+  if (object.motionIndex >= 0) {
+    bounds.expandToInclude(object.boundingBox.transform(world.motionData[object.motionIndex].endTransform));
+  }
+  return bounds;
+}
+
+static AABB lightBounds(const PointLight &light) noexcept {
+  switch (light.shape) {
+    case LightShape::Rectangle: {
+      const auto diagonal = (light.edgeU + light.edgeV) * 0.5f;
+      const auto otherDiagonal = (light.edgeU - light.edgeV) * 0.5f;
+      AABB bounds(light.position - diagonal, light.position + diagonal);
+      bounds.expandToInclude(light.position + otherDiagonal);
+      bounds.expandToInclude(light.position - otherDiagonal);
+      return bounds;
+    }
+    case LightShape::Sphere: {
+      const auto extent = utility::Vector(light.radius, light.radius, light.radius);
+      return AABB(light.position - extent, light.position + extent);
+    }
+    default: {
+      return AABB(light.position);
+    }
+  }
+}
+
+// One light per leaf where positions allow it, the clusters are summed up bottom-up
+static void buildLightHierarchy(World &world) noexcept {
+  world.lightBVH = BVH{};
+  world.lightClusters.clear();
+  if (world.lights.empty()) {
+    return;
+  }
+  std::vector<AABB> bounds;
+  bounds.reserve(world.lights.size());
+  for (const auto &light : world.lights) {
+    bounds.push_back(lightBounds(light));
+  }
+  world.lightBVH = buildBVH(bounds, BVHBuildMethod::SAH, 1);
+
+  const auto &nodes = world.lightBVH.nodes;
+  world.lightClusters.resize(nodes.size());
+  // Children are stored after their parents, so walking the nodes backwards sums the children first
+  for (size_t i = nodes.size(); i-- > 0;) {
+    LightCluster cluster{Color(0, 0, 0), 0.0f, INFINITY};
+    const auto addUp = [&cluster](const Color &intensity, const float power, const float minAttenuation) {
+      cluster.intensity = cluster.intensity + intensity;
+      cluster.power += power;
+      cluster.minAttenuation = std::min(cluster.minAttenuation, minAttenuation);
+    };
+    if (nodes[i].isLeaf()) {
+      for (uint32_t j = nodes[i].leftOrFirst; j < nodes[i].leftOrFirst + nodes[i].count; ++j) {
+        const PointLight &light = world.lights[world.lightBVH.primitiveIndices[j]];
+        addUp(light.intensity, brightestChannel(light.intensity), light.attenuation);
+      }
+    } else {
+      for (const uint32_t child : {nodes[i].leftOrFirst, nodes[i].leftOrFirst + 1}) {
+        const LightCluster &childCluster = world.lightClusters[child];
+        addUp(childCluster.intensity, childCluster.power, childCluster.minAttenuation);
+      }
+    }
+    world.lightClusters[i] = cluster;
+  }
+}
+
+bool hasLightHierarchy(const World &world) noexcept {
+  return !world.lightClusters.empty() && world.lightBVH.primitiveIndices.size() == world.lights.size();
+}
+
+void buildAccelerationStructure(World &world) noexcept {
+  invalidateAccelerationStructure(world);
+  buildLightHierarchy(world);
+
+  // Planes extend to infinity, a box around them would swallow the whole hierarchy
+  std::vector<AABB> objectBounds;
+  std::vector<uint32_t> boundedObjects;
+  for (uint32_t i = 0; i < world.objects.size(); ++i) {
+    const WorldObject &object = world.objects[i];
+    // Members of groups are reached through their group, whose box covers them
+    if (object.parentIndex >= 0) {
+      continue;
+    }
+    if (object.boundingBox.isFinite()) {
+      objectBounds.push_back(worldBounds(world, object));
+      boundedObjects.push_back(i);
+    } else {
+      world.unboundedObjects.push_back(i);
+    }
+  }
+
+  world.objectBVH = buildBVH(objectBounds, world.bvhBuildMethod);
+  // The hierarchy indexes into objectBounds, map those entries back to object indices
+  for (auto &primitiveIndex : world.objectBVH.primitiveIndices) {
+    primitiveIndex = boundedObjects[primitiveIndex];
+  }
+  world.objectWideBVH = collapseBVH<WIDE_BVH_WIDTH>(world.objectBVH);
+  world.objectBVHBuildCost = computeSAHCost(world.objectBVH);
+  world.objectBVHOutdated = false;
+}
+
+static bool coversAllObjects(const World &world) noexcept {
+  return world.objectBVH.primitiveIndices.size() + world.unboundedObjects.size() + world.groupMemberCount ==
+             world.objects.size() &&
+         !world.objects.empty();
+}
+
+bool hasAccelerationStructure(const World &world) noexcept {
+  return coversAllObjects(world) && !world.objectBVHOutdated;
+}
+
+bool updateAccelerationStructure(World &world, const float maxCostRatio) noexcept {
+  if (!hasLightHierarchy(world)) {
+    buildLightHierarchy(world);
+  }
+  // New objects need leaves of their own, which a refit can not add
+  if (!coversAllObjects(world)) {
+    buildAccelerationStructure(world);
+    return true;
+  }
+  if (!world.objectBVHOutdated) {
+    return false;
+  }
+
+  // The object hierarchy stores object indices, so the refit looks the bounds up by object index
+  std::vector<AABB> objectBounds(world.objects.size());
+  for (const auto objectIndex : world.objectBVH.primitiveIndices) {
+    objectBounds[objectIndex] = worldBounds(world, world.objects[objectIndex]);
+  }
+  refitBVH(world.objectBVH, objectBounds);
+  world.objectBVHOutdated = false;
+
+  if (computeSAHCost(world.objectBVH) > maxCostRatio * world.objectBVHBuildCost) {
+    buildAccelerationStructure(world);
+    return true;
+  }
+  world.objectWideBVH = collapseBVH<WIDE_BVH_WIDTH>(world.objectBVH);
+  return false;
+}
+
 } // namespace raytracer::scene
@@ -37,6 +37,56 @@ struct AABB {
     return tmin < tmax;
   }
 
+  // Slab test against a precomputed reciprocal of the ray direction, as used by the hierarchy traversal.
+  // Returns the distance at which the ray enters the box, or INFINITY when the box is missed, lies behind the ray or
+  // starts beyond maxDistance. Flat boxes (e.g. around axis aligned triangles) count as hit.
+  float intersectDistance(const Tuple &origin, const Tuple &inverseDirection, const float maxDistance) const noexcept {
+    float tx1 = (min.x - origin.x) * inverseDirection.x;
+    float tx2 = (max.x - origin.x) * inverseDirection.x;
+
+    float tmin = std::min(tx1, tx2);
+    float tmax = std::max(tx1, tx2);
+
+    float ty1 = (min.y - origin.y) * inverseDirection.y;
+    float ty2 = (max.y - origin.y) * inverseDirection.y;
+
+    tmin = std::max(tmin, std::min(ty1, ty2));
+    tmax = std::min(tmax, std::max(ty1, ty2));
+
+    float tz1 = (min.z - origin.z) * inverseDirection.z;
+    float tz2 = (max.z - origin.z) * inverseDirection.z;
+
+    tmin = std::max(tmin, std::min(tz1, tz2));
+    tmax = std::min(tmax, std::max(tz1, tz2));
+
+    if (tmin > tmax || tmax < 0.0f || tmin > maxDistance) {
+      return INFINITY;
+    }
+    return tmin;
+  }
+
+  // An empty box that any expandToInclude call replaces, unlike the default constructed box which contains the origin
+  static AABB empty() noexcept {
+    AABB box;
+    box.min = Point(INFINITY, INFINITY, INFINITY);
+    box.max = Point(-INFINITY, -INFINITY, -INFINITY);
+    return box;
+  }
+
+  bool isFinite() const noexcept {
+    return std::isfinite(min.x) && std::isfinite(min.y) && std::isfinite(min.z) && std::isfinite(max.x) &&
+           std::isfinite(max.y) && std::isfinite(max.z);
+  }
+
+  Tuple centroid() const noexcept { return Point((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f); }
+
+  float surfaceArea() const noexcept {
+    const float dx = max.x - min.x;
+    const float dy = max.y - min.y;
+    const float dz = max.z - min.z;
+    return 2.0f * (dx * dy + dy * dz + dz * dx);
+  }
+
   void expandToInclude(const AABB &other) noexcept {
     min = componentWiseMin(min, other.min);
     max = componentWiseMax(max, other.max);
@@ -48,7 +98,7 @@ struct AABB {
   }
 
   AABB transform(const Matrix<4, 4> &matrix) const noexcept {
-    AABB transformedAABB;
+    AABB transformedAABB = AABB::empty();
 
     transformedAABB.expandToInclude(matrix * Point(min.x, min.y, min.z));
     transformedAABB.expandToInclude(matrix * Point(min.x, min.y, max.z));
@@ -0,0 +1,159 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "libraries/Utility/include/AABB.hpp"
+#include "libraries/Utility/include/Ray.hpp"
+
+namespace raytracer {
+namespace utility {
+
+// Traversal uses a fixed size stack, so the builder turns nodes into leaves once this depth is reached
+constexpr uint32_t MAX_BVH_DEPTH = 64;
+
+/**
+ * \brief Node of a binary bounding volume hierarchy.
+ *
+ * The right child of an interior node is always stored directly after its left child, and children are always stored
+ * after their parent.
+ */
+struct BVHNode {
+  AABB bounds;
+  uint32_t leftOrFirst = 0; ///< Index of the left child for interior nodes, first entry in primitiveIndices for leaves.
+  uint32_t count = 0;       ///< Number of primitives in a leaf, 0 for interior nodes.
+
+  bool isLeaf() const noexcept { return count != 0; }
+};
+
+/**
+ * \brief Bounding volume hierarchy over a set of primitives that are only known through their bounding boxes.
+ *
+ * The leaves reference the primitives through primitiveIndices, which holds the indices of the bounds that were
+ * passed to buildBVH, reordered so that every leaf covers a contiguous range. Owners that reorder their primitives
+ * the same way can drop primitiveIndices and use the leaf ranges directly (see traverseBVHLeaves).
+ */
+struct BVH {
+  std::vector<BVHNode> nodes;
+  std::vector<uint32_t> primitiveIndices;
+};
+
+enum class BVHBuildMethod : uint8_t {
+  SAH,   ///< Binned surface area heuristic, the fastest hierarchies to trace.
+  Linear ///< Primitives sorted along a Morton curve, builds many times faster for previews and animation.
+};
+
+/**
+ * \brief Builds a hierarchy using the surface area heuristic evaluated over a fixed number of centroid bins.
+ *
+ * \param primitiveBounds Bounding box of every primitive, all of them have to be finite.
+ * \param maxLeafSize Nodes with more primitives than this are always split when possible.
+ */
+BVH buildBVH(const std::vector<AABB> &primitiveBounds, uint32_t maxLeafSize = 4) noexcept;
+
+/**
+ * \brief Builds a linear bounding volume hierarchy (LBVH).
+ *
+ * The primitive centroids are sorted by their 63 bit Morton code and every node is split where the highest bit of
+ * the codes in its range changes, so the build costs little more than the sort. The resulting hierarchy is slower
+ * to trace than the SAH one.
+ */
+BVH buildLinearBVH(const std::vector<AABB> &primitiveBounds, uint32_t maxLeafSize = 4) noexcept;
+
+BVH buildBVH(const std::vector<AABB> &primitiveBounds, BVHBuildMethod method, uint32_t maxLeafSize = 4) noexcept;
+
+/**
+ * \brief Updates the node bounds after primitives moved, keeping the topology of the hierarchy.
+ *
+ * Runs in a single bottom-up sweep over the nodes, which is much cheaper than a rebuild but lets the hierarchy degrade
+ * as primitives drift away from the ones they were grouped with (see computeSAHCost).
+ *
+ * \param primitiveBounds The new bounds, indexed by the values stored in primitiveIndices.
+ */
+void refitBVH(BVH &bvh, const std::vector<AABB> &primitiveBounds) noexcept;
+
+// Expected cost of tracing a ray through the hierarchy according to the surface area heuristic, lower is better
+float computeSAHCost(const BVH &bvh) noexcept;
+
+/**
+ * \brief Walks the hierarchy front to back and calls visitLeaf(first, count) for every leaf hit by the ray.
+ *
+ * Boxes that start beyond maxDistance are skipped. The callback may lower maxDistance (e.g. when it found a closer
+ * hit) so the remaining nodes get culled more aggressively.
+ */
+template <typename VisitLeaf>
+void traverseBVHLeaves(const BVH &bvh, const Ray &ray, float &maxDistance, VisitLeaf &&visitLeaf) noexcept {
+  if (bvh.nodes.empty()) {
+    return;
+  }
+  const Tuple inverseDirection =
+      Vector(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+  if (bvh.nodes[0].bounds.intersectDistance(ray.origin, inverseDirection, maxDistance) == INFINITY) {
+    return;
+  }
+
+  // Far children are stored with their entry distance so they can be dropped once a closer hit is known
+  struct StackEntry {
+    uint32_t nodeIndex;
+    float distance;
+  };
+  StackEntry stack[MAX_BVH_DEPTH];
+  uint32_t stackSize = 0;
+  uint32_t nodeIndex = 0;
+  while (true) {
+    const BVHNode &node = bvh.nodes[nodeIndex];
+    if (node.isLeaf()) {
+      visitLeaf(node.leftOrFirst, node.count);
+    } else {
+      uint32_t nearChild = node.leftOrFirst;
+      uint32_t farChild = node.leftOrFirst + 1;
+      float nearDistance = bvh.nodes[nearChild].bounds.intersectDistance(ray.origin, inverseDirection, maxDistance);
+      float farDistance = bvh.nodes[farChild].bounds.intersectDistance(ray.origin, inverseDirection, maxDistance);
+      if (farDistance < nearDistance) {
+        std::swap(nearChild, farChild);
+        std::swap(nearDistance, farDistance);
+      }
+      if (nearDistance != INFINITY) {
+        if (farDistance != INFINITY) {
+          stack[stackSize++] = StackEntry{farChild, farDistance};
+        }
+        nodeIndex = nearChild;
+        continue;
+      }
+    }
+
+    bool foundNode = false;
+    while (stackSize > 0) {
+      const StackEntry &entry = stack[--stackSize];
+      if (entry.distance <= maxDistance) {
+        nodeIndex = entry.nodeIndex;
+        foundNode = true;
+        break;
+      }
+    }
+    if (!foundNode) {
+      return;
+    }
+  }
+}
+
+/**
+ * \brief Walks the hierarchy front to back and calls visitPrimitive for every primitive in a leaf hit by the ray.
+ *
+ * The callback receives the primitive index and may lower maxDistance like in traverseBVHLeaves.
+ */
+template <typename VisitPrimitive>
+void traverseBVH(const BVH &bvh, const Ray &ray, float &maxDistance, VisitPrimitive &&visitPrimitive) noexcept {
+  traverseBVHLeaves(bvh, ray, maxDistance, [&](const uint32_t first, const uint32_t count) {
+    for (uint32_t i = first; i < first + count; ++i) {
+      visitPrimitive(bvh.primitiveIndices[i]);
+    }
+  });
+}
+
+} // namespace utility
+} // namespace raytracer
+
+#endif // BVH_HPP
@@ -0,0 +1,33 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace raytracer::utility {
+
+// Finalizer that spreads every input bit over the whole hash, for jitter that is repeatable from render to render
+inline uint32_t mixBits(uint32_t hash) noexcept {
+  hash ^= hash >> 16;
+  hash *= 0x7feb352du;
+  hash ^= hash >> 15;
+  hash *= 0x846ca68bu;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+constexpr uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+constexpr uint64_t FNV_PRIME = 1099511628211ULL;
+
+// 64 bit FNV-1a, pass the previous result as hash to continue hashing over several buffers
+inline uint64_t fnv1aHash(const std::byte *data, const size_t size, uint64_t hash = FNV_OFFSET_BASIS) noexcept {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint64_t>(data[i]);
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+} // namespace raytracer::utility
+
+#endif // HASH_HPP
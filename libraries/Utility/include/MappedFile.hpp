@@ -0,0 +1,30 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <string>
+
+namespace raytracer {
+namespace utility {
+
+// A read only view of a whole file, mapped into the address space so only the pages that are touched get read
+struct MappedFile {
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+
+  // Delete copy constructor and assignment
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  // Empty files can not be mapped and count as not open
+  bool isOpen() const noexcept { return data != nullptr; }
+
+  const std::byte *data;
+  size_t size;
+  void *mapping; // Platform handle needed to unmap the view
+};
+
+} // namespace utility
+} // namespace raytracer
+
+#endif // MAPPED_FILE_HPP
@@ -8,14 +8,15 @@ namespace raytracer {
 namespace utility {
 
 struct Ray {
-  Ray(Tuple origin, Tuple direction) noexcept
-      : origin{origin}, direction{direction} {}
+  Ray(Tuple origin, Tuple direction, float time = 0.0f) noexcept
+      : origin{origin}, direction{direction}, time{time} {}
   explicit Ray() noexcept = default;
 
   Tuple position(const float time) const noexcept;
 
   Tuple origin;
   Tuple direction;
+  float time = 0.0f; ///< When in the shutter interval [0, 1] the ray is traced, decides where moving objects are.
 };
 
 } // namespace utility
@@ -0,0 +1,270 @@
+#ifndef RAY_PACKET_HPP
+#define RAY_PACKET_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "libraries/Utility/include/Ray.hpp"
+#include "libraries/Utility/include/WideBVH.hpp"
+
+namespace raytracer {
+namespace utility {
+
+// As many rays as the target can test in a single instruction
+#if defined(__AVX2__)
+constexpr uint32_t RAY_PACKET_SIZE = 8;
+#else
+constexpr uint32_t RAY_PACKET_SIZE = 4;
+#endif
+
+/**
+ * \brief Rays traced together through the same hierarchy nodes, stored in SoA form so every ray gets its own lane.
+ *
+ * Besides the rays, the packet keeps the range of their origins and inverse directions, which bounds all of them at
+ * once and lets a box be culled for the whole packet with a single test. That bound only makes sense when the rays
+ * agree on the direction sign along every axis, packets that do not are marked incoherent and should be traced one
+ * ray at a time.
+ */
+template <uint32_t Size>
+struct RayPacket {
+  alignas(32) float origin[3][Size];
+  alignas(32) float direction[3][Size];
+  alignas(32) float inverseDirection[3][Size];
+  uint32_t activeMask = 0; ///< Lanes that hold a ray, the remaining ones repeat the first ray.
+
+  float minOrigin[3];
+  float maxOrigin[3];
+  float minInverseDirection[3];
+  float maxInverseDirection[3];
+  uint32_t nearSlab[3]; ///< Shared by all rays, see WideBVHRay::nearSlab.
+  bool coherent = true;
+
+  RayPacket(const Ray *rays, const uint32_t count) noexcept {
+    activeMask = count >= 32 ? ~0u : (1u << count) - 1;
+    for (uint32_t lane = 0; lane < Size; ++lane) {
+      const Ray &ray = rays[lane < count ? lane : 0];
+      const float rayOrigin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+      const float rayDirection[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+      for (uint32_t axis = 0; axis < 3; ++axis) {
+        origin[axis][lane] = rayOrigin[axis];
+        direction[axis][lane] = rayDirection[axis];
+        inverseDirection[axis][lane] = 1.0f / rayDirection[axis];
+      }
+    }
+
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      minOrigin[axis] = maxOrigin[axis] = origin[axis][0];
+      minInverseDirection[axis] = maxInverseDirection[axis] = inverseDirection[axis][0];
+      const bool negative = std::signbit(direction[axis][0]);
+      nearSlab[axis] = negative ? axis + 3 : axis;
+      for (uint32_t lane = 0; lane < Size; ++lane) {
+        minOrigin[axis] = std::min(minOrigin[axis], origin[axis][lane]);
+        maxOrigin[axis] = std::max(maxOrigin[axis], origin[axis][lane]);
+        minInverseDirection[axis] = std::min(minInverseDirection[axis], inverseDirection[axis][lane]);
+        maxInverseDirection[axis] = std::max(maxInverseDirection[axis], inverseDirection[axis][lane]);
+        coherent = coherent && std::signbit(direction[axis][lane]) == negative &&
+                   std::isfinite(inverseDirection[axis][lane]);
+      }
+    }
+  }
+
+  Ray ray(const uint32_t lane) const noexcept {
+    return Ray(Point(origin[0][lane], origin[1][lane], origin[2][lane]),
+               Vector(direction[0][lane], direction[1][lane], direction[2][lane]));
+  }
+};
+
+/**
+ * \brief Conservative test of a whole coherent packet against every child of a node.
+ *
+ * Bounds the slab distances of all rays by interval arithmetic over the packet's origin and inverse direction ranges.
+ * Returns a bit mask of the children that some ray of the packet might hit before maxDistance.
+ */
+template <uint32_t Width, uint32_t Size>
+inline uint32_t intersectChildrenFrustum(const WideBVHNode<Width> &node, const RayPacket<Size> &packet,
+                                         const float maxDistance) noexcept {
+  uint32_t hitMask = 0;
+  for (uint32_t i = 0; i < Width; ++i) {
+    float entry = 0.0f;
+    float exit = maxDistance;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      const uint32_t nearSlab = packet.nearSlab[axis];
+      const uint32_t farSlab = nearSlab < 3 ? axis + 3 : axis;
+      const float nearLow = node.bounds[nearSlab][i] - packet.maxOrigin[axis];
+      const float nearHigh = node.bounds[nearSlab][i] - packet.minOrigin[axis];
+      const float farLow = node.bounds[farSlab][i] - packet.maxOrigin[axis];
+      const float farHigh = node.bounds[farSlab][i] - packet.minOrigin[axis];
+      const float lowInverse = packet.minInverseDirection[axis];
+      const float highInverse = packet.maxInverseDirection[axis];
+      entry = std::max(entry, std::min(std::min(nearLow * lowInverse, nearLow * highInverse),
+                                       std::min(nearHigh * lowInverse, nearHigh * highInverse)));
+      exit = std::min(exit, std::max(std::max(farLow * lowInverse, farLow * highInverse),
+                                     std::max(farHigh * lowInverse, farHigh * highInverse)));
+    }
+    hitMask |= static_cast<uint32_t>(entry <= exit) << i;
+  }
+  return hitMask;
+}
+
+#if defined(__AVX2__)
+template <>
+inline uint32_t intersectChildrenFrustum<8, 8>(const WideBVHNode<8> &node, const RayPacket<8> &packet,
+                                               const float maxDistance) noexcept {
+  __m256 entry = _mm256_setzero_ps();
+  __m256 exit = _mm256_set1_ps(maxDistance);
+  for (uint32_t axis = 0; axis < 3; ++axis) {
+    const uint32_t nearSlab = packet.nearSlab[axis];
+    const uint32_t farSlab = nearSlab < 3 ? axis + 3 : axis;
+    const __m256 minOrigin = _mm256_set1_ps(packet.minOrigin[axis]);
+    const __m256 maxOrigin = _mm256_set1_ps(packet.maxOrigin[axis]);
+    const __m256 lowInverse = _mm256_set1_ps(packet.minInverseDirection[axis]);
+    const __m256 highInverse = _mm256_set1_ps(packet.maxInverseDirection[axis]);
+    const __m256 nearBound = _mm256_load_ps(node.bounds[nearSlab]);
+    const __m256 farBound = _mm256_load_ps(node.bounds[farSlab]);
+    const __m256 nearLow = _mm256_sub_ps(nearBound, maxOrigin);
+    const __m256 nearHigh = _mm256_sub_ps(nearBound, minOrigin);
+    const __m256 farLow = _mm256_sub_ps(farBound, maxOrigin);
+    const __m256 farHigh = _mm256_sub_ps(farBound, minOrigin);
+    const __m256 nearDistance =
+        _mm256_min_ps(_mm256_min_ps(_mm256_mul_ps(nearLow, lowInverse), _mm256_mul_ps(nearLow, highInverse)),
+                      _mm256_min_ps(_mm256_mul_ps(nearHigh, lowInverse), _mm256_mul_ps(nearHigh, highInverse)));
+    const __m256 farDistance =
+        _mm256_max_ps(_mm256_max_ps(_mm256_mul_ps(farLow, lowInverse), _mm256_mul_ps(farLow, highInverse)),
+                      _mm256_max_ps(_mm256_mul_ps(farHigh, lowInverse), _mm256_mul_ps(farHigh, highInverse)));
+    entry = _mm256_max_ps(nearDistance, entry);
+    exit = _mm256_min_ps(farDistance, exit);
+  }
+  return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)));
+}
+#endif
+
+/**
+ * \brief Slab test of every ray of a coherent packet against one box.
+ *
+ * The box is given as min x, min y, min z, max x, max y, max z. Returns a bit mask of the rays that enter the box
+ * before their own maxDistance and writes the smallest entry distance among them to minEntry.
+ */
+template <uint32_t Size>
+inline uint32_t intersectPacketBox(const float *box, const RayPacket<Size> &packet, const float *maxDistances,
+                                   float &minEntry) noexcept {
+  uint32_t hitMask = 0;
+  minEntry = INFINITY;
+  for (uint32_t lane = 0; lane < Size; ++lane) {
+    float entry = 0.0f;
+    float exit = maxDistances[lane];
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      const uint32_t farSlab = packet.nearSlab[axis] < 3 ? axis + 3 : axis;
+      entry = std::max(entry, (box[packet.nearSlab[axis]] - packet.origin[axis][lane]) *
+                                  packet.inverseDirection[axis][lane]);
+      exit = std::min(exit, (box[farSlab] - packet.origin[axis][lane]) * packet.inverseDirection[axis][lane]);
+    }
+    if (entry <= exit) {
+      hitMask |= 1u << lane;
+      minEntry = std::min(minEntry, entry);
+    }
+  }
+  return hitMask;
+}
+
+#if defined(__AVX2__)
+template <>
+inline uint32_t intersectPacketBox<8>(const float *box, const RayPacket<8> &packet, const float *maxDistances,
+                                      float &minEntry) noexcept {
+  __m256 entry = _mm256_setzero_ps();
+  __m256 exit = _mm256_loadu_ps(maxDistances);
+  for (uint32_t axis = 0; axis < 3; ++axis) {
+    const uint32_t farSlab = packet.nearSlab[axis] < 3 ? axis + 3 : axis;
+    const __m256 origin = _mm256_load_ps(packet.origin[axis]);
+    const __m256 inverseDirection = _mm256_load_ps(packet.inverseDirection[axis]);
+    const __m256 nearDistance =
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box[packet.nearSlab[axis]]), origin), inverseDirection);
+    const __m256 farDistance = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(box[farSlab]), origin), inverseDirection);
+    entry = _mm256_max_ps(nearDistance, entry);
+    exit = _mm256_min_ps(farDistance, exit);
+  }
+  const __m256 hit = _mm256_cmp_ps(entry, exit, _CMP_LE_OQ);
+  // Lanes that miss get an infinite entry, then the minimum is reduced across the register
+  __m256 entries = _mm256_blendv_ps(_mm256_set1_ps(INFINITY), entry, hit);
+  entries = _mm256_min_ps(entries, _mm256_permute2f128_ps(entries, entries, 1));
+  entries = _mm256_min_ps(entries, _mm256_shuffle_ps(entries, entries, _MM_SHUFFLE(1, 0, 3, 2)));
+  entries = _mm256_min_ps(entries, _mm256_shuffle_ps(entries, entries, _MM_SHUFFLE(2, 3, 0, 1)));
+  minEntry = _mm256_cvtss_f32(entries);
+  return static_cast<uint32_t>(_mm256_movemask_ps(hit));
+}
+#endif
+
+/**
+ * \brief Packet version of traverseWideBVHLeaves for coherent packets.
+ *
+ * Calls visitLeaf(first, count, rayMask) for every leaf hit by at least one ray, rayMask holding the rays that enter
+ * it. Every ray has its own maxDistance, which the callback may lower. Nodes are culled for the whole packet with the
+ * frustum test before the rays are tested one lane each.
+ */
+template <uint32_t Width, uint32_t Size, typename VisitLeaf>
+void traverseWideBVHLeaves(const WideBVH<Width> &bvh, const RayPacket<Size> &packet, float *maxDistances,
+                           VisitLeaf &&visitLeaf) noexcept {
+  if (bvh.nodes.empty()) {
+    if (bvh.rootLeafCount > 0) {
+      visitLeaf(0u, bvh.rootLeafCount, packet.activeMask);
+    }
+    return;
+  }
+
+  struct StackEntry {
+    uint32_t child;
+    uint32_t count;
+    uint32_t rayMask;
+    float distance;
+  };
+  StackEntry stack[MAX_BVH_DEPTH * (Width - 1) + 1];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = StackEntry{0, 0, packet.activeMask, 0.0f};
+
+  while (stackSize > 0) {
+    const StackEntry entry = stack[--stackSize];
+    float packetMaxDistance = -INFINITY;
+    for (uint32_t mask = entry.rayMask; mask != 0; mask &= mask - 1) {
+      packetMaxDistance = std::max(packetMaxDistance, maxDistances[__builtin_ctz(mask)]);
+    }
+    if (entry.distance > packetMaxDistance) {
+      continue;
+    }
+    if (entry.count > 0) {
+      visitLeaf(entry.child, entry.count, entry.rayMask);
+      continue;
+    }
+
+    const WideBVHNode<Width> &node = bvh.nodes[entry.child];
+    uint32_t candidates = intersectChildrenFrustum<Width, Size>(node, packet, packetMaxDistance);
+
+    const uint32_t firstPushed = stackSize;
+    while (candidates != 0) {
+      const uint32_t i = static_cast<uint32_t>(__builtin_ctz(candidates));
+      candidates &= candidates - 1;
+      const float box[6] = {node.bounds[0][i], node.bounds[1][i], node.bounds[2][i],
+                            node.bounds[3][i], node.bounds[4][i], node.bounds[5][i]};
+      float minEntry;
+      const uint32_t rayMask = intersectPacketBox<Size>(box, packet, maxDistances, minEntry) & entry.rayMask;
+      if (rayMask == 0) {
+        continue;
+      }
+      const StackEntry childEntry{node.child[i], node.count[i], rayMask, minEntry};
+      uint32_t position = stackSize++;
+      while (position > firstPushed && stack[position - 1].distance < childEntry.distance) {
+        stack[position] = stack[position - 1];
+        --position;
+      }
+      stack[position] = childEntry;
+    }
+  }
+}
+
+} // namespace utility
+} // namespace raytracer
+
+#endif // RAY_PACKET_HPP
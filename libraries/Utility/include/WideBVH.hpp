@@ -0,0 +1,205 @@
+#ifndef WIDE_BVH_HPP
+#define WIDE_BVH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "libraries/Utility/include/BVH.hpp"
+#include "libraries/Utility/include/Ray.hpp"
+
+namespace raytracer {
+namespace utility {
+
+// The widest node layout the target can test in a single instruction per slab
+#if defined(__AVX2__)
+constexpr uint32_t WIDE_BVH_WIDTH = 8;
+#else
+constexpr uint32_t WIDE_BVH_WIDTH = 4;
+#endif
+
+/**
+ * \brief Node of a wide bounding volume hierarchy, holding the bounds of all its children in SoA form.
+ *
+ * Leaves are not nodes of their own, a child slot either references an interior node or directly holds a leaf range.
+ * Unused slots have inverted (empty) bounds, which no ray can enter.
+ */
+template <uint32_t Width>
+struct alignas(32) WideBVHNode {
+  float bounds[6][Width]; ///< min x, min y, min z, max x, max y, max z of every child.
+  uint32_t child[Width];  ///< Index of the child node for interior children, first primitive for leaf children.
+  uint32_t count[Width];  ///< Number of primitives for leaf children, 0 for interior children.
+};
+
+/**
+ * \brief A binary BVH collapsed into nodes with up to Width children, so a single node visit tests them all.
+ *
+ * Primitives are referenced through the same leaf ranges as in the binary hierarchy it was collapsed from, so
+ * primitiveIndices (when present) of the binary hierarchy still applies.
+ */
+template <uint32_t Width>
+struct WideBVH {
+  std::vector<WideBVHNode<Width>> nodes;
+  uint32_t rootLeafCount = 0; ///< Set instead of any nodes when the binary hierarchy is a single leaf.
+};
+
+/**
+ * \brief Collapses a binary hierarchy into a wide one.
+ *
+ * Every wide node pulls in the children of the largest interior nodes below it (by surface area) until it has Width
+ * children, which keeps the expected number of box tests per ray low. Refitting the binary hierarchy requires
+ * collapsing it again.
+ */
+template <uint32_t Width>
+WideBVH<Width> collapseBVH(const BVH &bvh) noexcept;
+
+// Ray data shared by all node visits, with the slab each axis enters the box through selected by the direction sign
+struct WideBVHRay {
+  float origin[3];
+  float inverseDirection[3];
+  uint32_t nearSlab[3]; ///< Index into WideBVHNode::bounds of the slab a ray enters through on each axis.
+
+  explicit WideBVHRay(const Ray &ray) noexcept {
+    const float direction[3] = {ray.direction.x, ray.direction.y, ray.direction.z};
+    const float rayOrigin[3] = {ray.origin.x, ray.origin.y, ray.origin.z};
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      origin[axis] = rayOrigin[axis];
+      inverseDirection[axis] = 1.0f / direction[axis];
+      nearSlab[axis] = std::signbit(direction[axis]) ? axis + 3 : axis;
+    }
+  }
+};
+
+/**
+ * \brief Slab test of the ray against every child of a node.
+ *
+ * Writes the entry distance of every child and returns a bit mask of the children that are hit before maxDistance.
+ * Because the near slab is picked from the direction sign, empty slots (min > max) always come out as missed.
+ */
+template <uint32_t Width>
+inline uint32_t intersectChildren(const WideBVHNode<Width> &node, const WideBVHRay &ray, const float maxDistance,
+                                  float *distances) noexcept {
+  uint32_t hitMask = 0;
+  for (uint32_t i = 0; i < Width; ++i) {
+    float entry = 0.0f;
+    float exit = maxDistance;
+    for (uint32_t axis = 0; axis < 3; ++axis) {
+      const uint32_t farSlab = ray.nearSlab[axis] < 3 ? axis + 3 : axis;
+      entry = std::max(entry, (node.bounds[ray.nearSlab[axis]][i] - ray.origin[axis]) * ray.inverseDirection[axis]);
+      exit = std::min(exit, (node.bounds[farSlab][i] - ray.origin[axis]) * ray.inverseDirection[axis]);
+    }
+    distances[i] = entry;
+    hitMask |= static_cast<uint32_t>(entry <= exit) << i;
+  }
+  return hitMask;
+}
+
+#if defined(__SSE2__)
+template <>
+inline uint32_t intersectChildren<4>(const WideBVHNode<4> &node, const WideBVHRay &ray, const float maxDistance,
+                                     float *distances) noexcept {
+  __m128 entry = _mm_setzero_ps();
+  __m128 exit = _mm_set1_ps(maxDistance);
+  for (uint32_t axis = 0; axis < 3; ++axis) {
+    const uint32_t farSlab = ray.nearSlab[axis] < 3 ? axis + 3 : axis;
+    const __m128 origin = _mm_set1_ps(ray.origin[axis]);
+    const __m128 inverseDirection = _mm_set1_ps(ray.inverseDirection[axis]);
+    const __m128 nearDistance =
+        _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[ray.nearSlab[axis]]), origin), inverseDirection);
+    const __m128 farDistance = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[farSlab]), origin), inverseDirection);
+    // The slab distance goes first so a NaN (origin on a slab of a flat box) keeps the current value
+    entry = _mm_max_ps(nearDistance, entry);
+    exit = _mm_min_ps(farDistance, exit);
+  }
+  _mm_storeu_ps(distances, entry);
+  return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(entry, exit)));
+}
+#endif
+
+#if defined(__AVX2__)
+template <>
+inline uint32_t intersectChildren<8>(const WideBVHNode<8> &node, const WideBVHRay &ray, const float maxDistance,
+                                     float *distances) noexcept {
+  __m256 entry = _mm256_setzero_ps();
+  __m256 exit = _mm256_set1_ps(maxDistance);
+  for (uint32_t axis = 0; axis < 3; ++axis) {
+    const uint32_t farSlab = ray.nearSlab[axis] < 3 ? axis + 3 : axis;
+    const __m256 origin = _mm256_set1_ps(ray.origin[axis]);
+    const __m256 inverseDirection = _mm256_set1_ps(ray.inverseDirection[axis]);
+    const __m256 nearDistance =
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[ray.nearSlab[axis]]), origin), inverseDirection);
+    const __m256 farDistance =
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[farSlab]), origin), inverseDirection);
+    entry = _mm256_max_ps(nearDistance, entry);
+    exit = _mm256_min_ps(farDistance, exit);
+  }
+  _mm256_storeu_ps(distances, entry);
+  return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(entry, exit, _CMP_LE_OQ)));
+}
+#endif
+
+/**
+ * \brief Walks the wide hierarchy and calls visitLeaf(first, count) for every leaf hit by the ray, nearest first.
+ *
+ * Same contract as traverseBVHLeaves: boxes entered beyond maxDistance are skipped and the callback may lower it.
+ */
+template <uint32_t Width, typename VisitLeaf>
+void traverseWideBVHLeaves(const WideBVH<Width> &bvh, const Ray &ray, float &maxDistance,
+                           VisitLeaf &&visitLeaf) noexcept {
+  if (bvh.nodes.empty()) {
+    if (bvh.rootLeafCount > 0) {
+      visitLeaf(0u, bvh.rootLeafCount);
+    }
+    return;
+  }
+
+  // Every visited node pushes at most Width - 1 entries beyond the one it replaces
+  struct StackEntry {
+    uint32_t child;
+    uint32_t count;
+    float distance;
+  };
+  StackEntry stack[MAX_BVH_DEPTH * (Width - 1) + 1];
+  uint32_t stackSize = 0;
+  stack[stackSize++] = StackEntry{0, 0, 0.0f};
+
+  const WideBVHRay wideRay(ray);
+  alignas(32) float distances[Width];
+  while (stackSize > 0) {
+    const StackEntry entry = stack[--stackSize];
+    if (entry.distance > maxDistance) {
+      continue;
+    }
+    if (entry.count > 0) {
+      visitLeaf(entry.child, entry.count);
+      continue;
+    }
+
+    const WideBVHNode<Width> &node = bvh.nodes[entry.child];
+    uint32_t hitMask = intersectChildren<Width>(node, wideRay, maxDistance, distances);
+
+    // Push the hit children sorted far to near, so the nearest one is popped first
+    const uint32_t firstPushed = stackSize;
+    while (hitMask != 0) {
+      const uint32_t i = static_cast<uint32_t>(__builtin_ctz(hitMask));
+      hitMask &= hitMask - 1;
+      const StackEntry childEntry{node.child[i], node.count[i], distances[i]};
+      uint32_t position = stackSize++;
+      while (position > firstPushed && stack[position - 1].distance < childEntry.distance) {
+        stack[position] = stack[position - 1];
+        --position;
+      }
+      stack[position] = childEntry;
+    }
+  }
+}
+
+} // namespace utility
+} // namespace raytracer
+
+#endif // WIDE_BVH_HPP
@@ -0,0 +1,484 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <numeric>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+#include <tbb/parallel_reduce.h>
+
+#include "libraries/Utility/include/BVH.hpp"
+
+namespace raytracer {
+namespace utility {
+
+// Relative costs used by the surface area heuristic
+constexpr float TRAVERSAL_COST = 1.0f;
+constexpr float INTERSECTION_COST = 1.0f;
+constexpr uint32_t BIN_COUNT = 16;
+
+// Below these sizes the overhead of spawning tasks outweighs the work, so the builder stays on the current thread
+constexpr uint32_t PARALLEL_BINNING_THRESHOLD = 16384; // Primitives in a node before its passes are split into tasks
+constexpr uint32_t PARALLEL_SUBTREE_THRESHOLD = 4096;  // Primitives in a node before its children are built in parallel
+constexpr uint32_t PARALLEL_GRAIN_SIZE = 4096;
+
+// The linear builder quantizes centroids to 21 bits per axis, interleaved into a 63 bit Morton code
+constexpr uint32_t MORTON_BITS_PER_AXIS = 21;
+constexpr uint32_t RADIX_BITS = 8;
+constexpr uint32_t RADIX_BUCKETS = 1u << RADIX_BITS;
+
+namespace {
+
+struct Bin {
+  AABB bounds = AABB::empty();
+  uint32_t count = 0;
+};
+
+struct Split {
+  int axis = -1;
+  uint32_t binIndex = 0; ///< Primitives in bins up to and including this one go to the left child.
+  float cost = INFINITY;
+};
+
+struct RangeBounds {
+  AABB bounds = AABB::empty();
+  AABB centroidBounds = AABB::empty();
+
+  void merge(const RangeBounds &other) noexcept {
+    bounds.expandToInclude(other.bounds);
+    centroidBounds.expandToInclude(other.centroidBounds);
+  }
+};
+
+// Bins along all three axes, filled in a single pass over the primitives
+struct AxisBins {
+  std::array<std::array<Bin, BIN_COUNT>, 3> bins{};
+
+  void merge(const AxisBins &other) noexcept {
+    for (int axis = 0; axis < 3; ++axis) {
+      for (uint32_t i = 0; i < BIN_COUNT; ++i) {
+        bins[axis][i].bounds.expandToInclude(other.bins[axis][i].bounds);
+        bins[axis][i].count += other.bins[axis][i].count;
+      }
+    }
+  }
+};
+
+// Runs accumulate(result, begin, end) over the primitive range, splitting it across tasks when it is large enough
+template <typename Result, typename Accumulate>
+Result reduceRange(const uint32_t first, const uint32_t count, Accumulate &&accumulate) noexcept {
+  if (count < PARALLEL_BINNING_THRESHOLD) {
+    Result result;
+    accumulate(result, first, first + count);
+    return result;
+  }
+  return tbb::parallel_reduce(
+      tbb::blocked_range<uint32_t>(first, first + count, PARALLEL_GRAIN_SIZE), Result{},
+      [&](const tbb::blocked_range<uint32_t> &range, Result result) {
+        accumulate(result, range.begin(), range.end());
+        return result;
+      },
+      [](Result lhs, const Result &rhs) {
+        lhs.merge(rhs);
+        return lhs;
+      });
+}
+
+struct BVHBuilder {
+  const std::vector<AABB> &primitiveBounds;
+  std::vector<Tuple> centroids;
+  uint32_t maxLeafSize;
+  BVH bvh;
+  // The nodes are allocated up front, tasks claim pairs of sibling nodes from this counter
+  std::atomic<uint32_t> nodeCount{1};
+
+  float centroidAxis(const uint32_t primitiveIndex, const int axis) const noexcept {
+    return (&centroids[primitiveIndex].x)[axis];
+  }
+
+  static uint32_t binIndex(const float centroid, const float axisMin, const float binsPerUnit) noexcept {
+    const auto index = static_cast<uint32_t>((centroid - axisMin) * binsPerUnit);
+    return std::min(index, BIN_COUNT - 1);
+  }
+
+  Split findBestSplit(const uint32_t first, const uint32_t count, const AABB &centroidBounds) const noexcept {
+    std::array<float, 3> axisMin{};
+    std::array<float, 3> binsPerUnit{};
+    for (int axis = 0; axis < 3; ++axis) {
+      axisMin[axis] = (&centroidBounds.min.x)[axis];
+      const float axisExtent = (&centroidBounds.max.x)[axis] - axisMin[axis];
+      binsPerUnit[axis] = axisExtent > 0.0f ? BIN_COUNT / axisExtent : 0.0f;
+    }
+
+    const AxisBins axisBins = reduceRange<AxisBins>(first, count, [&](AxisBins &result, uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        const uint32_t primitive = bvh.primitiveIndices[i];
+        for (int axis = 0; axis < 3; ++axis) {
+          Bin &bin = result.bins[axis][binIndex(centroidAxis(primitive, axis), axisMin[axis], binsPerUnit[axis])];
+          bin.bounds.expandToInclude(primitiveBounds[primitive]);
+          bin.count++;
+        }
+      }
+    });
+
+    Split best;
+    for (int axis = 0; axis < 3; ++axis) {
+      if (binsPerUnit[axis] == 0.0f) {
+        continue;
+      }
+      const auto &bins = axisBins.bins[axis];
+
+      // Sweep from the right to get the cost of every right side, then from the left to evaluate each plane
+      std::array<float, BIN_COUNT - 1> rightAreaTimesCount{};
+      AABB rightBounds = AABB::empty();
+      uint32_t rightCount = 0;
+      for (uint32_t i = BIN_COUNT - 1; i > 0; --i) {
+        rightBounds.expandToInclude(bins[i].bounds);
+        rightCount += bins[i].count;
+        rightAreaTimesCount[i - 1] = rightCount == 0 ? 0.0f : rightBounds.surfaceArea() * rightCount;
+      }
+
+      AABB leftBounds = AABB::empty();
+      uint32_t leftCount = 0;
+      for (uint32_t i = 0; i < BIN_COUNT - 1; ++i) {
+        leftBounds.expandToInclude(bins[i].bounds);
+        leftCount += bins[i].count;
+        if (leftCount == 0 || leftCount == count) {
+          continue;
+        }
+        const float cost = leftBounds.surfaceArea() * leftCount + rightAreaTimesCount[i];
+        if (cost < best.cost) {
+          best = Split{axis, i, cost};
+        }
+      }
+    }
+    return best;
+  }
+
+  void subdivide(const uint32_t nodeIndex, const uint32_t depth) noexcept {
+    const uint32_t first = bvh.nodes[nodeIndex].leftOrFirst;
+    const uint32_t count = bvh.nodes[nodeIndex].count;
+
+    const RangeBounds rangeBounds =
+        reduceRange<RangeBounds>(first, count, [&](RangeBounds &result, uint32_t begin, uint32_t end) {
+          for (uint32_t i = begin; i < end; ++i) {
+            result.bounds.expandToInclude(primitiveBounds[bvh.primitiveIndices[i]]);
+            result.centroidBounds.expandToInclude(centroids[bvh.primitiveIndices[i]]);
+          }
+        });
+    bvh.nodes[nodeIndex].bounds = rangeBounds.bounds;
+
+    if (count == 1 || depth + 1 >= MAX_BVH_DEPTH) {
+      return;
+    }
+
+    const Split split = findBestSplit(first, count, rangeBounds.centroidBounds);
+    if (split.axis == -1) {
+      return; // All centroids coincide, there is nothing to separate
+    }
+    const float parentArea = rangeBounds.bounds.surfaceArea();
+    const float leafCost = INTERSECTION_COST * count;
+    const float splitCost =
+        parentArea > 0.0f ? TRAVERSAL_COST + INTERSECTION_COST * split.cost / parentArea : TRAVERSAL_COST + leafCost;
+    if (count <= maxLeafSize && splitCost >= leafCost) {
+      return;
+    }
+
+    const float axisMin = (&rangeBounds.centroidBounds.min.x)[split.axis];
+    const float binsPerUnit = BIN_COUNT / ((&rangeBounds.centroidBounds.max.x)[split.axis] - axisMin);
+    const auto middle = std::partition(
+        bvh.primitiveIndices.begin() + first, bvh.primitiveIndices.begin() + first + count,
+        [&](const uint32_t primitive) {
+          return binIndex(centroidAxis(primitive, split.axis), axisMin, binsPerUnit) <= split.binIndex;
+        });
+    const auto leftCount = static_cast<uint32_t>(middle - (bvh.primitiveIndices.begin() + first));
+
+    const uint32_t leftChild = nodeCount.fetch_add(2, std::memory_order_relaxed);
+    bvh.nodes[leftChild] = BVHNode{AABB{}, first, leftCount};
+    bvh.nodes[leftChild + 1] = BVHNode{AABB{}, first + leftCount, count - leftCount};
+    bvh.nodes[nodeIndex].leftOrFirst = leftChild;
+    bvh.nodes[nodeIndex].count = 0;
+
+    // The children own disjoint ranges of primitiveIndices and nodes, so they can be built concurrently
+    if (count >= PARALLEL_SUBTREE_THRESHOLD) {
+      tbb::parallel_invoke([&] { subdivide(leftChild, depth + 1); }, [&] { subdivide(leftChild + 1, depth + 1); });
+    } else {
+      subdivide(leftChild, depth + 1);
+      subdivide(leftChild + 1, depth + 1);
+    }
+  }
+};
+
+
+// Spreads the lowest 21 bits of value so that there are two zero bits between each of them
+uint64_t expandBits(uint64_t value) noexcept {
+  value &= 0x1fffff;
+  value = (value | value << 32) & 0x1f00000000ffff;
+  value = (value | value << 16) & 0x1f0000ff0000ff;
+  value = (value | value << 8) & 0x100f00f00f00f00f;
+  value = (value | value << 4) & 0x10c30c30c30c30c3;
+  value = (value | value << 2) & 0x1249249249249249;
+  return value;
+}
+
+uint64_t mortonCode(const Tuple &centroid, const AABB &centroidBounds) noexcept {
+  constexpr float scale = static_cast<float>((1u << MORTON_BITS_PER_AXIS) - 1);
+  const auto quantize = [&](const float value, const float axisMin, const float axisMax) {
+    const float extent = axisMax - axisMin;
+    return static_cast<uint64_t>(extent > 0.0f ? std::clamp((value - axisMin) / extent, 0.0f, 1.0f) * scale : 0.0f);
+  };
+  return expandBits(quantize(centroid.x, centroidBounds.min.x, centroidBounds.max.x)) << 2 |
+         expandBits(quantize(centroid.y, centroidBounds.min.y, centroidBounds.max.y)) << 1 |
+         expandBits(quantize(centroid.z, centroidBounds.min.z, centroidBounds.max.z));
+}
+
+struct CodeBits {
+  uint64_t anySet = 0;
+  uint64_t allSet = ~uint64_t{0};
+
+  void merge(const CodeBits &other) noexcept {
+    anySet |= other.anySet;
+    allSet &= other.allSet;
+  }
+};
+
+// Least significant digit radix sort of the codes together with the primitive indices. Every pass counts the digits
+// of fixed size blocks in parallel, turns the counts into per block offsets and scatters the blocks in parallel,
+// which keeps the sort stable. Digits that are the same for every code are skipped.
+void radixSort(std::vector<uint64_t> &codes, std::vector<uint32_t> &indices) noexcept {
+  const auto count = static_cast<uint32_t>(codes.size());
+  const CodeBits codeBits = reduceRange<CodeBits>(0, count, [&](CodeBits &result, uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      result.anySet |= codes[i];
+      result.allSet &= codes[i];
+    }
+  });
+  const uint64_t varyingBits = codeBits.anySet & ~codeBits.allSet;
+
+  const uint32_t blockCount = (count + PARALLEL_GRAIN_SIZE - 1) / PARALLEL_GRAIN_SIZE;
+  std::vector<std::array<uint32_t, RADIX_BUCKETS>> blockOffsets(blockCount);
+  std::vector<uint64_t> codesOut(count);
+  std::vector<uint32_t> indicesOut(count);
+  const auto forEachBlock = [&](auto &&visitBlock) {
+    tbb::parallel_for(uint32_t{0}, blockCount, [&](const uint32_t block) {
+      visitBlock(block, block * PARALLEL_GRAIN_SIZE, std::min(count, (block + 1) * PARALLEL_GRAIN_SIZE));
+    });
+  };
+
+  for (uint32_t shift = 0; shift < 64; shift += RADIX_BITS) {
+    if (((varyingBits >> shift) & (RADIX_BUCKETS - 1)) == 0) {
+      continue;
+    }
+    forEachBlock([&](const uint32_t block, const uint32_t begin, const uint32_t end) {
+      blockOffsets[block].fill(0);
+      for (uint32_t i = begin; i < end; ++i) {
+        blockOffsets[block][(codes[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+      }
+    });
+
+    uint32_t offset = 0;
+    for (uint32_t digit = 0; digit < RADIX_BUCKETS; ++digit) {
+      for (uint32_t block = 0; block < blockCount; ++block) {
+        const uint32_t digitCount = blockOffsets[block][digit];
+        blockOffsets[block][digit] = offset;
+        offset += digitCount;
+      }
+    }
+
+    forEachBlock([&](const uint32_t block, const uint32_t begin, const uint32_t end) {
+      auto &offsets = blockOffsets[block];
+      for (uint32_t i = begin; i < end; ++i) {
+        const uint32_t destination = offsets[(codes[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        codesOut[destination] = codes[i];
+        indicesOut[destination] = indices[i];
+      }
+    });
+    codes.swap(codesOut);
+    indices.swap(indicesOut);
+  }
+}
+
+struct LinearBVHBuilder {
+  const std::vector<AABB> &primitiveBounds;
+  std::vector<uint64_t> codes; ///< Sorted Morton codes, parallel to bvh.primitiveIndices.
+  uint32_t maxLeafSize;
+  BVH bvh;
+  std::atomic<uint32_t> nodeCount{1};
+
+  // Splits at the highest bit in which the codes of the range differ, every code before the split has it cleared
+  uint32_t findSplit(const uint32_t first, const uint32_t count) const noexcept {
+    const uint64_t differingBits = codes[first] ^ codes[first + count - 1];
+    if (differingBits == 0) {
+      return first + count / 2; // Identical codes, fall back to halving the range
+    }
+    const uint64_t splitBit = uint64_t{1} << (63 - std::countl_zero(differingBits));
+    const auto split = std::partition_point(codes.begin() + first, codes.begin() + first + count,
+                                            [&](const uint64_t code) { return (code & splitBit) == 0; });
+    return static_cast<uint32_t>(split - codes.begin());
+  }
+
+  // Bounds are computed on the way back up, so every node is visited once
+  void subdivide(const uint32_t nodeIndex, const uint32_t first, const uint32_t count, const uint32_t depth) noexcept {
+    BVHNode &node = bvh.nodes[nodeIndex];
+    if (count <= maxLeafSize || depth + 1 >= MAX_BVH_DEPTH) {
+      node = BVHNode{AABB::empty(), first, count};
+      for (uint32_t i = first; i < first + count; ++i) {
+        node.bounds.expandToInclude(primitiveBounds[bvh.primitiveIndices[i]]);
+      }
+      return;
+    }
+
+    const uint32_t split = findSplit(first, count);
+    const uint32_t leftChild = nodeCount.fetch_add(2, std::memory_order_relaxed);
+    if (count >= PARALLEL_SUBTREE_THRESHOLD) {
+      tbb::parallel_invoke([&] { subdivide(leftChild, first, split - first, depth + 1); },
+                           [&] { subdivide(leftChild + 1, split, first + count - split, depth + 1); });
+    } else {
+      subdivide(leftChild, first, split - first, depth + 1);
+      subdivide(leftChild + 1, split, first + count - split, depth + 1);
+    }
+
+    node.bounds = bvh.nodes[leftChild].bounds;
+    node.bounds.expandToInclude(bvh.nodes[leftChild + 1].bounds);
+    node.leftOrFirst = leftChild;
+    node.count = 0;
+  }
+};
+
+// The counter hands out node indices in the order the tasks happen to run in. Lays the nodes out again the way a
+// serial build numbers them, children pairs in the pre-order of their parents, so the same input always gives the
+// same nodes however the build was scheduled.
+void renumberInBuildOrder(BVH &bvh) noexcept {
+  std::vector<BVHNode> ordered(bvh.nodes.size());
+  ordered[0] = bvh.nodes[0];
+  uint32_t nextIndex = 1;
+  std::vector<uint32_t> stack{0};
+  while (!stack.empty()) {
+    BVHNode &node = ordered[stack.back()];
+    stack.pop_back();
+    if (node.isLeaf()) {
+      continue;
+    }
+    ordered[nextIndex] = bvh.nodes[node.leftOrFirst];
+    ordered[nextIndex + 1] = bvh.nodes[node.leftOrFirst + 1];
+    node.leftOrFirst = nextIndex;
+    nextIndex += 2;
+    stack.push_back(node.leftOrFirst + 1);
+    stack.push_back(node.leftOrFirst);
+  }
+  bvh.nodes = std::move(ordered);
+}
+
+} // namespace
+
+BVH buildBVH(const std::vector<AABB> &primitiveBounds, const uint32_t maxLeafSize) noexcept {
+  BVHBuilder builder{primitiveBounds, {}, std::max(maxLeafSize, 1u), {}};
+  if (primitiveBounds.empty()) {
+    return {};
+  }
+
+  const auto primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+  builder.centroids.resize(primitiveCount);
+  builder.bvh.primitiveIndices.resize(primitiveCount);
+  tbb::parallel_for(tbb::blocked_range<uint32_t>(0, primitiveCount, PARALLEL_GRAIN_SIZE),
+                    [&](const tbb::blocked_range<uint32_t> &range) {
+                      for (uint32_t i = range.begin(); i < range.end(); ++i) {
+                        builder.centroids[i] = primitiveBounds[i].centroid();
+                        builder.bvh.primitiveIndices[i] = i;
+                      }
+                    });
+
+  // A binary tree with n leaves has at most 2n - 1 nodes
+  builder.bvh.nodes.resize(2 * primitiveCount - 1);
+  builder.bvh.nodes[0] = BVHNode{AABB{}, 0, primitiveCount};
+  builder.subdivide(0, 0);
+  builder.bvh.nodes.resize(builder.nodeCount.load());
+  if (primitiveCount >= PARALLEL_SUBTREE_THRESHOLD) {
+    renumberInBuildOrder(builder.bvh);
+  }
+
+  return std::move(builder.bvh);
+}
+
+BVH buildLinearBVH(const std::vector<AABB> &primitiveBounds, const uint32_t maxLeafSize) noexcept {
+  LinearBVHBuilder builder{primitiveBounds, {}, std::max(maxLeafSize, 1u), {}};
+  if (primitiveBounds.empty()) {
+    return {};
+  }
+
+  const auto primitiveCount = static_cast<uint32_t>(primitiveBounds.size());
+  const AABB centroidBounds =
+      reduceRange<RangeBounds>(0, primitiveCount, [&](RangeBounds &result, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+          result.centroidBounds.expandToInclude(primitiveBounds[i].centroid());
+        }
+      }).centroidBounds;
+
+  builder.codes.resize(primitiveCount);
+  builder.bvh.primitiveIndices.resize(primitiveCount);
+  tbb::parallel_for(tbb::blocked_range<uint32_t>(0, primitiveCount, PARALLEL_GRAIN_SIZE),
+                    [&](const tbb::blocked_range<uint32_t> &range) {
+                      for (uint32_t i = range.begin(); i < range.end(); ++i) {
+                        builder.codes[i] = mortonCode(primitiveBounds[i].centroid(), centroidBounds);
+                        builder.bvh.primitiveIndices[i] = i;
+                      }
+                    });
+  radixSort(builder.codes, builder.bvh.primitiveIndices);
+
+  builder.bvh.nodes.resize(2 * primitiveCount - 1);
+  builder.subdivide(0, 0, primitiveCount, 0);
+  builder.bvh.nodes.resize(builder.nodeCount.load());
+  if (primitiveCount >= PARALLEL_SUBTREE_THRESHOLD) {
+    renumberInBuildOrder(builder.bvh);
+  }
+
+  return std::move(builder.bvh);
+}
+
+BVH buildBVH(const std::vector<AABB> &primitiveBounds, const BVHBuildMethod method,
+             const uint32_t maxLeafSize) noexcept {
+  switch (method) {
+  case BVHBuildMethod::SAH:
+    return buildBVH(primitiveBounds, maxLeafSize);
+  case BVHBuildMethod::Linear:
+    return buildLinearBVH(primitiveBounds, maxLeafSize);
+  }
+  return {};
+}
+
+void refitBVH(BVH &bvh, const std::vector<AABB> &primitiveBounds) noexcept {
+  // Children are stored after their parent, so a reverse sweep updates every child before its parent
+  for (auto node = bvh.nodes.rbegin(); node != bvh.nodes.rend(); ++node) {
+    if (node->isLeaf()) {
+      node->bounds = AABB::empty();
+      for (uint32_t i = node->leftOrFirst; i < node->leftOrFirst + node->count; ++i) {
+        node->bounds.expandToInclude(primitiveBounds[bvh.primitiveIndices[i]]);
+      }
+    } else {
+      node->bounds = bvh.nodes[node->leftOrFirst].bounds;
+      node->bounds.expandToInclude(bvh.nodes[node->leftOrFirst + 1].bounds);
+    }
+  }
+}
+
+float computeSAHCost(const BVH &bvh) noexcept {
+  if (bvh.nodes.empty()) {
+    return 0.0f;
+  }
+  const float rootArea = bvh.nodes[0].bounds.surfaceArea();
+  if (rootArea <= 0.0f) {
+    return TRAVERSAL_COST + INTERSECTION_COST * bvh.nodes[0].count;
+  }
+
+  float cost = 0.0f;
+  for (const auto &node : bvh.nodes) {
+    const float nodeCost = node.isLeaf() ? INTERSECTION_COST * node.count : TRAVERSAL_COST;
+    cost += nodeCost * node.bounds.surfaceArea() / rootArea;
+  }
+  return cost;
+}
+
+} // namespace utility
+} // namespace raytracer
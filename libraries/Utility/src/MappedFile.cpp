@@ -0,0 +1,99 @@
+#include "libraries/Utility/include/MappedFile.hpp"
+
+// Platform detection
+#if defined(_WIN32) || defined(_WIN64)
+  #define PLATFORM_WINDOWS
+  #include <windows.h>
+#elif defined(__APPLE__) || defined(__MACH__) || defined(__linux__) || defined(__unix__) || defined(__posix__)
+  #define PLATFORM_POSIX
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#else
+  #error "Unsupported platform"
+#endif
+
+namespace raytracer {
+namespace utility {
+
+namespace platform {
+
+#ifdef PLATFORM_WINDOWS
+const std::byte *mapFile(const std::string &path, size_t &size, void *&mapping) {
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return nullptr;
+  }
+  // The mapping object keeps the file open, so the file handle is not needed any more
+  mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr) {
+    return nullptr;
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == nullptr) {
+    CloseHandle(mapping);
+    mapping = nullptr;
+    return nullptr;
+  }
+  size = static_cast<size_t>(fileSize.QuadPart);
+  return static_cast<const std::byte *>(view);
+}
+
+void unmapFile(const std::byte *data, size_t, void *mapping) {
+  UnmapViewOfFile(data);
+  CloseHandle(mapping);
+}
+
+#elif defined(PLATFORM_POSIX)
+const std::byte *mapFile(const std::string &path, size_t &size, void *&mapping) {
+  const int file = open(path.c_str(), O_RDONLY);
+  if (file == -1) {
+    return nullptr;
+  }
+  struct stat fileStatus;
+  if (fstat(file, &fileStatus) != 0 || fileStatus.st_size == 0) {
+    close(file);
+    return nullptr;
+  }
+  // The mapping stays valid after the descriptor is closed
+  void *view = mmap(nullptr, static_cast<size_t>(fileStatus.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (view == MAP_FAILED) {
+    return nullptr;
+  }
+  size = static_cast<size_t>(fileStatus.st_size);
+  mapping = nullptr;
+  return static_cast<const std::byte *>(view);
+}
+
+void unmapFile(const std::byte *data, size_t size, void *) {
+  munmap(const_cast<std::byte *>(data), size);
+}
+
+#endif
+
+} // namespace platform
+
+MappedFile::MappedFile(const std::string &path) : data{nullptr}, size{0}, mapping{nullptr} {
+  data = platform::mapFile(path, size, mapping);
+  if (data == nullptr) {
+    size = 0;
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr) {
+    platform::unmapFile(data, size, mapping);
+  }
+}
+
+} // namespace utility
+} // namespace raytracer
@@ -0,0 +1,84 @@
+#include "libraries/Utility/include/WideBVH.hpp"
+
+namespace raytracer {
+namespace utility {
+
+namespace {
+
+template <uint32_t Width>
+uint32_t collapseNode(const BVH &bvh, const uint32_t binaryIndex, WideBVH<Width> &wide) noexcept {
+  const auto wideIndex = static_cast<uint32_t>(wide.nodes.size());
+  wide.nodes.emplace_back();
+
+  // Start from the two children and keep opening the interior child with the largest surface area, as it is the one
+  // most likely to be entered by a ray
+  uint32_t children[Width];
+  uint32_t childCount = 2;
+  children[0] = bvh.nodes[binaryIndex].leftOrFirst;
+  children[1] = children[0] + 1;
+  while (childCount < Width) {
+    int32_t largest = -1;
+    float largestArea = -1.0f;
+    for (uint32_t i = 0; i < childCount; ++i) {
+      const BVHNode &child = bvh.nodes[children[i]];
+      if (!child.isLeaf() && child.bounds.surfaceArea() > largestArea) {
+        largest = static_cast<int32_t>(i);
+        largestArea = child.bounds.surfaceArea();
+      }
+    }
+    if (largest == -1) {
+      break;
+    }
+    const uint32_t opened = bvh.nodes[children[largest]].leftOrFirst;
+    children[largest] = opened;
+    children[childCount++] = opened + 1;
+  }
+
+  // Interior children are collapsed first, the node is only written afterwards since that can grow wide.nodes
+  uint32_t childSlots[Width];
+  uint32_t childCounts[Width];
+  for (uint32_t i = 0; i < childCount; ++i) {
+    const BVHNode &child = bvh.nodes[children[i]];
+    childSlots[i] = child.isLeaf() ? child.leftOrFirst : collapseNode(bvh, children[i], wide);
+    childCounts[i] = child.count;
+  }
+
+  WideBVHNode<Width> &node = wide.nodes[wideIndex];
+  for (uint32_t i = 0; i < Width; ++i) {
+    const AABB bounds = i < childCount ? bvh.nodes[children[i]].bounds : AABB::empty();
+    node.bounds[0][i] = bounds.min.x;
+    node.bounds[1][i] = bounds.min.y;
+    node.bounds[2][i] = bounds.min.z;
+    node.bounds[3][i] = bounds.max.x;
+    node.bounds[4][i] = bounds.max.y;
+    node.bounds[5][i] = bounds.max.z;
+    node.child[i] = i < childCount ? childSlots[i] : 0;
+    node.count[i] = i < childCount ? childCounts[i] : 0;
+  }
+  return wideIndex;
+}
+
+} // namespace
+
+template <uint32_t Width>
+WideBVH<Width> collapseBVH(const BVH &bvh) noexcept {
+  WideBVH<Width> wide;
+  if (bvh.nodes.empty()) {
+    return wide;
+  }
+  if (bvh.nodes[0].isLeaf()) {
+    wide.rootLeafCount = bvh.nodes[0].count;
+    return wide;
+  }
+
+  // Every wide node replaces at least one binary interior node, of which there are fewer than half of all nodes
+  wide.nodes.reserve(bvh.nodes.size() / 2);
+  collapseNode(bvh, 0, wide);
+  return wide;
+}
+
+template WideBVH<4> collapseBVH<4>(const BVH &bvh) noexcept;
+template WideBVH<8> collapseBVH<8>(const BVH &bvh) noexcept;
+
+} // namespace utility
+} // namespace raytracer